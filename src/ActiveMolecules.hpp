@@ -27,8 +27,14 @@
 #include "similarities_input_placeholder.hpp"
 #include "molecule_input_placeholder.hpp"
 #include "CP.hpp"
+#include "sampled_cp.hpp"
+#include "descriptor_aps.hpp"
 #include "matrix.hpp"
+#include "symmetric_matrix.hpp"
+#include "jaccard_matrix.hpp"
 #include "algebra.hpp"
+#include "parallel.hpp"
+#include "instrument.hpp"
 
 #include <vector>
 #include <string>
@@ -36,6 +42,8 @@
 #include <utility>
 #include <tuple>
 #include <memory>
+#include <ostream>
+#include <cstdint>
 
 // essential state
 namespace
@@ -43,24 +51,145 @@ namespace
     SimilaritiesInputPlaceholder    g_similarities_input_placeholder;
 }
 
+struct RankOptions
+{
+    RankOptions()
+    :
+        n_workers(ThreadPool::default_workers()),
+        quantized(false),
+        knn(0),
+        descriptor_weight(0.0),
+        activity_thr_A_star(0.0),
+        cp_error_report(nullptr)
+    {
+        sampling.budget = 0;
+    }
+
+    // number of threads scoring test molecules
+    std::size_t n_workers;
+    // keep similarities as 8-bit bucket indices instead of doubles
+    bool quantized;
+    // score every test molecule against its knn most similar training
+    // molecules only (APSsim_knn), 0 uses the whole training set
+    std::size_t knn;
+    // weight of the mean descriptor APS (DescriptorAPS) added to the
+    // similarity scores, 0 leaves the descriptors out
+    double descriptor_weight;
+    // A*: training pairs whose normalized activities are at most this far
+    // apart agree, i.e. count towards the CPsim numerators
+    double activity_thr_A_star;
+    // CPsim curves from sampled pairs (SampledCPsimCurve) when the budget
+    // is not 0, otherwise from all training pairs
+    SamplingOptions sampling;
+    // where sampled CPsim curves list the error of every bucket's CP value,
+    // nullptr for nowhere
+    std::ostream * cp_error_report;
+};
+
 struct ActiveMolecules
 {
     typedef std::vector<std::string> molecule_array_type;
 
+    explicit ActiveMolecules(const RankOptions & options = RankOptions())
+    :
+        m_options(options)
+    {
+        g_similarities_input_placeholder.setQuantized(m_options.quantized);
+    }
+
+    const RankOptions & options() const
+    {
+        return m_options;
+    }
+
+    void
+    reserve(std::size_t n_molecules);
+
     int
     similarity(int & abs_index, std::vector<double> & row);
 
+    int
+    similarity(int abs_index, const double * cbegin, const double * cend);
+
     std::vector<int>
     rank(
         molecule_array_type & training_data,
         molecule_array_type & testing_data);
 
+    // rank against a similarity matrix supplied by the caller, e.g. a mapped file
+    template<typename _MatrixType>
+    std::vector<int>
+    rank(
+        molecule_array_type & training_data,
+        molecule_array_type & testing_data,
+        const std::unique_ptr<_MatrixType> & similarities) const;
+
+    /*
+     * rank with the similarity scores computed by the caller's `scorer`,
+     * e.g. OutOfCoreScorer, called as
+     *
+     *     scorer(train_data, test_data, n_features, activities, thread_pool, scores)
+     *
+     * with the normalized molecule matrices and `scores` holding a zero per
+     * test molecule. Descriptor scores are added to them as for rank().
+     */
+    template<typename _Scorer>
+    std::vector<int>
+    rank_scored(
+        molecule_array_type & training_data,
+        molecule_array_type & testing_data,
+        _Scorer && scorer) const;
+
 private:
-    std::vector<int> &&
+    std::vector<int>
     rank(
         molecule_array_type && training_data,
         molecule_array_type && testing_data,
         SimilaritiesInputPlaceholder && similarities_input_placeholder) const;
+
+    template<typename _SimilarityType>
+    std::vector<int>
+    rank_as(
+        molecule_array_type && training_data,
+        molecule_array_type && testing_data,
+        SimilaritiesInputPlaceholder && similarities_input_placeholder) const;
+
+    template<typename _MatrixType>
+    std::vector<int>
+    rank_with(
+        molecule_array_type && training_data,
+        molecule_array_type && testing_data,
+        const std::unique_ptr<_MatrixType> & similarities) const;
+
+    template<typename _Scorer>
+    std::vector<int>
+    rank_scored(
+        molecule_array_type && training_data,
+        molecule_array_type && testing_data,
+        _Scorer && scorer) const;
+
+private:
+    // `name` labels the curve in the cp_error_report
+    template<typename _MatrixType>
+    CPsimCurve<double, 101>
+    cpsim_curve(
+        const char * name,
+        const std::unique_ptr<_MatrixType> & similarities,
+        const std::valarray<double> & activities,
+        ThreadPool & thread_pool) const;
+
+    template<typename _MatrixType, typename _MoleculeMatrixType>
+    double
+    score_knn(
+        const std::size_t jidx,
+        const std::unique_ptr<_MatrixType> & similarities,
+        const _MoleculeMatrixType & train_data,
+        const double * test_features,
+        const std::vector<double> & train_norms,
+        const std::valarray<double> & activities) const;
+
+private:
+    const RankOptions m_options;
 };
 
 int
@@ -71,6 +200,20 @@ ActiveMolecules::similarity(int & abs_index, std::vector<double> & row)
     return abs_index;
 }
 
+void
+ActiveMolecules::reserve(std::size_t n_molecules)
+{
+    g_similarities_input_placeholder.allocate(n_molecules);
+}
+
+int
+ActiveMolecules::similarity(int abs_index, const double * cbegin, const double * cend)
+{
+    g_similarities_input_placeholder.takeFrom(abs_index, cbegin, cend);
+
+    return abs_index;
+}
+
 std::vector<int>
 ActiveMolecules::rank(
     ActiveMolecules::molecule_array_type & training_data,
@@ -79,15 +222,153 @@ ActiveMolecules::rank(
     return rank(std::move(training_data), std::move(testing_data), std::move(g_similarities_input_placeholder));
 }
 
-std::vector<int> &&
+template<typename _MatrixType>
+std::vector<int>
 ActiveMolecules::rank(
+    ActiveMolecules::molecule_array_type & training_data,
+    ActiveMolecules::molecule_array_type & testing_data,
+    const std::unique_ptr<_MatrixType> & similarities) const
+{
+    return rank_with(std::move(training_data), std::move(testing_data), similarities);
+}
+
+template<typename _Scorer>
+std::vector<int>
+ActiveMolecules::rank_scored(
+    ActiveMolecules::molecule_array_type & training_data,
+    ActiveMolecules::molecule_array_type & testing_data,
+    _Scorer && scorer) const
+{
+    return rank_scored(std::move(training_data), std::move(testing_data), scorer);
+}
+
+std::vector<int>
+ActiveMolecules::rank(
+    ActiveMolecules::molecule_array_type && training_data,
+    ActiveMolecules::molecule_array_type && testing_data,
+    SimilaritiesInputPlaceholder && similarities_input_placeholder) const
+{
+    if (m_options.quantized)
+    {
+        return rank_as<std::uint8_t>(std::move(training_data), std::move(testing_data), std::move(similarities_input_placeholder));
+    }
+    else
+    {
+        return rank_as<double>(std::move(training_data), std::move(testing_data), std::move(similarities_input_placeholder));
+    }
+}
+
+template<typename _SimilarityType>
+std::vector<int>
+ActiveMolecules::rank_as(
     ActiveMolecules::molecule_array_type && training_data,
     ActiveMolecules::molecule_array_type && testing_data,
     SimilaritiesInputPlaceholder && similarities_input_placeholder) const
+{
+    const std::unique_ptr<SymmetricMatrix2d<_SimilarityType>> similarities =
+        similarities_input_placeholder.template render<_SimilarityType>();
+
+    return rank_with(std::move(training_data), std::move(testing_data), similarities);
+}
+
+template<typename _MatrixType>
+std::vector<int>
+ActiveMolecules::rank_with(
+    ActiveMolecules::molecule_array_type && training_data,
+    ActiveMolecules::molecule_array_type && testing_data,
+    const std::unique_ptr<_MatrixType> & similarities) const
+{
+    typedef typename _MatrixType::value_type similarity_type;
+    typedef MoleculeInputPlaceholder::matrix_type molecule_matrix_type;
+
+    return rank_scored(std::move(training_data), std::move(testing_data),
+        [this, &similarities](
+            const molecule_matrix_type & train_data,
+            const molecule_matrix_type & test_data,
+            const std::size_t n_features,
+            const std::valarray<double> & activities,
+            ThreadPool & thread_pool,
+            std::vector<double> & scores)
+        {
+            const std::size_t X = train_data.rows();
+
+            AM_PHASE_SEQUENCE();
+
+            if (m_options.knn != 0)
+            {
+                AM_NEXT_PHASE("knn_scoring");
+
+                // Jaccards of the few pairs each test molecule needs are computed
+                // on the fly instead of building the O(X^2) matrix
+                std::vector<double> train_norms(X);
+
+                for (std::size_t idx{0}; idx < X; ++idx)
+                {
+                    train_norms[idx] = squared_norm(train_data.row_cbegin(idx), n_features);
+                }
+
+                thread_pool.parallel_for(0, scores.size(),
+                    [&](const std::size_t idx)
+                    {
+                        scores[idx] =
+                            score_knn(idx + X, similarities,
+                                train_data, test_data.row_cbegin(idx), train_norms, activities);
+                    }
+                );
+            }
+            else
+            {
+                AM_NEXT_PHASE("jaccard_matrix");
+
+                const std::unique_ptr<SymmetricMatrix2d<similarity_type>> jaccards =
+                    build_jaccard_matrix<similarity_type>(train_data, test_data, n_features, thread_pool);
+
+                AM_NEXT_PHASE("cpsim_curves");
+
+                const CPsimCurve<double, 101> similarities_curve =
+                    cpsim_curve("similarities", similarities, activities, thread_pool);
+                const CPsimCurve<double, 101> jaccards_curve =
+                    cpsim_curve("jaccards", jaccards, activities, thread_pool);
+
+                AM_NEXT_PHASE("apssim_scoring");
+
+                thread_pool.parallel_for(0, scores.size(),
+                    [&](const std::size_t idx)
+                    {
+                        scores[idx] =
+                            APSsim(
+                                idx + X,
+                                similarities_curve,
+                                similarities,
+                                activities
+                            );
+                        scores[idx] +=
+                            APSsim(
+                                idx + X,
+                                jaccards_curve,
+                                jaccards,
+                                activities
+                            );
+                    },
+                    16
+                );
+            }
+        }
+    );
+}
+
+template<typename _Scorer>
+std::vector<int>
+ActiveMolecules::rank_scored(
+    ActiveMolecules::molecule_array_type && training_data,
+    ActiveMolecules::molecule_array_type && testing_data,
+    _Scorer && scorer) const
 {
     constexpr std::size_t ACTIVITY_INDEX{21};
     const molecule_array_type::size_type TESTING_DATA_SIZE = testing_data.size();
-    const molecule_array_type::size_type TRAINING_DATA_SIZE = training_data.size();
+
+    AM_PHASE_SEQUENCE();
+    AM_NEXT_PHASE("render_molecules");
 
     MoleculeInputPlaceholder molecules_for_training_input_placeholder;
     MoleculeInputPlaceholder molecules_for_testing_input_placeholder;
@@ -95,63 +376,54 @@ ActiveMolecules::rank(
     molecules_for_training_input_placeholder.takeFrom(std::move(training_data));
     molecules_for_testing_input_placeholder.takeFrom(std::move(testing_data));
 
-    const std::unique_ptr<Matrix2d<double>> similarities = similarities_input_placeholder.render();
-    std::unique_ptr<Matrix2d<double>> unn_train_data = molecules_for_training_input_placeholder.render();
-    std::unique_ptr<Matrix2d<double>> unn_test_data = molecules_for_testing_input_placeholder.render();
+    typedef MoleculeInputPlaceholder::matrix_type molecule_matrix_type;
 
-    const std::unique_ptr<Matrix2d<double>> train_data = normalize_columns(std::move(unn_train_data));
-    const std::unique_ptr<Matrix2d<double>> test_data = normalize_columns(std::move(unn_test_data));
-//    const std::unique_ptr<Matrix2d<double>> train_data{std::move(unn_train_data)};
-//    const std::unique_ptr<Matrix2d<double>> test_data{std::move(unn_test_data)};
+    // parsed and normalized in one pass
+    const std::unique_ptr<molecule_matrix_type> train_data = molecules_for_training_input_placeholder.render_normalized();
+    const std::unique_ptr<molecule_matrix_type> test_data = molecules_for_testing_input_placeholder.render_normalized();
 
     const std::valarray<double> activities = train_data->col(ACTIVITY_INDEX);
 
-    typedef std::tuple<std::size_t, double, std::valarray<double>> scored_tuple_type;
-    std::vector<scored_tuple_type> scored_tuples;
-    scored_tuples.reserve(TESTING_DATA_SIZE);
+    ThreadPool thread_pool(m_options.n_workers);
 
-    for (std::size_t idx{0}; idx < TESTING_DATA_SIZE; ++idx)
-    {
-        scored_tuples.push_back(std::make_tuple(idx + train_data->rows(), 0.0, test_data->row(idx)));
-    }
+    // the scorer times its own phases
+    AM_END_PHASES();
+
+    std::vector<double> scores(TESTING_DATA_SIZE, 0.0);
 
-    std::unique_ptr<Matrix2d<double>> jaccards(new Matrix2d<double>(TRAINING_DATA_SIZE, TRAINING_DATA_SIZE));
+    // the activity column is not a descriptor and is unknown for test molecules
+    scorer(*train_data, *test_data, ACTIVITY_INDEX, activities, thread_pool, scores);
 
-    for (std::size_t iidx{0}; iidx < TRAINING_DATA_SIZE; ++iidx)
+    if (m_options.descriptor_weight != 0.0)
     {
-        const std::valarray<double> irow = train_data->row(iidx);
+        AM_NEXT_PHASE("descriptor_scoring");
 
-        for (std::size_t jidx{iidx}; jidx < TRAINING_DATA_SIZE; ++jidx)
+        const DescriptorAPS<double, 101> descriptor_aps(*train_data, ACTIVITY_INDEX, activities,
+            m_options.activity_thr_A_star, thread_pool);
+        const std::unique_ptr<Matrix2d<double>> descriptor_scores = descriptor_aps.score(*test_data, thread_pool);
+
+        for (std::size_t idx{0}; idx < TESTING_DATA_SIZE; ++idx)
         {
-            double v = jaccard(irow, train_data->row(jidx));
-            jaccards->write(iidx, jidx, v);
-            jaccards->write(jidx, iidx, v);
+            double score{0.0};
+
+            for (std::size_t col{0}; col < ACTIVITY_INDEX; ++col)
+            {
+                score += descriptor_scores->at(idx, col);
+            }
+
+            scores[idx] += m_options.descriptor_weight * score / ACTIVITY_INDEX;
         }
     }
 
+    AM_NEXT_PHASE("sort");
+
+    typedef std::tuple<std::size_t, double> scored_tuple_type;
+    std::vector<scored_tuple_type> scored_tuples;
+    scored_tuples.reserve(TESTING_DATA_SIZE);
+
     for (std::size_t idx{0}; idx < TESTING_DATA_SIZE; ++idx)
     {
-//        auto kernel = [](const double & lhs, const double & rhs)
-//        {
-////            return fabs(lhs) >= rhs;
-//            return fabs(lhs) <= rhs;
-////            return (lhs) >= rhs;
-////            return (lhs) <= rhs;
-//        };
-        std::get<1>(scored_tuples[idx]) =
-            APSsim(
-                std::get<0>(scored_tuples[idx]),
-                0.0,
-                similarities,
-                activities
-            );
-        std::get<1>(scored_tuples[idx]) +=
-            APSsim(
-                std::get<0>(scored_tuples[idx]),
-                0.0,
-                jaccards,
-                activities
-            );
+        scored_tuples.push_back(std::make_tuple(idx + train_data->rows(), scores[idx]));
     }
 
     std::sort(scored_tuples.begin(), scored_tuples.end(),
@@ -161,7 +433,8 @@ ActiveMolecules::rank(
         }
     );
 
-    static std::vector<int> result;
+    std::vector<int> result;
+    result.reserve(TESTING_DATA_SIZE);
     std::transform(scored_tuples.cbegin(), scored_tuples.cend(),
         std::back_inserter(result),
         [](const scored_tuple_type & item)
@@ -170,7 +443,103 @@ ActiveMolecules::rank(
         }
     );
 
-    return std::move(result);
+    return result;
+}
+
+/*
+ * The cp_error_report lists a sampled curve as a header line followed by
+ * one line per bucket: the similarity threshold, the CP value, its
+ * confidence interval half-width and the sampled pairs behind it.
+ */
+template<typename _MatrixType>
+CPsimCurve<double, 101>
+ActiveMolecules::cpsim_curve(
+    const char * name,
+    const std::unique_ptr<_MatrixType> & similarities,
+    const std::valarray<double> & activities,
+    ThreadPool & thread_pool) const
+{
+    typedef SampledCPsimCurve<double, 101> sampled_type;
+
+    if (m_options.sampling.budget != 0)
+    {
+        const sampled_type sampled(m_options.activity_thr_A_star, similarities, activities, m_options.sampling);
+
+        if (m_options.cp_error_report != nullptr)
+        {
+            std::ostream & report = *m_options.cp_error_report;
+
+            report << "# " << name << " CPsim curve, " << sampled.drawn()
+                << (sampled.exact() ? " pairs, exact" : " sampled pairs") << "\n";
+
+            // byte codes are the bucket indices
+            for (std::size_t bucket{0}; bucket < sampled_type::N; ++bucket)
+            {
+                const std::uint8_t code = bucket;
+
+                report << SimilarityCodec<std::uint8_t>::decode(code) << ' ' << sampled.at(code) << ' '
+                    << sampled.error_at(code) << ' ' << sampled.pairs_at(code) << "\n";
+            }
+
+            report << std::flush;
+        }
+
+        return sampled.curve();
+    }
+    else
+    {
+        return CPsimCurve<double, 101>(m_options.activity_thr_A_star, similarities, activities, thread_pool);
+    }
+}
+
+/*
+ * Sum of the similarity and Jaccard APSsim_knn of the test molecule at
+ * absolute index `jidx`, whose normalized row is `test_features`.
+ */
+template<typename _MatrixType, typename _MoleculeMatrixType>
+double
+ActiveMolecules::score_knn(
+    const std::size_t jidx,
+    const std::unique_ptr<_MatrixType> & similarities,
+    const _MoleculeMatrixType & train_data,
+    const double * test_features,
+    const std::vector<double> & train_norms,
+    const std::valarray<double> & activities) const
+{
+    typedef SimilarityCodec<typename _MatrixType::value_type> codec_type;
+
+    constexpr std::size_t N_FEATURES{21};
+    const std::size_t X = train_data.rows();
+
+    std::vector<double> similarity_to(X);
+
+    for (std::size_t iidx{0}; iidx < X; ++iidx)
+    {
+        similarity_to[iidx] = codec_type::decode(similarities->at(iidx, jidx));
+    }
+
+    double score = APSsim_knn<double, 101>(similarity_to, m_options.knn,
+        [&similarities](const std::size_t lhs, const std::size_t rhs)
+        {
+            return codec_type::decode(similarities->at(lhs, rhs));
+        },
+        m_options.activity_thr_A_star, activities);
+
+    const double test_norm = squared_norm(test_features, N_FEATURES);
+
+    for (std::size_t iidx{0}; iidx < X; ++iidx)
+    {
+        similarity_to[iidx] = jaccard(train_data.row_cbegin(iidx), test_features, N_FEATURES, train_norms[iidx], test_norm);
+    }
+
+    score += APSsim_knn<double, 101>(similarity_to, m_options.knn,
+        [&train_data, &train_norms](const std::size_t lhs, const std::size_t rhs)
+        {
+            return jaccard(train_data.row_cbegin(lhs), train_data.row_cbegin(rhs), N_FEATURES, train_norms[lhs], train_norms[rhs]);
+        },
+        m_options.activity_thr_A_star, activities);
+
+    return score;
 }
 
 #endif /* ACTIVEMOLECULES_HPP_ */
@@ -25,13 +25,21 @@
 #define CP_HPP_
 
 #include "matrix.hpp"
+#include "algebra.hpp"
 #include "cache.hpp"
+#include "instrument.hpp"
+#include "simd.hpp"
+#include "quantize.hpp"
+#include "pair_scheduler.hpp"
 
 #include <cstddef>
+#include <cstdint>
 #include <valarray>
 #include <utility>
 #include <memory>
 #include <algorithm>
+#include <vector>
+#include <type_traits>
 
 #pragma GCC optimize ( "-ffast-math" )
 #pragma GCC optimize ( "-Ofast" )
@@ -57,6 +65,46 @@ _ValueType jaccard(
     return fabs(result);
 }
 
+template<typename _ValueType>
+_ValueType distance(
+    const StridedView<const _ValueType> & lhs,
+    const StridedView<const _ValueType> & rhs
+    )
+{
+    _ValueType lhs_sq{0};
+    _ValueType rhs_sq{0};
+    _ValueType inner{0};
+
+    for (std::size_t idx{0}; idx < lhs.size(); ++idx)
+    {
+        lhs_sq += lhs[idx] * lhs[idx];
+        rhs_sq += rhs[idx] * rhs[idx];
+        inner += lhs[idx] * rhs[idx];
+    }
+
+    return sqrt(lhs_sq + rhs_sq - 2 * inner);
+}
+
+template<typename _ValueType>
+_ValueType jaccard(
+    const StridedView<const _ValueType> & lhs,
+    const StridedView<const _ValueType> & rhs
+    )
+{
+    _ValueType lhs_sq{0};
+    _ValueType rhs_sq{0};
+    _ValueType inter{0};
+
+    for (std::size_t idx{0}; idx < lhs.size(); ++idx)
+    {
+        lhs_sq += lhs[idx] * lhs[idx];
+        rhs_sq += rhs[idx] * rhs[idx];
+        inter += lhs[idx] * rhs[idx];
+    }
+
+    return fabs(inter / (lhs_sq + rhs_sq - inter));
+}
+
 template<typename _ValueType, std::size_t _N>
 struct MinMaxIndexer
 {
@@ -68,7 +116,7 @@ struct MinMaxIndexer
     explicit MinMaxIndexer(const value_type & min, const value_type & max)
     :
         m_min(min),
-        m_width(max)
+        m_width(max - min)
     {
 
     }
@@ -93,264 +141,1301 @@ private:
     const value_type m_width;
 };
 
-template<typename _ValueType, typename _Compare>
-_ValueType CP(
-    const _ValueType distance,
-    const _ValueType activity_thr_A_star,
-    const std::valarray<_ValueType> & distances,
-    const std::valarray<_ValueType> & activities,
-    _Compare compare
-    )
+/*
+ * Row kernels, counting the pairs of row i against n columns: `values`
+ * are compared against `threshold` by _Compare, as `value_i - values[j]`
+ * with _Difference and as `values[j]` otherwise, and the activities are
+ * tested by _Agree. RowKernel picks the kernel at compile time: the
+ * vector kernels of simd.hpp when the element type, comparator and
+ * activity criterion have them, the scalar loop for everything else.
+ */
+struct VectorKernelTag {};
+struct ByteKernelTag {};
+struct ScalarKernelTag {};
+
+template<typename _ElementType, typename _ValueType, bool _Difference, typename _Compare, typename _Agree>
+struct RowKernel
 {
-    typedef std::size_t size_type;
-    typedef _ValueType value_type;
+    typedef typename std::conditional<
+        std::is_same<_ElementType, double>::value && std::is_same<_ValueType, double>::value &&
+            is_simd_comparator<_Compare>::value && is_simd_criterion<_Agree>::value,
+        VectorKernelTag,
+        typename std::conditional<
+            std::is_same<_ElementType, std::uint8_t>::value && std::is_same<_ValueType, double>::value &&
+                !_Difference && std::is_same<_Compare, GreaterEqual>::value && is_simd_criterion<_Agree>::value,
+            ByteKernelTag,
+            ScalarKernelTag
+        >::type
+    >::type tag;
+};
 
-    auto compare_A = [](const double & lhs, const double & rhs)
-    {
-        return fabs(lhs) <= rhs;
-    };
+template<bool _Difference, typename _Compare, typename _Agree>
+inline
+void count_row(
+    const _Compare &,
+    const _Agree &,
+    const double * values,
+    const double * activities,
+    const std::size_t n,
+    const double value_i,
+    const double activity_i,
+    const double threshold,
+    const double activity_thr_A_star,
+    PairCounts & counts,
+    VectorKernelTag)
+{
+    PairCountKernel<_Compare, _Difference, _Agree>::count(
+        values, activities, n, value_i, activity_i, threshold, activity_thr_A_star, counts);
+}
+
+template<bool _Difference, typename _Compare, typename _Agree>
+inline
+void count_row(
+    const _Compare &,
+    const _Agree &,
+    const std::uint8_t * values,
+    const double * activities,
+    const std::size_t n,
+    const std::uint8_t,
+    const double activity_i,
+    const std::uint8_t threshold,
+    const double activity_thr_A_star,
+    PairCounts & counts,
+    ByteKernelTag)
+{
+    ByteCountKernel<_Agree>::count(values, activities, n, threshold, activity_i, activity_thr_A_star, counts);
+}
 
-    auto constexpr round_up = [](const size_type & what, const size_type & mult) -> size_type
+template<bool _Difference, typename _Compare, typename _Agree, typename _ElementType, typename _ValueType>
+inline
+void count_row(
+    const _Compare & compare,
+    const _Agree & agree,
+    const _ElementType * values,
+    const _ValueType * activities,
+    const std::size_t n,
+    const _ElementType value_i,
+    const _ValueType activity_i,
+    const _ElementType threshold,
+    const _ValueType activity_thr_A_star,
+    PairCounts & counts,
+    ScalarKernelTag)
+{
+    for (std::size_t jidx{0}; jidx < n; ++jidx)
     {
-        return
-            what % mult ?
-                what + mult - what % mult
-                :
-                what;
-    };
+        const bool Dist_i_j = compare(_Difference ? value_i - values[jidx] : values[jidx], threshold);
+        const bool Delta_A_i_j_LE_A_star = agree(activity_i, activities[jidx], activity_thr_A_star);
 
-    const size_type N = activities.size();
+        counts.denominator += Dist_i_j;
+        counts.numerator += Dist_i_j & Delta_A_i_j_LE_A_star;
+    }
+}
+
+/*
+ * Pair sources, i.e. where the value compared for a pair (i, j), i < j,
+ * comes from. row(i) is indexed with absolute column numbers.
+ */
+
+// features[i] - features[j] of a single descriptor, as in CP
+template<typename _ValueType>
+struct DifferenceSource
+{
+    typedef std::size_t size_type;
+    typedef _ValueType element_type;
 
-    size_type numerator{0};
-    size_type denominator{0};
+    static constexpr bool DIFFERENCE{true};
 
-    std::valarray<std::pair<value_type, value_type>> local_data;
-    local_data.resize(N);
-    for (size_type idx{0}; idx < local_data.size(); ++idx)
+    explicit DifferenceSource(const element_type * values)
+    :
+        m_values(values)
     {
-        local_data[idx] = std::make_pair(distances[idx], activities[idx]);
     }
 
-    const std::pair<value_type, value_type> * local_data_p = &local_data[0];
+    const element_type * row(const size_type) const
+    {
+        return m_values;
+    }
 
-    for (size_type iidx{0}; iidx < (N - 1); ++iidx)
+    element_type value(const size_type iidx) const
     {
-        value_type distance_iidx = local_data_p[iidx].first;
-        value_type activity_iidx = local_data_p[iidx].second;
+        return m_values[iidx];
+    }
 
-        constexpr size_type ALIGN_VALUE{8};
-        const size_type total_trips = N - (iidx + 1);
-        const size_type initial_trip_count = round_up(iidx + 1, ALIGN_VALUE) - (iidx + 1);
-        const size_type initial_trip_limit = initial_trip_count + (iidx + 1);
-        const size_type final_trip_count = (total_trips - initial_trip_count) % ALIGN_VALUE;
-        const size_type core_trip_count = total_trips - initial_trip_count - final_trip_count;
-        const size_type core_trip_limit = initial_trip_limit + core_trip_count;
-//        std::cout << total_trips << " = " << initial_trip_count << " + " << core_trip_count << " + " << final_trip_count << ", start=" << (iidx + 1) << std::endl;
-//        std::cout << initial_trip_limit << " / " << core_trip_limit << " / " << N << std::endl;
+    template<typename _ThresholdType>
+    element_type encode(const _ThresholdType & threshold) const
+    {
+        return threshold;
+    }
 
-        size_type jidx{iidx + 1};
+private:
+    const element_type * m_values;
+};
 
-        for (; jidx < initial_trip_limit; ++jidx)
-        {
-            bool Dist_i_j_GE_min_dist_x = compare((distance_iidx - local_data_p[jidx].first), (distance));
-            bool Delta_A_i_j_LE_A_star = compare_A((activity_iidx - local_data_p[jidx].second), activity_thr_A_star);
+// matrix elements (i, j), as in CPsim; byte matrices compare bucket codes
+template<typename _MatrixType>
+struct MatrixSource
+{
+    typedef std::size_t size_type;
+    typedef typename _MatrixType::value_type element_type;
 
-            denominator += Dist_i_j_GE_min_dist_x;
-            numerator += Delta_A_i_j_LE_A_star * Dist_i_j_GE_min_dist_x;
-        }
-        for (; jidx < core_trip_limit; jidx += ALIGN_VALUE)
-        {
-            for (size_type vidx{0}; vidx < ALIGN_VALUE; ++vidx)
-            {
-                bool Dist_i_j_GE_min_dist_x = compare((distance_iidx - local_data_p[jidx + vidx].first), (distance));
-                bool Delta_A_i_j_LE_A_star = compare_A((activity_iidx - local_data_p[jidx + vidx].second), activity_thr_A_star);
+    static constexpr bool DIFFERENCE{false};
 
-                denominator += Dist_i_j_GE_min_dist_x;
-                numerator += Delta_A_i_j_LE_A_star * Dist_i_j_GE_min_dist_x;
-            }
-        }
-        for (; jidx < N; ++jidx)
-        {
-            bool Dist_i_j_GE_min_dist_x = compare((distance_iidx - local_data_p[jidx].first), (distance));
-            bool Delta_A_i_j_LE_A_star = compare_A((activity_iidx - local_data_p[jidx].second), activity_thr_A_star);
+    explicit MatrixSource(const _MatrixType & matrix)
+    :
+        m_matrix(matrix)
+    {
+    }
 
-            denominator += Dist_i_j_GE_min_dist_x;
-            numerator += Delta_A_i_j_LE_A_star * Dist_i_j_GE_min_dist_x;
-        }
+    const element_type * row(const size_type iidx) const
+    {
+        return m_matrix.upper_row_cbegin(iidx);
     }
 
-    const value_type result = denominator != 0 ? (value_type)numerator / denominator : 0.0;
+    element_type value(const size_type) const
+    {
+        return element_type();
+    }
 
-    return result;
-}
+    template<typename _ThresholdType>
+    element_type encode(const _ThresholdType & threshold) const
+    {
+        return SimilarityCodec<element_type>::encode(threshold);
+    }
 
+private:
+    const _MatrixType & m_matrix;
+};
 
-template<typename _ValueType, typename _Compare>
-_ValueType APS(
-    const std::size_t jidx,
-    const _ValueType activity_thr_A_star,
-    const std::valarray<_ValueType> & features,
-    const std::valarray<_ValueType> & activities,
-    _Compare compare
-    )
+/*
+ * Cache policies for the per molecule CP lookups of APS: NoCache computes
+ * every value, BucketCache keeps one CP per bucket of _N evenly spaced
+ * buckets over the threshold range.
+ */
+struct NoCache
 {
-    typedef std::size_t size_type;
-    typedef _ValueType value_type;
+    template<typename _KeyType, typename _Function>
+    auto lookup(const _KeyType &, _Function && compute) -> decltype(compute())
+    {
+        return compute();
+    }
+};
 
-    const std::valarray<value_type> distances = features - features[jidx];
-//    distances.apply(fabs);
+template<typename _ValueType, std::size_t _N>
+struct BucketCache
+{
+    typedef _ValueType value_type;
 
-    Cache<value_type, 51> cache;
-    MinMaxIndexer<value_type, 51> cache_indexer(std::minmax_element(std::begin(distances), std::end(distances)));
+    BucketCache(const value_type & min, const value_type & max)
+    :
+        m_indexer(min, max)
+    {
+    }
 
-    std::valarray<value_type> CPs;
-    CPs.resize(activities.size());
+    template<typename _Iterator>
+    explicit BucketCache(const std::pair<_Iterator, _Iterator> & min_max)
+    :
+        m_indexer(min_max)
+    {
+    }
 
-    for (std::size_t iidx{0}; iidx < CPs.size(); ++iidx)
+    template<typename _Function>
+    value_type lookup(const value_type & key, _Function && compute)
     {
-        size_type cache_idx = cache_indexer.indexFor(distances[iidx]);
+        const std::size_t cache_idx = m_indexer.indexFor(key);
 
-        if (!cache.isOccupiedAt(cache_idx))
+        if (!m_cache.isOccupiedAt(cache_idx))
         {
-            CPs[iidx] = CP(distances[iidx], activity_thr_A_star, distances, activities, compare);
-            cache.write(cache_idx, CPs[iidx]);
+            AM_COUNT(CACHE_MISSES, 1);
+            m_cache.write(cache_idx, compute());
         }
         else
         {
-            CPs[iidx] = cache.read(cache_idx);
+            AM_COUNT(CACHE_HITS, 1);
         }
-//        std::cout << "CP " << iidx << ": " << CPs[iidx] << std::endl;
+
+        return m_cache.read(cache_idx);
+    }
+
+private:
+    Cache<value_type, _N> m_cache;
+    MinMaxIndexer<value_type, _N> m_indexer;
+};
+
+/*
+ * Numerator and denominator of an APS, summed in the order the molecules
+ * are added. Every APS sums this way, so code producing the CP values in
+ * another arrangement, e.g. a sweep over matrix tiles, can reproduce the
+ * scores exactly as long as it adds each molecule's terms in order. Kept
+ * out of -ffast-math so the compiler does not reassociate the sums.
+ */
+#pragma GCC push_options
+#pragma GCC optimize("-fno-fast-math", "-ffp-contract=off")
+
+template<typename _ValueType>
+struct APSSums
+{
+    typedef _ValueType value_type;
+
+    APSSums()
+    :
+        m_numerator(0.0),
+        m_denominator(0.0)
+    {
+    }
+
+    void add(const value_type activity, const value_type CP)
+    {
+        m_numerator += activity * CP;
+        m_denominator += CP;
+    }
+
+    value_type numerator() const
+    {
+        return m_numerator;
+    }
+
+    value_type denominator() const
+    {
+        return m_denominator;
     }
 
-    const value_type numerator = (activities * CPs).sum();
-    const value_type denominator = CPs.sum();
+    value_type result() const
+    {
+        return m_numerator / m_denominator;
+    }
+
+private:
+    value_type m_numerator;
+    value_type m_denominator;
+};
+
+#pragma GCC pop_options
+
+/*
+ * Activity weighted mean of engine.CP(threshold_of(i)) over N molecules,
+ * shared by the APS of all engines.
+ */
+template<typename _Engine, typename _ValueType, typename _ThresholdFunction, typename _Cache>
+_ValueType weighted_APS(
+    const _Engine & engine,
+    const _ValueType * activities,
+    const std::size_t N,
+    _ThresholdFunction && threshold_of,
+    _Cache & cache)
+{
+    typedef _ValueType value_type;
+
+    APSSums<value_type> sums;
 
-    const value_type  result = numerator / denominator;
+    for (std::size_t iidx{0}; iidx < N; ++iidx)
+    {
+        const value_type threshold = threshold_of(iidx);
 
-//    std::cout << "APS " << result << std::endl;
+        sums.add(activities[iidx], cache.lookup(threshold, [&engine, threshold](){ return engine.CP(threshold); }));
+    }
 
-    return result;
+    return sums.result();
 }
 
-template<typename _ValueType>
-_ValueType CPsim(
-    const _ValueType distance,
-    const _ValueType activity_thr_A_star,
-    const std::unique_ptr<Matrix2d<double>> & similarities,
-    const std::valarray<_ValueType> & activities
-    )
+/*
+ * CP and APS over the i < j pairs of N molecules, with the pair source,
+ * the comparator, the activity criterion and (for APS) the cache as
+ * compile-time policies. Every combination runs the row kernel RowKernel
+ * selects for it, serially or tiled over a ThreadPool.
+ */
+template<typename _ValueType, typename _Source, typename _Compare, typename _Agree = ActivityWithin>
+struct CPEngine
 {
     typedef std::size_t size_type;
     typedef _ValueType value_type;
+    typedef typename _Source::element_type element_type;
+    typedef typename RowKernel<element_type, value_type, _Source::DIFFERENCE, _Compare, _Agree>::tag kernel_tag;
+
+    CPEngine(
+        const _Source & source,
+        const value_type * activities,
+        const size_type N,
+        const value_type activity_thr_A_star,
+        const _Compare & compare = _Compare(),
+        const _Agree & agree = _Agree())
+    :
+        m_source(source),
+        m_activities(activities),
+        m_N(N),
+        m_activity_thr_A_star(activity_thr_A_star),
+        m_compare(compare),
+        m_agree(agree)
+    {
+    }
 
-    auto compare_A = [](const double & lhs, const double & rhs)
+    void count(const PairTile & tile, const element_type threshold, PairCounts & counts) const
     {
-        return fabs(lhs) <= rhs;
-    };
+        // locals keep the row loop free of reloads through `this`
+        const value_type * activities = m_activities;
+        const value_type activity_thr_A_star = m_activity_thr_A_star;
+        PairCounts tile_counts{0, 0};
+
+        for (size_type iidx{tile.row_begin}; iidx < tile.row_end; ++iidx)
+        {
+            const size_type col_begin = std::max(tile.col_begin, iidx + 1);
+
+            if (col_begin < tile.col_end)
+            {
+                count_row<_Source::DIFFERENCE>(m_compare, m_agree,
+                    m_source.row(iidx) + col_begin, activities + col_begin, tile.col_end - col_begin,
+                    m_source.value(iidx), activities[iidx], threshold, activity_thr_A_star, tile_counts,
+                    kernel_tag());
+            }
+        }
+
+        counts += tile_counts;
+    }
 
-    auto constexpr round_up = [](const size_type & what, const size_type & mult) -> size_type
+    value_type CP(const value_type threshold) const
     {
-        return
-            what % mult ?
-                what + mult - what % mult
-                :
-                what;
-    };
+        PairCounts counts{0, 0};
 
-    const size_type N = activities.size();
+        AM_COUNT(PAIRS_VISITED, m_N * (m_N - 1) / 2);
+
+        count(PairTile{0, m_N, 0, m_N}, m_source.encode(threshold), counts);
 
-    size_type numerator{0};
-    size_type denominator{0};
+        return ratio(counts);
+    }
 
-    for (size_type iidx{0}; iidx < (N - 1); ++iidx)
+    value_type CP(const value_type threshold, ThreadPool & thread_pool) const
     {
-        value_type activity_iidx = activities[iidx];
+        const element_type encoded = m_source.encode(threshold);
 
-        constexpr size_type ALIGN_VALUE{8};
-        const size_type total_trips = N - (iidx + 1);
-        const size_type initial_trip_count = round_up(iidx + 1, ALIGN_VALUE) - (iidx + 1);
-        const size_type initial_trip_limit = initial_trip_count + (iidx + 1);
-        const size_type final_trip_count = (total_trips - initial_trip_count) % ALIGN_VALUE;
-        const size_type core_trip_count = total_trips - initial_trip_count - final_trip_count;
-        const size_type core_trip_limit = initial_trip_limit + core_trip_count;
+        AM_COUNT(PAIRS_VISITED, m_N * (m_N - 1) / 2);
 
-        size_type jidx{iidx + 1};
+        return ratio(reduce_tiles(thread_pool, TriangleTiling(m_N, m_N), PairCounts{0, 0},
+            [this, encoded](const PairTile & tile, PairCounts & partial)
+            {
+                count(tile, encoded, partial);
+            }
+        ));
+    }
 
-        for (; jidx < initial_trip_limit; ++jidx)
-        {
-            bool Dist_i_j_GE_min_dist_x = similarities->at(iidx, jidx) >= distance;
-            bool Delta_A_i_j_LE_A_star = compare_A(activity_iidx - activities[jidx], activity_thr_A_star);
+    /*
+     * Activity weighted mean of CP(threshold_of(i)) over all molecules,
+     * the CP values looked up through `cache`.
+     */
+    template<typename _ThresholdFunction, typename _Cache>
+    value_type APS(_ThresholdFunction && threshold_of, _Cache & cache) const
+    {
+        return weighted_APS(*this, m_activities, m_N, threshold_of, cache);
+    }
 
-            denominator += Dist_i_j_GE_min_dist_x;
-            numerator += Delta_A_i_j_LE_A_star * Dist_i_j_GE_min_dist_x;
-        }
-        for (; jidx < core_trip_limit; jidx += ALIGN_VALUE)
+private:
+    static value_type ratio(const PairCounts & counts)
+    {
+        return counts.denominator != 0 ? (value_type)counts.numerator / counts.denominator : 0.0;
+    }
+
+private:
+    const _Source m_source;
+    const value_type * m_activities;
+    const size_type m_N;
+    const value_type m_activity_thr_A_star;
+    const _Compare m_compare;
+    const _Agree m_agree;
+};
+
+/*
+ * Bitset of the i < j pairs of N molecules whose activities agree under
+ * _Agree, row i holding bit j % 64 of word j / 64 for every column j > i.
+ * Agreement does not depend on the similarity threshold, so a bitset
+ * built once serves all CPsim evaluations with the same activities and
+ * A*, see AgreementMaskEngine. Rows are kept whole, N^2 / 8 bytes, so
+ * that words line up with absolute column numbers.
+ */
+struct ActivityAgreementMask
+{
+    typedef std::size_t size_type;
+    typedef std::uint64_t word_type;
+
+    static constexpr size_type WORD_BITS{64};
+
+    template<typename _ValueType, typename _Agree = ActivityWithin>
+    ActivityAgreementMask(
+        const _ValueType * activities,
+        const size_type N,
+        const _ValueType activity_thr_A_star,
+        const _Agree & agree = _Agree())
+    :
+        m_N(N),
+        m_words((N + WORD_BITS - 1) / WORD_BITS),
+        m_bits(N * m_words, 0)
+    {
+        for (size_type iidx{0}; iidx < N; ++iidx)
         {
-            for (size_type vidx{0}; vidx < ALIGN_VALUE; ++vidx)
+            const _ValueType activity_iidx = activities[iidx];
+            word_type * row = &m_bits[iidx * m_words];
+
+            for (size_type widx{(iidx + 1) / WORD_BITS}; widx < m_words; ++widx)
             {
-                bool Dist_i_j_GE_min_dist_x = similarities->at(iidx, jidx) >= distance;
-                bool Delta_A_i_j_LE_A_star = compare_A(activity_iidx - activities[jidx], activity_thr_A_star);
+                const size_type first = widx * WORD_BITS;
+                word_type bits{0};
 
-                denominator += Dist_i_j_GE_min_dist_x;
-                numerator += Delta_A_i_j_LE_A_star * Dist_i_j_GE_min_dist_x;
+                for (size_type jidx{std::max(first, iidx + 1)}; jidx < std::min(first + WORD_BITS, N); ++jidx)
+                {
+                    bits |= word_type(agree(activity_iidx, activities[jidx], activity_thr_A_star)) << (jidx - first);
+                }
+
+                row[widx] = bits;
             }
         }
-        for (; jidx < N; ++jidx)
-        {
-            bool Dist_i_j_GE_min_dist_x = similarities->at(iidx, jidx) >= distance;
-            bool Delta_A_i_j_LE_A_star = compare_A(activity_iidx - activities[jidx], activity_thr_A_star);
+    }
 
-            denominator += Dist_i_j_GE_min_dist_x;
-            numerator += Delta_A_i_j_LE_A_star * Dist_i_j_GE_min_dist_x;
-        }
+    size_type size() const
+    {
+        return m_N;
     }
 
-    const value_type result = denominator != 0 ? (value_type)numerator / denominator : 0.0;
+    // indexed with absolute word numbers
+    const word_type * row(const size_type iidx) const
+    {
+        return &m_bits[iidx * m_words];
+    }
 
-    return result;
-}
+    bool at(const size_type iidx, const size_type jidx) const
+    {
+        return (row(iidx)[jidx / WORD_BITS] >> (jidx % WORD_BITS)) & 1;
+    }
 
-template<typename _ValueType>
-_ValueType APSsim(
-    const std::size_t jidx,
-    const _ValueType activity_thr_A_star,
-    const std::unique_ptr<Matrix2d<double>> & similarities,
-    const std::valarray<_ValueType> & activities
-    )
+private:
+    const size_type m_N;
+    const size_type m_words;
+    std::vector<word_type> m_bits;
+};
+
+/*
+ * CPsim and APSsim CP values over a precomputed ActivityAgreementMask.
+ * Rows are swept 64 columns at a time: the similarities of a word are
+ * compared into a 64-bit mask and counted with AND and popcount against
+ * the agreement word (MaskCountKernel); the partial words at the diagonal
+ * and the row ends go through the same word compare on a padded copy.
+ * The comparisons are those of CPEngine, hence so are the counts.
+ *
+ * The mask costs a sweep over the pairs and N^2 / 8 bytes of its own, so
+ * CPsim and APSsim given A* stay with CPEngine; callers evaluating many
+ * thresholds against the same activities build a mask once and pass it.
+ * CPsimCurve, which the rankers use, sees every pair once anyway.
+ */
+template<typename _ValueType, typename _MatrixType>
+struct AgreementMaskEngine
 {
     typedef std::size_t size_type;
     typedef _ValueType value_type;
+    typedef typename _MatrixType::value_type element_type;
+    typedef ActivityAgreementMask::word_type word_type;
 
-    Cache<value_type, 101> cache;
-    MinMaxIndexer<value_type, 101> cache_indexer(0.0, 1.0);
-
-    std::valarray<value_type> CPs;
-    CPs.resize(activities.size());
+    static constexpr size_type WORD_BITS{ActivityAgreementMask::WORD_BITS};
 
+    AgreementMaskEngine(
+        const _MatrixType & similarities,
+        const ActivityAgreementMask & agreement,
+        const value_type * activities)
+    :
+        m_similarities(similarities),
+        m_agreement(agreement),
+        m_activities(activities)
+    {
+    }
 
-    for (std::size_t iidx{0}; iidx < CPs.size(); ++iidx)
+    void count(const PairTile & tile, const element_type threshold, PairCounts & counts) const
     {
-        size_type cache_idx = cache_indexer.indexFor(similarities->at(iidx, jidx));
-        if (!cache.isOccupiedAt(cache_idx))
+        PairCounts tile_counts{0, 0};
+
+        for (size_type iidx{tile.row_begin}; iidx < tile.row_end; ++iidx)
         {
-            CPs[iidx] = CPsim(similarities->at(iidx, jidx), activity_thr_A_star, similarities, activities);
-            cache.write(cache_idx, CPs[iidx]);
+            const size_type col_begin = std::max(tile.col_begin, iidx + 1);
+
+            if (col_begin >= tile.col_end)
+            {
+                continue;
+            }
+
+            const element_type * values = m_similarities.upper_row_cbegin(iidx);
+            const word_type * agree = m_agreement.row(iidx);
+
+            const size_type word_begin = (col_begin + WORD_BITS - 1) / WORD_BITS;
+            const size_type word_end = tile.col_end / WORD_BITS;
+
+            const size_type head_end = std::min(tile.col_end, word_begin * WORD_BITS);
+
+            count_partial(values, agree, col_begin, head_end, threshold, tile_counts);
+
+            if (word_begin < word_end)
+            {
+                MaskCountKernel<element_type>::count(values, agree, word_begin, word_end, threshold, tile_counts);
+            }
+
+            count_partial(values, agree, std::max(head_end, word_end * WORD_BITS), tile.col_end, threshold, tile_counts);
         }
-        else
+
+        counts += tile_counts;
+    }
+
+    value_type CP(const value_type threshold) const
+    {
+        const size_type N = m_agreement.size();
+        PairCounts counts{0, 0};
+
+        AM_COUNT(PAIRS_VISITED, N * (N - 1) / 2);
+
+        count(PairTile{0, N, 0, N}, SimilarityCodec<element_type>::encode(threshold), counts);
+
+        return ratio(counts);
+    }
+
+    value_type CP(const value_type threshold, ThreadPool & thread_pool) const
+    {
+        const size_type N = m_agreement.size();
+        const element_type encoded = SimilarityCodec<element_type>::encode(threshold);
+
+        AM_COUNT(PAIRS_VISITED, N * (N - 1) / 2);
+
+        // tile columns are multiples of whole words
+        return ratio(reduce_tiles(thread_pool, TriangleTiling(N, N), PairCounts{0, 0},
+            [this, encoded](const PairTile & tile, PairCounts & partial)
+            {
+                count(tile, encoded, partial);
+            }
+        ));
+    }
+
+    template<typename _ThresholdFunction, typename _Cache>
+    value_type APS(_ThresholdFunction && threshold_of, _Cache & cache) const
+    {
+        return weighted_APS(*this, m_activities, m_agreement.size(), threshold_of, cache);
+    }
+
+private:
+    /*
+     * Columns [col_begin, col_end) within a single word. Row elements out
+     * of that range may lie outside the matrix, so the word is compared
+     * from a copy and its other bits are masked off.
+     */
+    static void count_partial(
+        const element_type * values,
+        const word_type * agree,
+        const size_type col_begin,
+        const size_type col_end,
+        const element_type threshold,
+        PairCounts & counts)
+    {
+        if (col_begin >= col_end)
         {
-            CPs[iidx] = cache.read(cache_idx);
+            return;
         }
-//        std::cout << "CP " << iidx << ": " << CPs[iidx] << std::endl;
+
+        const size_type widx = col_begin / WORD_BITS;
+        const size_type offset = col_begin % WORD_BITS;
+        const size_type n = col_end - col_begin;
+
+        element_type word_values[WORD_BITS] = {};
+
+        std::copy(values + col_begin, values + col_end, word_values + offset);
+
+        const word_type range = (n == WORD_BITS ? ~word_type(0) : ((word_type(1) << n) - 1)) << offset;
+        const word_type m_dist = MaskCountKernel<element_type>::word(word_values, threshold) & range;
+
+        counts.denominator += __builtin_popcountll(m_dist);
+        counts.numerator += __builtin_popcountll(m_dist & agree[widx]);
+    }
+
+    static value_type ratio(const PairCounts & counts)
+    {
+        return counts.denominator != 0 ? (value_type)counts.numerator / counts.denominator : 0.0;
     }
 
-    const value_type numerator = (activities * CPs).sum();
-    const value_type denominator = CPs.sum();
+private:
+    const _MatrixType & m_similarities;
+    const ActivityAgreementMask & m_agreement;
+    const value_type * m_activities;
+};
+
+/*
+ * CP and APS of a single descriptor under AbsLessEqual/AbsGreaterEqual.
+ * |features[i] - features[j]| does not depend on the pair order, so with
+ * the values sorted once the pairs within a threshold of molecule q are a
+ * contiguous run of its sorted predecessors, found with two pointers. The
+ * agreeing pairs among them are counted with a Fenwick tree over activity
+ * ranks: ActivityWithin agrees on a contiguous range of sorted activities,
+ * located once per distinct activity with the criterion itself.
+ *
+ * Past the O(N log N) setup a CP is O(N log N) instead of O(N^2), with
+ * the same floating point comparisons as CPEngine, hence the same counts.
+ * With the 51 bucket cache an APS is thus O(N log N) as well. A single CP
+ * does not amortize the setup and stays with CPEngine, which is faster up
+ * to a couple thousand molecules. The pool overload runs serially.
+ */
+template<typename _Compare, typename _Agree>
+struct is_sorted_difference_pair
+{
+    static constexpr bool value = false;
+};
+
+template<> struct is_sorted_difference_pair<AbsLessEqual, ActivityWithin> { static constexpr bool value = true; };
+template<> struct is_sorted_difference_pair<AbsGreaterEqual, ActivityWithin> { static constexpr bool value = true; };
+
+template<typename _ValueType, typename _Compare, typename _Agree = ActivityWithin>
+struct SortedDifferenceEngine
+{
+    typedef std::size_t size_type;
+    typedef _ValueType value_type;
+
+    SortedDifferenceEngine(
+        const DifferenceSource<value_type> & source,
+        const value_type * activities,
+        const size_type N,
+        const value_type activity_thr_A_star,
+        const _Compare & compare = _Compare(),
+        const _Agree & agree = _Agree())
+    :
+        m_activities(activities),
+        m_N(N),
+        m_values(N),
+        m_ranks(N),
+        m_compare(compare)
+    {
+        typedef std::pair<value_type, value_type> item_type;
+
+        // (value, activity) in ascending value order
+        std::vector<item_type> items(N);
+
+        for (size_type iidx{0}; iidx < N; ++iidx)
+        {
+            items[iidx] = item_type(source.value(iidx), activities[iidx]);
+        }
 
-    const value_type  result = numerator / denominator;
+        std::sort(items.begin(), items.end(),
+            [](const item_type & lhs, const item_type & rhs){ return lhs.first < rhs.first; });
 
-//    std::cout << "APSsim " << result << std::endl;
+        typedef std::pair<value_type, size_type> level_type;
+
+        // (activity, position in value order) in ascending activity order
+        std::vector<level_type> by_activity(N);
+
+        for (size_type pos{0}; pos < N; ++pos)
+        {
+            m_values[pos] = items[pos].first;
+            by_activity[pos] = level_type(items[pos].second, pos);
+        }
+
+        std::sort(by_activity.begin(), by_activity.end());
+
+        std::vector<value_type> levels;
+
+        for (const auto & item : by_activity)
+        {
+            if (levels.empty() || levels.back() != item.first)
+            {
+                levels.push_back(item.first);
+            }
+
+            m_ranks[item.second] = levels.size() - 1;
+        }
+
+        m_n_ranks = levels.size();
+        m_agree_begin.resize(m_n_ranks);
+        m_agree_end.resize(m_n_ranks);
+
+        for (size_type rank{0}; rank < m_n_ranks; ++rank)
+        {
+            const value_type activity = levels[rank];
+            const auto level = levels.cbegin() + rank;
+
+            // agreeing levels below and above, each side monotone in the criterion
+            m_agree_begin[rank] = std::partition_point(levels.cbegin(), level + 1,
+                [&](const value_type other){ return !agree(activity, other, activity_thr_A_star); }) - levels.cbegin();
+            m_agree_end[rank] = std::partition_point(level, levels.cend(),
+                [&](const value_type other){ return agree(activity, other, activity_thr_A_star); }) - levels.cbegin();
+        }
+
+        m_all = all_pairs(m_compare);
+    }
+
+    value_type CP(const value_type threshold) const
+    {
+        return ratio(counts(threshold, m_compare));
+    }
+
+    value_type CP(const value_type threshold, ThreadPool &) const
+    {
+        return CP(threshold);
+    }
+
+    template<typename _ThresholdFunction, typename _Cache>
+    value_type APS(_ThresholdFunction && threshold_of, _Cache & cache) const
+    {
+        return weighted_APS(*this, m_activities, m_N, threshold_of, cache);
+    }
+
+private:
+    PairCounts all_pairs(const AbsLessEqual &) const
+    {
+        return PairCounts{0, 0};
+    }
+
+    PairCounts all_pairs(const AbsGreaterEqual &) const
+    {
+        return within([](const value_type){ return true; });
+    }
+
+    PairCounts counts(const value_type threshold, const AbsLessEqual &) const
+    {
+        return within([threshold](const value_type gap){ return gap <= threshold; });
+    }
+
+    PairCounts counts(const value_type threshold, const AbsGreaterEqual &) const
+    {
+        const PairCounts below = within([threshold](const value_type gap){ return gap < threshold; });
+
+        return PairCounts{m_all.numerator - below.numerator, m_all.denominator - below.denominator};
+    }
+
+    /*
+     * Pairs whose gap, the larger value minus the smaller one, is `inside`,
+     * which has to hold for all gaps below some bound and for none above.
+     */
+    template<typename _Inside>
+    PairCounts within(_Inside && inside) const
+    {
+        FenwickTree window(m_n_ranks);
+        PairCounts counts{0, 0};
+        size_type first{0};
+
+        for (size_type pos{0}; pos < m_N; ++pos)
+        {
+            while (first < pos && !inside(m_values[pos] - m_values[first]))
+            {
+                window.remove(m_ranks[first++]);
+            }
+
+            counts.denominator += pos - first;
+            counts.numerator += window.range(m_agree_begin[m_ranks[pos]], m_agree_end[m_ranks[pos]]);
+
+            window.add(m_ranks[pos]);
+        }
+
+        return counts;
+    }
+
+    static value_type ratio(const PairCounts & counts)
+    {
+        return counts.denominator != 0 ? (value_type)counts.numerator / counts.denominator : 0.0;
+    }
+
+private:
+    const value_type * m_activities;
+    const size_type m_N;
+    // values in ascending order with the ranks of their activities
+    std::vector<value_type> m_values;
+    std::vector<size_type> m_ranks;
+    // per rank, the range of ranks agreeing with it
+    std::vector<size_type> m_agree_begin;
+    std::vector<size_type> m_agree_end;
+    size_type m_n_ranks;
+    PairCounts m_all;
+    const _Compare m_compare;
+};
+
+// the engine APS of a single descriptor runs on
+template<typename _ValueType, typename _Compare, typename _Agree = ActivityWithin>
+struct DifferenceEngine
+{
+    typedef typename std::conditional<
+        is_sorted_difference_pair<_Compare, _Agree>::value,
+        SortedDifferenceEngine<_ValueType, _Compare, _Agree>,
+        CPEngine<_ValueType, DifferenceSource<_ValueType>, _Compare, _Agree>
+    >::type type;
+};
+
+template<typename _ValueType, typename _Compare>
+_ValueType CP(
+    const _ValueType distance,
+    const _ValueType activity_thr_A_star,
+    const std::valarray<_ValueType> & distances,
+    const std::valarray<_ValueType> & activities,
+    _Compare compare
+    )
+{
+    typedef CPEngine<_ValueType, DifferenceSource<_ValueType>, _Compare> engine_type;
+
+    return engine_type(DifferenceSource<_ValueType>(&distances[0]), &activities[0], activities.size(),
+        activity_thr_A_star, compare).CP(distance);
+}
+
+// CP with the pair triangle spread over the pool
+template<typename _ValueType, typename _Compare>
+_ValueType CP(
+    const _ValueType distance,
+    const _ValueType activity_thr_A_star,
+    const std::valarray<_ValueType> & distances,
+    const std::valarray<_ValueType> & activities,
+    _Compare compare,
+    ThreadPool & thread_pool
+    )
+{
+    typedef CPEngine<_ValueType, DifferenceSource<_ValueType>, _Compare> engine_type;
+
+    return engine_type(DifferenceSource<_ValueType>(&distances[0]), &activities[0], activities.size(),
+        activity_thr_A_star, compare).CP(distance, thread_pool);
+}
+
+
+/*
+ * `features` and `activities` are anything indexable with a size(), e.g.
+ * valarrays or StridedViews of matrix columns. The abs comparators run on
+ * the O(N log N) SortedDifferenceEngine.
+ */
+template<typename _ValueType, typename _FeaturesType, typename _ActivitiesType, typename _Compare>
+_ValueType APS(
+    const std::size_t jidx,
+    const _ValueType activity_thr_A_star,
+    const _FeaturesType & features,
+    const _ActivitiesType & activities,
+    _Compare compare
+    )
+{
+    typedef std::size_t size_type;
+    typedef _ValueType value_type;
+    typedef typename DifferenceEngine<value_type, _Compare>::type engine_type;
+
+    const size_type N = activities.size();
+
+    // CP sweeps need contiguous rows, so the columns are gathered once
+    std::valarray<value_type> distances(N);
+    std::valarray<value_type> contiguous_activities(N);
+
+    for (size_type iidx{0}; iidx < N; ++iidx)
+    {
+        distances[iidx] = features[iidx] - features[jidx];
+        contiguous_activities[iidx] = activities[iidx];
+    }
+
+    BucketCache<value_type, 51> cache(std::minmax_element(std::begin(distances), std::end(distances)));
+
+    const engine_type engine{DifferenceSource<value_type>(&distances[0]), &contiguous_activities[0], N,
+        activity_thr_A_star, compare};
+
+    return engine.APS([&distances](const size_type iidx){ return distances[iidx]; }, cache);
+}
+
+template<typename _ValueType, typename _MatrixType>
+_ValueType CPsim(
+    const _ValueType distance,
+    const _ValueType activity_thr_A_star,
+    const std::unique_ptr<_MatrixType> & similarities,
+    const std::valarray<_ValueType> & activities
+    )
+{
+    typedef CPEngine<_ValueType, MatrixSource<_MatrixType>, GreaterEqual> engine_type;
+
+    AM_COUNT(CPSIM_CALLS, 1);
+
+    return engine_type(MatrixSource<_MatrixType>(*similarities), &activities[0], activities.size(),
+        activity_thr_A_star).CP(distance);
+}
+
+// CPsim with the pair triangle spread over the pool
+template<typename _ValueType, typename _MatrixType>
+_ValueType CPsim(
+    const _ValueType distance,
+    const _ValueType activity_thr_A_star,
+    const std::unique_ptr<_MatrixType> & similarities,
+    const std::valarray<_ValueType> & activities,
+    ThreadPool & thread_pool
+    )
+{
+    typedef CPEngine<_ValueType, MatrixSource<_MatrixType>, GreaterEqual> engine_type;
+
+    AM_COUNT(CPSIM_CALLS, 1);
+
+    return engine_type(MatrixSource<_MatrixType>(*similarities), &activities[0], activities.size(),
+        activity_thr_A_star).CP(distance, thread_pool);
+}
+
+// CPsim against agreement precomputed for repeated calls, see AgreementMaskEngine
+template<typename _ValueType, typename _MatrixType>
+_ValueType CPsim(
+    const _ValueType distance,
+    const ActivityAgreementMask & agreement,
+    const std::unique_ptr<_MatrixType> & similarities
+    )
+{
+    typedef AgreementMaskEngine<_ValueType, _MatrixType> engine_type;
+
+    AM_COUNT(CPSIM_CALLS, 1);
+
+    return engine_type(*similarities, agreement, nullptr).CP(distance);
+}
+
+template<typename _ValueType, typename _MatrixType>
+_ValueType CPsim(
+    const _ValueType distance,
+    const ActivityAgreementMask & agreement,
+    const std::unique_ptr<_MatrixType> & similarities,
+    ThreadPool & thread_pool
+    )
+{
+    typedef AgreementMaskEngine<_ValueType, _MatrixType> engine_type;
+
+    AM_COUNT(CPSIM_CALLS, 1);
+
+    return engine_type(*similarities, agreement, nullptr).CP(distance, thread_pool);
+}
+
+/*
+ * Training pairs binned by the quantized similarity threshold bucket:
+ * denominators count all pairs in a bucket, numerators those of them with
+ * agreeing activities. Pairs can be added one at a time.
+ */
+template<std::size_t _N>
+struct CPsimHistogram
+{
+    typedef std::size_t size_type;
+
+    static constexpr size_type N{_N};
+
+    CPsimHistogram()
+    :
+        m_numerators(N, 0),
+        m_denominators(N, 0)
+    {
+    }
+
+    inline
+    void add(const size_type bucket, const bool Delta_A_i_j_LE_A_star)
+    {
+        ++m_denominators[bucket];
+        m_numerators[bucket] += Delta_A_i_j_LE_A_star;
+    }
+
+    CPsimHistogram & operator+=(const CPsimHistogram & other)
+    {
+        for (size_type bucket{0}; bucket < N; ++bucket)
+        {
+            m_numerators[bucket] += other.m_numerators[bucket];
+            m_denominators[bucket] += other.m_denominators[bucket];
+        }
+
+        return *this;
+    }
+
+    size_type numerator(const size_type bucket) const
+    {
+        return m_numerators[bucket];
+    }
+
+    size_type denominator(const size_type bucket) const
+    {
+        return m_denominators[bucket];
+    }
+
+private:
+    std::vector<size_type> m_numerators;
+    std::vector<size_type> m_denominators;
+};
+
+/*
+ * CPsim curve over the quantized similarity thresholds.
+ *
+ * CPsim depends only on the threshold, the training block of the similarity
+ * matrix and the activities, so all training pairs are binned once by their
+ * threshold bucket and the numerator/denominator for every bucket are built
+ * from suffix sums of the two histograms. A CPsim lookup is then O(1).
+ * Matrices holding quantized byte codes are binned by the code directly.
+ */
+template<typename _ValueType, std::size_t _N>
+struct CPsimCurve
+{
+    typedef std::size_t size_type;
+    typedef _ValueType value_type;
+    typedef SimilarityQuantizer<_ValueType, _N> quantizer_type;
+    typedef CPsimHistogram<_N> histogram_type;
+
+    static constexpr size_type N{_N};
+
+    template<typename _MatrixType>
+    CPsimCurve(
+        const _ValueType activity_thr_A_star,
+        const std::unique_ptr<_MatrixType> & similarities,
+        const std::valarray<_ValueType> & activities)
+    :
+        m_CPs(N, 0.0)
+    {
+        const size_type NA = activities.size();
+
+        histogram_type histogram;
+
+        AM_COUNT(PAIRS_VISITED, NA * (NA - 1) / 2);
+
+        add_tile(PairTile{0, NA, 0, NA}, activity_thr_A_star, *similarities, activities, histogram);
+        accumulate(histogram);
+    }
+
+    // the same, with the pair triangle spread over the pool
+    template<typename _MatrixType>
+    CPsimCurve(
+        const _ValueType activity_thr_A_star,
+        const std::unique_ptr<_MatrixType> & similarities,
+        const std::valarray<_ValueType> & activities,
+        ThreadPool & thread_pool)
+    :
+        m_CPs(N, 0.0)
+    {
+        const size_type NA = activities.size();
+
+        AM_COUNT(PAIRS_VISITED, NA * (NA - 1) / 2);
+
+        accumulate(reduce_tiles(thread_pool, TriangleTiling(NA, NA), histogram_type(),
+            [&](const PairTile & tile, histogram_type & partial)
+            {
+                add_tile(tile, activity_thr_A_star, *similarities, activities, partial);
+            }
+        ));
+    }
+
+    explicit CPsimCurve(const histogram_type & histogram)
+    :
+        m_CPs(N, 0.0)
+    {
+        accumulate(histogram);
+    }
+
+    static inline
+    size_type indexFor(const value_type & similarity)
+    {
+        return quantizer_type::indexFor(similarity);
+    }
+
+    static inline
+    size_type indexFor(const std::uint8_t & code)
+    {
+        return code;
+    }
+
+    inline
+    value_type at(const value_type & similarity) const
+    {
+        return m_CPs[indexFor(similarity)];
+    }
+
+    inline
+    value_type at(const std::uint8_t & code) const
+    {
+        return m_CPs[code];
+    }
+
+private:
+    template<typename _MatrixType>
+    void add_tile(
+        const PairTile & tile,
+        const _ValueType activity_thr_A_star,
+        const _MatrixType & similarities,
+        const std::valarray<_ValueType> & activities,
+        histogram_type & histogram) const
+    {
+        for (size_type iidx{tile.row_begin}; iidx < tile.row_end; ++iidx)
+        {
+            const value_type activity_iidx = activities[iidx];
+            const auto row_p = similarities.upper_row_cbegin(iidx);
+
+            for (size_type jidx{std::max(tile.col_begin, iidx + 1)}; jidx < tile.col_end; ++jidx)
+            {
+                const bool Delta_A_i_j_LE_A_star = fabs(activity_iidx - activities[jidx]) <= activity_thr_A_star;
+
+                histogram.add(indexFor(row_p[jidx]), Delta_A_i_j_LE_A_star);
+            }
+        }
+    }
+
+    void accumulate(const histogram_type & histogram)
+    {
+        size_type numerator{0};
+        size_type denominator{0};
+
+        AM_COUNT(CURVE_BUILDS, 1);
+
+        for (size_type bucket{N}; bucket-- > 0;)
+        {
+            numerator += histogram.numerator(bucket);
+            denominator += histogram.denominator(bucket);
+
+            m_CPs[bucket] = denominator != 0 ? (value_type)numerator / denominator : 0.0;
+        }
+    }
+
+private:
+    std::vector<value_type> m_CPs;
+};
+
+template<typename _ValueType, typename _MatrixType>
+_ValueType APSsim(
+    const std::size_t jidx,
+    const _ValueType activity_thr_A_star,
+    const std::unique_ptr<_MatrixType> & similarities,
+    const std::valarray<_ValueType> & activities
+    )
+{
+    typedef std::size_t size_type;
+    typedef _ValueType value_type;
+    typedef SimilarityCodec<typename _MatrixType::value_type> codec_type;
+    typedef CPEngine<value_type, MatrixSource<_MatrixType>, GreaterEqual> engine_type;
+
+    BucketCache<value_type, 101> cache(0.0, 1.0);
+
+    const engine_type engine{MatrixSource<_MatrixType>(*similarities), &activities[0], activities.size(),
+        activity_thr_A_star};
+
+    return engine.APS(
+        [&similarities, jidx](const size_type iidx)
+        {
+            return codec_type::decode(similarities->at(iidx, jidx));
+        },
+        cache);
+}
+
+/*
+ * As above, with agreement taken from a mask built once by the caller and
+ * shared by all the molecules it scores; building one per call would cost
+ * a pair sweep and N^2 / 8 bytes each time.
+ */
+template<typename _ValueType, typename _MatrixType>
+_ValueType APSsim(
+    const std::size_t jidx,
+    const ActivityAgreementMask & agreement,
+    const std::unique_ptr<_MatrixType> & similarities,
+    const std::valarray<_ValueType> & activities
+    )
+{
+    typedef std::size_t size_type;
+    typedef _ValueType value_type;
+    typedef SimilarityCodec<typename _MatrixType::value_type> codec_type;
+    typedef AgreementMaskEngine<value_type, _MatrixType> engine_type;
+
+    BucketCache<value_type, 101> cache(0.0, 1.0);
+
+    const engine_type engine{*similarities, agreement, &activities[0]};
+
+    return engine.APS(
+        [&similarities, jidx](const size_type iidx)
+        {
+            return codec_type::decode(similarities->at(iidx, jidx));
+        },
+        cache);
+}
+
+template<typename _ValueType, std::size_t _N, typename _MatrixType>
+_ValueType APSsim(
+    const std::size_t jidx,
+    const CPsimCurve<_ValueType, _N> & curve,
+    const std::unique_ptr<_MatrixType> & similarities,
+    const std::valarray<_ValueType> & activities
+    )
+{
+    APSSums<_ValueType> sums;
+
+    AM_COUNT(CURVE_LOOKUPS, activities.size());
+
+    for (std::size_t iidx{0}; iidx < activities.size(); ++iidx)
+    {
+        sums.add(activities[iidx], curve.at(similarities->at(iidx, jidx)));
+    }
+
+    return sums.result();
+}
+
+/*
+ * APSsim of a molecule given the bucket codes of its similarities to every
+ * training molecule, e.g. kept by an incremental ranker instead of a matrix.
+ */
+template<typename _ValueType, std::size_t _N>
+_ValueType APSsim(
+    const CPsimCurve<_ValueType, _N> & curve,
+    const std::uint8_t * codes,
+    const std::valarray<_ValueType> & activities
+    )
+{
+    APSSums<_ValueType> sums;
+
+    AM_COUNT(CURVE_LOOKUPS, activities.size());
+
+    for (std::size_t iidx{0}; iidx < activities.size(); ++iidx)
+    {
+        sums.add(activities[iidx], curve.at(codes[iidx]));
+    }
+
+    return sums.result();
+}
+
+/*
+ * APSsim restricted to the `knn` training molecules most similar to the
+ * scored one. The CPsim curve is built from the pairs among those
+ * neighbours only and the APS sums run over them, so past finding the
+ * neighbours in O(X log knn) the cost is O(knn^2) instead of O(X^2).
+ *
+ * `similarity_to` holds the similarities of the scored molecule to every
+ * training molecule, `pair_similarity(a, b)` gives the similarity of two
+ * training molecules. With knn >= X the result equals the full APSsim.
+ * Returns 0 when no neighbour gets a non-zero CP.
+ */
+template<typename _ValueType, std::size_t _N, typename _PairSimilarity>
+_ValueType APSsim_knn(
+    const std::vector<_ValueType> & similarity_to,
+    const std::size_t knn,
+    _PairSimilarity && pair_similarity,
+    const _ValueType activity_thr_A_star,
+    const std::valarray<_ValueType> & activities
+    )
+{
+    typedef std::size_t size_type;
+    typedef _ValueType value_type;
+
+    std::vector<size_type> neighbours;
+    neighbours.reserve(knn);
+
+    find_k_nearest_neighbours(similarity_to.data(), similarity_to.data() + similarity_to.size(),
+        std::min(knn, similarity_to.size()), std::back_inserter(neighbours));
+
+    // training order, so that with all molecules the sums match APSsim
+    std::sort(neighbours.begin(), neighbours.end());
+
+    const size_type K = neighbours.size();
+
+    CPsimHistogram<_N> histogram;
+
+    AM_COUNT(PAIRS_VISITED, K * (K - 1) / 2);
+
+    for (size_type iidx{0}; iidx + 1 < K; ++iidx)
+    {
+        const value_type activity_iidx = activities[neighbours[iidx]];
+
+        for (size_type jidx{iidx + 1}; jidx < K; ++jidx)
+        {
+            const bool Delta_A_i_j_LE_A_star = fabs(activity_iidx - activities[neighbours[jidx]]) <= activity_thr_A_star;
+
+            histogram.add(
+                SimilarityQuantizer<value_type, _N>::indexFor(pair_similarity(neighbours[iidx], neighbours[jidx])),
+                Delta_A_i_j_LE_A_star);
+        }
+    }
+
+    const CPsimCurve<value_type, _N> curve(histogram);
+
+    APSSums<value_type> sums;
+
+    AM_COUNT(CURVE_LOOKUPS, K);
+
+    for (size_type iidx{0}; iidx < K; ++iidx)
+    {
+        sums.add(activities[neighbours[iidx]], curve.at(similarity_to[neighbours[iidx]]));
+    }
 
-    return result;
+    return sums.denominator() != 0.0 ? sums.result() : 0.0;
 }
 
 #endif /* CP_HPP_ */
@@ -30,6 +30,8 @@
 #include <cstddef>
 #include <cassert>
 #include <iterator>
+#include <vector>
+#include <algorithm>
 
 template<typename _OutIterator>
 std::size_t find_k_nearest_neighbours(
@@ -38,7 +40,7 @@ std::size_t find_k_nearest_neighbours(
     std::size_t knn,
     _OutIterator && out_iterator)
 {
-    assert(std::distance(begin, end) >= knn);
+    assert(std::distance(begin, end) >= (std::ptrdiff_t)knn);
 
     typedef std::pair<std::size_t, double> pair_type;
 
@@ -52,35 +54,31 @@ std::size_t find_k_nearest_neighbours(
         candidates.push_back(std::make_pair(cnt, *pos++));
     }
 
-    auto ascending_predicate = [](const pair_type & lhs, const pair_type & rhs)
+    // strict weak ordering: higher similarity first, ties to the lower index
+    auto closer = [](const pair_type & lhs, const pair_type & rhs)
     {
-        return lhs.second >= rhs.second;
-//        return lhs.second <= rhs.second;
+        return lhs.second > rhs.second || (lhs.second == rhs.second && lhs.first < rhs.first);
     };
 
-    std::make_heap(candidates.begin(), candidates.end(), ascending_predicate);
+    // heap front is the farthest of the candidates
+    std::make_heap(candidates.begin(), candidates.end(), closer);
 
     while (pos != end)
     {
-        if (*pos >= candidates.front().second)
-//        if (*pos <= candidates.front().second)
+        const pair_type candidate = std::make_pair(std::distance(begin, pos), *pos);
+
+        if (closer(candidate, candidates.front()))
         {
-            std::pop_heap(candidates.begin(), candidates.end(), ascending_predicate);
+            std::pop_heap(candidates.begin(), candidates.end(), closer);
 
-            candidates.back() = std::make_pair(std::distance(begin, pos), *pos);
-            std::push_heap(candidates.begin(), candidates.end(), ascending_predicate);
+            candidates.back() = candidate;
+            std::push_heap(candidates.begin(), candidates.end(), closer);
         }
 
         ++pos;
     }
 
-    std::sort(candidates.begin(), candidates.end(),
-        [](const pair_type & lhs, const pair_type & rhs)
-        {
-            return lhs.second > rhs.second;
-//            return lhs.second < rhs.second;
-        }
-    );
+    std::sort(candidates.begin(), candidates.end(), closer);
 
     for (auto pair : candidates)
     {
@@ -90,23 +88,93 @@ std::size_t find_k_nearest_neighbours(
     return knn;
 }
 
-template<typename _ValueType>
-std::unique_ptr<Matrix2d<_ValueType>>
-normalize_columns(std::unique_ptr<Matrix2d<_ValueType>> && matrix)
+/*
+ * Fenwick (binary indexed) tree of counts over positions [0, size), with
+ * O(log size) updates and prefix sums.
+ */
+struct FenwickTree
 {
-    typedef _ValueType value_type;
+    typedef std::size_t size_type;
+
+    explicit FenwickTree(const size_type size)
+    :
+        m_tree(size + 1, 0)
+    {
+    }
+
+    void add(const size_type position)
+    {
+        for (size_type idx{position + 1}; idx < m_tree.size(); idx += idx & -idx)
+        {
+            ++m_tree[idx];
+        }
+    }
+
+    void remove(const size_type position)
+    {
+        for (size_type idx{position + 1}; idx < m_tree.size(); idx += idx & -idx)
+        {
+            --m_tree[idx];
+        }
+    }
+
+    // count over [0, end)
+    size_type prefix(const size_type end) const
+    {
+        size_type result{0};
+
+        for (size_type idx{end}; idx > 0; idx -= idx & -idx)
+        {
+            result += m_tree[idx];
+        }
+
+        return result;
+    }
+
+    // count over [begin, end)
+    size_type range(const size_type begin, const size_type end) const
+    {
+        return begin < end ? prefix(end) - prefix(begin) : 0;
+    }
+
+private:
+    std::vector<size_type> m_tree;
+};
+
+template<typename _MatrixType>
+std::unique_ptr<_MatrixType>
+normalize_columns(std::unique_ptr<_MatrixType> && matrix)
+{
+    typedef typename _MatrixType::value_type value_type;
     typedef std::size_t size_type;
 
     for (size_type icol = 0; icol < matrix->cols(); ++icol)
     {
-        std::valarray<value_type> column = matrix->col(icol);
+        const StridedView<value_type> column = matrix->col_view(icol);
+        const size_type n_elem = column.size();
+
+        value_type sum{0};
+
+        for (size_type irow = 0; irow < n_elem; ++irow)
+        {
+            sum += column[irow];
+        }
 
-        value_type mean = column.sum() / column.size();
-        column -= mean;
+        const value_type mean = sum / n_elem;
+        value_type sum_sq{0};
 
-        column /= sqrt(1.0 / (column.size() - 1) * (column * column).sum());
+        for (size_type irow = 0; irow < n_elem; ++irow)
+        {
+            column[irow] -= mean;
+            sum_sq += column[irow] * column[irow];
+        }
+
+        const value_type stddev = sqrt(1.0 / (n_elem - 1) * sum_sq);
 
-        matrix->col(icol) = column;
+        for (size_type irow = 0; irow < n_elem; ++irow)
+        {
+            column[irow] /= stddev;
+        }
     }
 
     return std::move(matrix);
@@ -0,0 +1,155 @@
+/*******************************************************************************
+ * Copyright (c) 2015 Wojciech Migda
+ * All rights reserved
+ * Distributed under the terms of the GNU LGPL v3
+ *******************************************************************************
+ *
+ * Filename: allocator.hpp
+ *
+ * Description:
+ *      Raw storage allocation policies for matrices
+ *
+ * Authors:
+ *          Wojciech Migda (wm)
+ *
+ *******************************************************************************
+ * History:
+ * --------
+ * Date         Who  Ticket     Description
+ * ----------   ---  ---------  ------------------------------------------------
+ * 2026-10-17   wm              Initial version
+ *
+ ******************************************************************************/
+
+#ifndef ALLOCATOR_HPP_
+#define ALLOCATOR_HPP_
+
+#include <sys/mman.h>
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <map>
+#include <mutex>
+#include <utility>
+
+/*
+ * Every policy hands out zero-filled blocks through
+ *
+ *     static void * allocate(size_type nbytes);
+ *     static void deallocate(void * ptr, size_type nbytes);
+ *
+ * and aligns them to at least a cache line.
+ */
+
+template<std::size_t _Alignment = 64>
+struct AlignedAllocator
+{
+    typedef std::size_t size_type;
+
+    static constexpr size_type ALIGNMENT{_Alignment};
+
+    static void * allocate(const size_type nbytes)
+    {
+        void * ptr = nullptr;
+
+        if (posix_memalign(&ptr, ALIGNMENT, nbytes ? nbytes : ALIGNMENT) != 0)
+        {
+            throw std::bad_alloc();
+        }
+
+        std::memset(ptr, 0, nbytes);
+
+        return ptr;
+    }
+
+    static void deallocate(void * ptr, const size_type)
+    {
+        std::free(ptr);
+    }
+};
+
+/*
+ * Keeps released blocks on a per-size free list and hands them out again,
+ * which saves the page faults of repeatedly building same-sized matrices
+ * (e.g. one per request in a long running process). The pool is shared by
+ * all threads and is never returned to the system.
+ */
+template<std::size_t _Alignment = 64>
+struct PooledAllocator
+{
+    typedef std::size_t size_type;
+    typedef AlignedAllocator<_Alignment> upstream_type;
+
+    static void * allocate(const size_type nbytes)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex());
+            auto found = free_blocks().find(nbytes);
+
+            if (found != free_blocks().end())
+            {
+                void * ptr = found->second;
+
+                free_blocks().erase(found);
+                std::memset(ptr, 0, nbytes);
+
+                return ptr;
+            }
+        }
+
+        return upstream_type::allocate(nbytes);
+    }
+
+    static void deallocate(void * ptr, const size_type nbytes)
+    {
+        std::lock_guard<std::mutex> lock(mutex());
+
+        free_blocks().insert(std::make_pair(nbytes, ptr));
+    }
+
+private:
+    static std::mutex & mutex()
+    {
+        static std::mutex the_mutex;
+
+        return the_mutex;
+    }
+
+    static std::multimap<size_type, void *> & free_blocks()
+    {
+        static std::multimap<size_type, void *> the_blocks;
+
+        return the_blocks;
+    }
+};
+
+/*
+ * Anonymous private mappings: page aligned, zeroed lazily by the kernel and
+ * returned to the system as soon as the matrix goes away. Best for the
+ * large, short-lived matrices.
+ */
+struct MmapAllocator
+{
+    typedef std::size_t size_type;
+
+    static void * allocate(const size_type nbytes)
+    {
+        void * ptr = mmap(nullptr, nbytes ? nbytes : 1, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (ptr == MAP_FAILED)
+        {
+            throw std::bad_alloc();
+        }
+
+        return ptr;
+    }
+
+    static void deallocate(void * ptr, const size_type nbytes)
+    {
+        munmap(ptr, nbytes ? nbytes : 1);
+    }
+};
+
+#endif /* ALLOCATOR_HPP_ */
@@ -0,0 +1,595 @@
+/*******************************************************************************
+ * Copyright (c) 2015 Wojciech Migda
+ * All rights reserved
+ * Distributed under the terms of the GNU LGPL v3
+ *******************************************************************************
+ *
+ * Filename: bench.cpp
+ *
+ * Description:
+ *      Micro and end-to-end benchmarks on synthetic datasets
+ *
+ * Authors:
+ *          Wojciech Migda (wm)
+ *
+ *******************************************************************************
+ * History:
+ * --------
+ * Date         Who  Ticket     Description
+ * ----------   ---  ---------  ------------------------------------------------
+ * 2026-10-17   wm              Initial version
+ *
+ ******************************************************************************/
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <chrono>
+#include <algorithm>
+#include <numeric>
+#include <functional>
+
+#include "ActiveMolecules.hpp"
+#include "text_input.hpp"
+#include "tiled_matrix.hpp"
+#include "out_of_core.hpp"
+#include "sharded_ranker.hpp"
+#include "synthetic.hpp"
+
+namespace
+{
+
+struct BenchResult
+{
+    std::string name;
+    std::size_t X;
+    std::size_t Y;
+    // units of work done by one repetition, e.g. pairs or test molecules
+    std::size_t items;
+    std::vector<double> seconds;
+};
+
+/*
+ * Times `repeat` runs of `body`, calling `setup` before each of them
+ * outside of the measured interval.
+ */
+BenchResult measure(
+    const std::string & name,
+    const SyntheticDataset & dataset,
+    const std::size_t items,
+    const std::size_t repeat,
+    const std::function<void ()> & setup,
+    const std::function<void ()> & body)
+{
+    BenchResult result{name, dataset.X(), dataset.Y(), items, {}};
+
+    for (std::size_t run{0}; run < repeat; ++run)
+    {
+        setup();
+
+        const auto start = std::chrono::steady_clock::now();
+        body();
+        const auto stop = std::chrono::steady_clock::now();
+
+        result.seconds.push_back(std::chrono::duration<double>(stop - start).count());
+    }
+
+    return result;
+}
+
+void write_json(std::ostream & os, const std::vector<BenchResult> & results, const std::uint64_t seed, const std::size_t workers)
+{
+    os << "{\n  \"seed\": " << seed << ",\n  \"workers\": " << workers << ",\n  \"results\": [";
+
+    for (std::size_t idx{0}; idx < results.size(); ++idx)
+    {
+        std::vector<double> seconds = results[idx].seconds;
+        std::sort(seconds.begin(), seconds.end());
+
+        const double mean = std::accumulate(seconds.cbegin(), seconds.cend(), 0.0) / seconds.size();
+        const double median = seconds[seconds.size() / 2];
+
+        os << (idx ? ",\n" : "\n")
+            << "    {\"name\": \"" << results[idx].name << "\""
+            << ", \"X\": " << results[idx].X
+            << ", \"Y\": " << results[idx].Y
+            << ", \"repeat\": " << seconds.size()
+            << ", \"items\": " << results[idx].items
+            << ", \"min_s\": " << seconds.front()
+            << ", \"median_s\": " << median
+            << ", \"mean_s\": " << mean
+            << ", \"items_per_s\": " << results[idx].items / seconds.front()
+            << "}";
+    }
+
+    os << "\n  ]\n}\n";
+}
+
+void run_scale(
+    const std::size_t X,
+    const std::size_t Y,
+    const std::uint64_t seed,
+    const std::size_t repeat,
+    const RankOptions & options,
+    const char * tile_directory,
+    std::vector<BenchResult> & results)
+{
+    const SyntheticDataset dataset(X, Y, seed);
+    const std::size_t N = X + Y;
+    const auto & similarities = dataset.similarities();
+    const auto nothing = [](){};
+
+    // the text input the parsers read
+    std::string text;
+    {
+        char * buffer = nullptr;
+        std::size_t size = 0;
+        std::FILE * stream = open_memstream(&buffer, &size);
+
+        dataset.write(stream);
+        std::fclose(stream);
+        text.assign(buffer, size);
+        std::free(buffer);
+    }
+
+    ThreadPool thread_pool(options.n_workers);
+
+    results.push_back(measure("parse_similarities", dataset, N * N, repeat, nothing,
+        [&]()
+        {
+            std::FILE * stream = fmemopen(&text[0], text.size(), "r");
+            BlockReader reader(stream);
+            std::size_t nx{0};
+            std::size_t ny{0};
+            SimilaritiesInputPlaceholder placeholder;
+
+            reader.next_integer(nx);
+            reader.next_integer(ny);
+            placeholder.allocate(nx + ny);
+            read_similarity_rows(reader, nx + ny, thread_pool,
+                [&placeholder](const std::size_t i, const double * cbegin, const double * cend)
+                {
+                    placeholder.takeFrom(i, cbegin, cend);
+                }
+            );
+            std::fclose(stream);
+        }
+    ));
+
+    MoleculeInputPlaceholder training_placeholder;
+    std::unique_ptr<MoleculeInputPlaceholder::matrix_type> train_data;
+
+    results.push_back(measure("parse_molecules", dataset, N, repeat,
+        [&]()
+        {
+            training_placeholder.takeFrom(dataset.training_molecules());
+        },
+        [&]()
+        {
+            train_data = training_placeholder.render();
+
+            MoleculeInputPlaceholder testing_placeholder;
+            testing_placeholder.takeFrom(dataset.testing_molecules());
+            testing_placeholder.render();
+        }
+    ));
+
+    results.push_back(measure("normalize_columns", dataset, X, repeat,
+        [&]()
+        {
+            training_placeholder.takeFrom(dataset.training_molecules());
+            train_data = training_placeholder.render();
+        },
+        [&]()
+        {
+            train_data = normalize_columns(std::move(train_data));
+        }
+    ));
+
+    // the parse and normalization of the two entries above in one pass
+    results.push_back(measure("parse_normalize_molecules", dataset, X, repeat, nothing,
+        [&]()
+        {
+            training_placeholder.render_normalized();
+        }
+    ));
+
+    const std::valarray<double> activities = train_data->col(21);
+
+    MoleculeInputPlaceholder testing_placeholder;
+    testing_placeholder.takeFrom(dataset.testing_molecules());
+    const std::unique_ptr<MoleculeInputPlaceholder::matrix_type> test_data = normalize_columns(testing_placeholder.render());
+
+    volatile double sink{0.0};
+
+    results.push_back(measure("jaccard", dataset, X * (X - 1) / 2, repeat, nothing,
+        [&]()
+        {
+            const MoleculeInputPlaceholder::matrix_type & matrix = *train_data;
+            double sum{0.0};
+
+            for (std::size_t iidx{0}; iidx < X; ++iidx)
+            {
+                for (std::size_t jidx{iidx + 1}; jidx < X; ++jidx)
+                {
+                    sum += jaccard(matrix.row_view(iidx), matrix.row_view(jidx));
+                }
+            }
+
+            sink = sum;
+        }
+    ));
+
+    results.push_back(measure("build_jaccard_matrix", dataset, X * (X + 1) / 2 + X * Y, repeat, nothing,
+        [&]()
+        {
+            build_jaccard_matrix<double>(*train_data, *test_data, 21, thread_pool);
+        }
+    ));
+
+    results.push_back(measure("find_k_nearest_neighbours", dataset, Y, repeat, nothing,
+        [&]()
+        {
+            std::vector<double> row(X);
+            std::vector<std::size_t> neighbours;
+
+            for (std::size_t yidx{0}; yidx < Y; ++yidx)
+            {
+                for (std::size_t iidx{0}; iidx < X; ++iidx)
+                {
+                    row[iidx] = similarities->at(iidx, X + yidx);
+                }
+
+                neighbours.clear();
+                find_k_nearest_neighbours(row.data(), row.data() + X, std::min<std::size_t>(10, X), std::back_inserter(neighbours));
+            }
+        }
+    ));
+
+    // a handful of thresholds and molecules keeps the quadratic kernels affordable
+    constexpr std::size_t N_PROBES{4};
+
+    results.push_back(measure("CPsim", dataset, N_PROBES * X * (X - 1) / 2, repeat, nothing,
+        [&]()
+        {
+            for (std::size_t probe{0}; probe < N_PROBES; ++probe)
+            {
+                sink = CPsim(0.2 * (probe + 1), 0.0, similarities, activities);
+            }
+        }
+    ));
+
+    results.push_back(measure("CPsim_parallel", dataset, N_PROBES * X * (X - 1) / 2, repeat, nothing,
+        [&]()
+        {
+            for (std::size_t probe{0}; probe < N_PROBES; ++probe)
+            {
+                sink = CPsim(0.2 * (probe + 1), 0.0, similarities, activities, thread_pool);
+            }
+        }
+    ));
+
+    const ActivityAgreementMask agreement(&activities[0], X, 0.0);
+
+    results.push_back(measure("CPsim_mask", dataset, N_PROBES * X * (X - 1) / 2, repeat, nothing,
+        [&]()
+        {
+            for (std::size_t probe{0}; probe < N_PROBES; ++probe)
+            {
+                sink = CPsim(0.2 * (probe + 1), agreement, similarities);
+            }
+        }
+    ));
+
+    results.push_back(measure("CPsimCurve", dataset, X * (X - 1) / 2, repeat, nothing,
+        [&]()
+        {
+            const CPsimCurve<double, 101> curve(0.0, similarities, activities);
+            sink = curve.at(0.5);
+        }
+    ));
+
+    results.push_back(measure("CPsimCurve_parallel", dataset, X * (X - 1) / 2, repeat, nothing,
+        [&]()
+        {
+            const CPsimCurve<double, 101> curve(0.0, similarities, activities, thread_pool);
+            sink = curve.at(0.5);
+        }
+    ));
+
+    SamplingOptions sampling;
+    sampling.budget = 100000;
+
+    results.push_back(measure("CPsimCurve_sampled", dataset, sampling.budget, repeat, nothing,
+        [&]()
+        {
+            const SampledCPsimCurve<double, 101> curve(0.0, similarities, activities, sampling);
+            sink = curve.at(0.5);
+        }
+    ));
+
+    const CPsimCurve<double, 101> curve(0.0, similarities, activities);
+
+    results.push_back(measure("APSsim", dataset, Y, repeat, nothing,
+        [&]()
+        {
+            for (std::size_t yidx{0}; yidx < Y; ++yidx)
+            {
+                sink = APSsim(X + yidx, curve, similarities, activities);
+            }
+        }
+    ));
+
+    results.push_back(measure("APSsim_cached", dataset, N_PROBES, repeat, nothing,
+        [&]()
+        {
+            for (std::size_t probe{0}; probe < N_PROBES; ++probe)
+            {
+                sink = APSsim(X + probe % Y, 0.0, similarities, activities);
+            }
+        }
+    ));
+
+    results.push_back(measure("APSsim_mask", dataset, N_PROBES, repeat, nothing,
+        [&]()
+        {
+            for (std::size_t probe{0}; probe < N_PROBES; ++probe)
+            {
+                sink = APSsim(X + probe % Y, agreement, similarities, activities);
+            }
+        }
+    ));
+
+    const std::valarray<double> feature = train_data->col(0);
+
+    results.push_back(measure("CP", dataset, N_PROBES * X * (X - 1) / 2, repeat, nothing,
+        [&]()
+        {
+            for (std::size_t probe{0}; probe < N_PROBES; ++probe)
+            {
+                sink = CP(0.25 * (probe + 1), 0.0, feature, activities, AbsLessEqual());
+            }
+        }
+    ));
+
+    results.push_back(measure("CP_parallel", dataset, N_PROBES * X * (X - 1) / 2, repeat, nothing,
+        [&]()
+        {
+            for (std::size_t probe{0}; probe < N_PROBES; ++probe)
+            {
+                sink = CP(0.25 * (probe + 1), 0.0, feature, activities, AbsLessEqual(), thread_pool);
+            }
+        }
+    ));
+
+    results.push_back(measure("APS", dataset, N_PROBES, repeat, nothing,
+        [&]()
+        {
+            for (std::size_t probe{0}; probe < N_PROBES; ++probe)
+            {
+                sink = APS(probe % X, 0.0, feature, activities, AbsLessEqual());
+            }
+        }
+    ));
+
+    // APS on the O(N^2) engine the sorted one replaces for the abs comparators
+    results.push_back(measure("APS_pairwise", dataset, N_PROBES, repeat, nothing,
+        [&]()
+        {
+            typedef CPEngine<double, DifferenceSource<double>, AbsLessEqual> engine_type;
+
+            for (std::size_t probe{0}; probe < N_PROBES; ++probe)
+            {
+                const std::valarray<double> distances = feature - feature[probe % X];
+                BucketCache<double, 51> cache(std::minmax_element(std::begin(distances), std::end(distances)));
+
+                const engine_type engine{DifferenceSource<double>(&distances[0]), &activities[0], X, 0.0};
+
+                sink = engine.APS([&distances](const std::size_t iidx){ return distances[iidx]; }, cache);
+            }
+        }
+    ));
+
+    // curves of all 21 descriptors and the scores of every test molecule
+    results.push_back(measure("DescriptorAPS", dataset, Y * 21, repeat, nothing,
+        [&]()
+        {
+            const DescriptorAPS<double, 101> descriptor_aps(*train_data, 21, activities, 0.0, thread_pool);
+
+            sink = descriptor_aps.score(*test_data, thread_pool)->at(0, 0);
+        }
+    ));
+
+    std::vector<std::string> training_molecules;
+    std::vector<std::string> testing_molecules;
+
+    results.push_back(measure("rank", dataset, Y, repeat,
+        [&]()
+        {
+            training_molecules = dataset.training_molecules();
+            testing_molecules = dataset.testing_molecules();
+        },
+        [&]()
+        {
+            ActiveMolecules(options).rank(training_molecules, testing_molecules, similarities);
+        }
+    ));
+
+    // tiles sized for a 16 MiB budget, so that mid-sized datasets take several
+    TiledMatrixFile<double> tiles(tile_directory, X, X + Y, tile_size_for_budget(16 << 20, X + Y, sizeof (double)));
+    {
+        TiledMatrixWriter<double> writer(tiles);
+        std::vector<double> row(X + Y);
+
+        for (std::size_t iidx{0}; iidx < X; ++iidx)
+        {
+            for (std::size_t jidx{0}; jidx < X + Y; ++jidx)
+            {
+                row[jidx] = similarities->at(iidx, jidx);
+            }
+
+            writer.writeRow(iidx, row.data(), row.data() + row.size());
+        }
+    }
+
+    if (tiles.good())
+    {
+        results.push_back(measure("rank_out_of_core", dataset, Y, repeat,
+            [&]()
+            {
+                training_molecules = dataset.training_molecules();
+                testing_molecules = dataset.testing_molecules();
+            },
+            [&]()
+            {
+                OutOfCoreScorer<double> scorer(tiles, options.activity_thr_A_star);
+
+                ActiveMolecules(options).rank_scored(training_molecules, testing_molecules, scorer);
+            }
+        ));
+    }
+    else
+    {
+        std::cerr << "Cannot write tiles under " << tile_directory << ", rank_out_of_core skipped" << std::endl;
+    }
+
+    results.push_back(measure("rank_sharded4", dataset, Y, repeat,
+        [&]()
+        {
+            training_molecules = dataset.training_molecules();
+            testing_molecules = dataset.testing_molecules();
+        },
+        [&]()
+        {
+            ShardedScorer<SymmetricMatrix2d<double>> scorer(similarities, options.activity_thr_A_star, 4);
+
+            ActiveMolecules(options).rank_scored(training_molecules, testing_molecules, scorer);
+        }
+    ));
+
+    RankOptions knn_options(options);
+    knn_options.knn = 50;
+
+    results.push_back(measure("rank_knn50", dataset, Y, repeat,
+        [&]()
+        {
+            training_molecules = dataset.training_molecules();
+            testing_molecules = dataset.testing_molecules();
+        },
+        [&]()
+        {
+            ActiveMolecules(knn_options).rank(training_molecules, testing_molecules, similarities);
+        }
+    ));
+}
+
+bool parse_scales(const char * spec, std::vector<std::pair<std::size_t, std::size_t>> & scales)
+{
+    std::stringstream stream(spec);
+    std::string item;
+
+    scales.clear();
+
+    while (std::getline(stream, item, ','))
+    {
+        std::size_t X{0};
+        std::size_t Y{0};
+
+        if (std::sscanf(item.c_str(), "%zux%zu", &X, &Y) != 2 || X < 2 || Y < 1)
+        {
+            return false;
+        }
+
+        scales.emplace_back(X, Y);
+    }
+
+    return !scales.empty();
+}
+
+}
+
+int main(int argc, char ** argv)
+{
+    RankOptions options;
+    std::uint64_t seed{1};
+    std::size_t repeat{5};
+    const char * output_path = nullptr;
+    const char * tile_directory = std::getenv("TMPDIR") != nullptr ? std::getenv("TMPDIR") : "/tmp";
+    bool generate{false};
+    std::vector<std::pair<std::size_t, std::size_t>> scales{{250, 100}, {1000, 300}, {2000, 600}};
+
+    for (int iarg = 1; iarg < argc; ++iarg)
+    {
+        if ((!strcmp(argv[iarg], "-j") || !strcmp(argv[iarg], "--workers")) && (iarg + 1 < argc))
+        {
+            options.n_workers = std::strtoul(argv[++iarg], nullptr, 10);
+        }
+        else if (!strcmp(argv[iarg], "--seed") && (iarg + 1 < argc))
+        {
+            seed = std::strtoull(argv[++iarg], nullptr, 10);
+        }
+        else if (!strcmp(argv[iarg], "--repeat") && (iarg + 1 < argc))
+        {
+            repeat = std::max<std::size_t>(1, std::strtoul(argv[++iarg], nullptr, 10));
+        }
+        else if (!strcmp(argv[iarg], "--scales") && (iarg + 1 < argc) && parse_scales(argv[iarg + 1], scales))
+        {
+            ++iarg;
+        }
+        else if (!strcmp(argv[iarg], "--tile-dir") && (iarg + 1 < argc))
+        {
+            tile_directory = argv[++iarg];
+        }
+        else if (!strcmp(argv[iarg], "-o") && (iarg + 1 < argc))
+        {
+            output_path = argv[++iarg];
+        }
+        else if (!strcmp(argv[iarg], "--generate") && (iarg + 1 < argc) && parse_scales(argv[iarg + 1], scales))
+        {
+            generate = true;
+            ++iarg;
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0]
+                << " [-j|--workers N] [--seed S] [--repeat R] [--scales XxY,...] [--tile-dir DIR] [-o results.json]"
+                << "\n       " << argv[0] << " [--seed S] --generate XxY > input" << std::endl;
+            return 1;
+        }
+    }
+
+    if (generate)
+    {
+        // dump the first scale as text input instead of benchmarking
+        SyntheticDataset(scales.front().first, scales.front().second, seed).write(stdout);
+
+        return 0;
+    }
+
+    std::vector<BenchResult> results;
+
+    for (const auto & scale : scales)
+    {
+        run_scale(scale.first, scale.second, seed, repeat, options, tile_directory, results);
+    }
+
+    if (output_path != nullptr)
+    {
+        std::ofstream output(output_path);
+
+        write_json(output, results, seed, options.n_workers);
+    }
+    else
+    {
+        write_json(std::cout, results, seed, options.n_workers);
+    }
+
+    return 0;
+}
@@ -0,0 +1,364 @@
+/*******************************************************************************
+ * Copyright (c) 2015 Wojciech Migda
+ * All rights reserved
+ * Distributed under the terms of the GNU LGPL v3
+ *******************************************************************************
+ *
+ * Filename: binary_matrix.hpp
+ *
+ * Description:
+ *      Binary similarity dataset format, writer and memory mapped loader
+ *
+ * Authors:
+ *          Wojciech Migda (wm)
+ *
+ *******************************************************************************
+ * History:
+ * --------
+ * Date         Who  Ticket     Description
+ * ----------   ---  ---------  ------------------------------------------------
+ * 2026-10-17   wm              Initial version
+ *
+ ******************************************************************************/
+
+#ifndef BINARY_MATRIX_HPP_
+#define BINARY_MATRIX_HPP_
+
+#include "matrix.hpp"
+#include "symmetric_matrix.hpp"
+#include "quantize.hpp"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+/*
+ * File layout:
+ *
+ *   [0, 128)                       BinaryMatrixHeader, zero padded
+ *   [matrix_offset, +matrix_bytes) similarities, dense rows or packed upper
+ *                                  triangle rows, as doubles or byte codes
+ *   [molecules_offset, ...)        the X + Y molecule records, one per line
+ *
+ * Numbers are stored in host byte order; byte_order lets a reader detect
+ * a file written on a machine of the other endianness.
+ */
+struct BinaryMatrixHeader
+{
+    enum DType : std::uint32_t
+    {
+        F64 = 0,
+        U8 = 1
+    };
+
+    enum Layout : std::uint32_t
+    {
+        DENSE = 0,
+        PACKED_UPPER = 1
+    };
+
+    static constexpr std::uint32_t BYTE_ORDER_MARK{0x01020304};
+    static constexpr std::uint32_t VERSION{1};
+    static constexpr std::size_t MATRIX_OFFSET{128};
+    // keeps the matrix size, up to 8 N^2 bytes, clear of 64 bit overflow
+    static constexpr std::uint64_t MAX_MOLECULES{std::uint64_t(1) << 28};
+
+    char magic[8];
+    std::uint32_t byte_order;
+    std::uint32_t version;
+    std::uint32_t dtype;
+    std::uint32_t layout;
+    std::uint64_t X;
+    std::uint64_t Y;
+    std::uint64_t matrix_offset;
+    std::uint64_t matrix_bytes;
+    std::uint64_t molecules_offset;
+    std::uint64_t molecules_bytes;
+
+    static const char * expected_magic()
+    {
+        return "AMSIMBIN";
+    }
+
+    std::size_t n_molecules() const
+    {
+        return X + Y;
+    }
+
+    std::size_t element_size() const
+    {
+        return dtype == U8 ? sizeof (std::uint8_t) : sizeof (double);
+    }
+
+    std::size_t n_elements() const
+    {
+        return
+            layout == PACKED_UPPER ?
+                SymmetricMatrix2d<double>::packed_size(n_molecules(), n_molecules())
+                :
+                n_molecules() * n_molecules();
+    }
+
+    bool valid() const
+    {
+        return
+            !std::memcmp(magic, expected_magic(), sizeof (magic)) &&
+            byte_order == BYTE_ORDER_MARK &&
+            version == VERSION &&
+            (dtype == F64 || dtype == U8) &&
+            (layout == DENSE || layout == PACKED_UPPER) &&
+            X <= MAX_MOLECULES && Y <= MAX_MOLECULES &&
+            matrix_bytes == n_elements() * element_size();
+    }
+
+    // valid(), with both sections in order and inside a file of `file_size` bytes
+    bool fits(const std::uint64_t file_size) const
+    {
+        return
+            valid() &&
+            matrix_offset == MATRIX_OFFSET &&
+            !sum_overflows(matrix_offset, matrix_bytes) &&
+            matrix_offset + matrix_bytes <= molecules_offset &&
+            !sum_overflows(molecules_offset, molecules_bytes) &&
+            molecules_offset + molecules_bytes <= file_size;
+    }
+
+private:
+    static bool sum_overflows(const std::uint64_t lhs, const std::uint64_t rhs)
+    {
+        return lhs + rhs < lhs;
+    }
+};
+
+static_assert(sizeof (BinaryMatrixHeader) <= BinaryMatrixHeader::MATRIX_OFFSET, "header does not fit its slot");
+
+/*
+ * Writes the binary format row by row, so a converter never has to hold
+ * the whole matrix. The header is completed by close().
+ */
+struct BinaryMatrixWriter
+{
+    typedef std::size_t size_type;
+
+    BinaryMatrixWriter(
+        const char * path,
+        const size_type X,
+        const size_type Y,
+        const BinaryMatrixHeader::DType dtype,
+        const BinaryMatrixHeader::Layout layout)
+    :
+        m_file(std::fopen(path, "wb")),
+        m_header()
+    {
+        std::memcpy(m_header.magic, BinaryMatrixHeader::expected_magic(), sizeof (m_header.magic));
+        m_header.byte_order = BinaryMatrixHeader::BYTE_ORDER_MARK;
+        m_header.version = BinaryMatrixHeader::VERSION;
+        m_header.dtype = dtype;
+        m_header.layout = layout;
+        m_header.X = X;
+        m_header.Y = Y;
+        m_header.matrix_offset = BinaryMatrixHeader::MATRIX_OFFSET;
+        m_header.matrix_bytes = m_header.n_elements() * m_header.element_size();
+        m_header.molecules_offset = m_header.matrix_offset + m_header.matrix_bytes;
+        m_header.molecules_bytes = 0;
+
+        if (m_file != nullptr)
+        {
+            const std::vector<char> padding(BinaryMatrixHeader::MATRIX_OFFSET, 0);
+
+            std::fwrite(padding.data(), 1, padding.size(), m_file);
+        }
+    }
+
+    ~BinaryMatrixWriter()
+    {
+        close();
+    }
+
+    bool good() const
+    {
+        return m_file != nullptr && !std::ferror(m_file);
+    }
+
+    // `cbegin` .. `cend` is the full row `index` of the similarity matrix
+    void writeRow(const size_type index, const double * cbegin, const double * cend)
+    {
+        if (m_file == nullptr)
+        {
+            return;
+        }
+
+        const double * from = m_header.layout == BinaryMatrixHeader::PACKED_UPPER ? cbegin + index : cbegin;
+
+        if (m_header.dtype == BinaryMatrixHeader::U8)
+        {
+            m_codes.resize(cend - from);
+            std::transform(from, cend, m_codes.begin(), SimilarityCodec<std::uint8_t>::encode);
+            std::fwrite(m_codes.data(), sizeof (std::uint8_t), m_codes.size(), m_file);
+        }
+        else
+        {
+            std::fwrite(from, sizeof (double), cend - from, m_file);
+        }
+    }
+
+    void writeMolecule(const std::string & molecule)
+    {
+        if (m_file == nullptr)
+        {
+            return;
+        }
+
+        std::fwrite(molecule.data(), 1, molecule.size(), m_file);
+        std::fputc('\n', m_file);
+        m_header.molecules_bytes += molecule.size() + 1;
+    }
+
+    bool close()
+    {
+        if (m_file == nullptr)
+        {
+            return false;
+        }
+
+        std::fseek(m_file, 0, SEEK_SET);
+        std::fwrite(&m_header, sizeof (m_header), 1, m_file);
+
+        const bool result = !std::ferror(m_file);
+
+        std::fclose(m_file);
+        m_file = nullptr;
+
+        return result;
+    }
+
+private:
+    std::FILE * m_file;
+    BinaryMatrixHeader m_header;
+    std::vector<std::uint8_t> m_codes;
+};
+
+/*
+ * Read-only mapping of a binary dataset. The similarity matrix is served
+ * directly from the mapped pages through MatrixView/SymmetricMatrixView,
+ * so loading costs only the page faults of what the ranking touches.
+ */
+struct MappedBinaryMatrix
+{
+    typedef std::size_t size_type;
+
+    MappedBinaryMatrix()
+    :
+        m_data(nullptr),
+        m_size(0)
+    {
+    }
+
+    MappedBinaryMatrix(const MappedBinaryMatrix &) = delete;
+    MappedBinaryMatrix & operator=(const MappedBinaryMatrix &) = delete;
+
+    ~MappedBinaryMatrix()
+    {
+        if (m_data != nullptr)
+        {
+            munmap(m_data, m_size);
+        }
+    }
+
+    bool open(const char * path)
+    {
+        const int fd = ::open(path, O_RDONLY);
+
+        if (fd < 0)
+        {
+            return false;
+        }
+
+        struct stat st;
+
+        if (fstat(fd, &st) != 0 || (size_type)st.st_size < sizeof (BinaryMatrixHeader))
+        {
+            ::close(fd);
+            return false;
+        }
+
+        m_size = st.st_size;
+        void * data = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+
+        if (data == MAP_FAILED)
+        {
+            m_size = 0;
+            return false;
+        }
+
+        m_data = data;
+        madvise(m_data, m_size, MADV_WILLNEED);
+
+        return header().fits(m_size);
+    }
+
+    const BinaryMatrixHeader & header() const
+    {
+        return *static_cast<const BinaryMatrixHeader *>(m_data);
+    }
+
+    template<typename _Type>
+    std::unique_ptr<SymmetricMatrixView<_Type>> packed() const
+    {
+        return std::unique_ptr<SymmetricMatrixView<_Type>>(
+            new SymmetricMatrixView<_Type>(matrix_data<_Type>(), header().n_molecules(), header().n_molecules()));
+    }
+
+    template<typename _Type>
+    std::unique_ptr<MatrixView<_Type>> dense() const
+    {
+        return std::unique_ptr<MatrixView<_Type>>(
+            new MatrixView<_Type>(matrix_data<_Type>(), header().n_molecules(), header().n_molecules()));
+    }
+
+    // false unless the molecule section holds all X + Y newline terminated records
+    bool molecules(std::vector<std::string> & training_data, std::vector<std::string> & testing_data) const
+    {
+        const char * pos = static_cast<const char *>(m_data) + header().molecules_offset;
+        const char * end = pos + header().molecules_bytes;
+
+        for (size_type index = 0; index < header().n_molecules(); ++index)
+        {
+            const char * eol = std::find(pos, end, '\n');
+
+            if (eol == end)
+            {
+                return false;
+            }
+
+            (index < header().X ? training_data : testing_data).emplace_back(pos, eol);
+            pos = eol + 1;
+        }
+
+        return true;
+    }
+
+private:
+    template<typename _Type>
+    const _Type * matrix_data() const
+    {
+        return reinterpret_cast<const _Type *>(static_cast<const char *>(m_data) + header().matrix_offset);
+    }
+
+private:
+    void * m_data;
+    size_type m_size;
+};
+
+#endif /* BINARY_MATRIX_HPP_ */
@@ -0,0 +1,128 @@
+/*******************************************************************************
+ * Copyright (c) 2015 Wojciech Migda
+ * All rights reserved
+ * Distributed under the terms of the GNU LGPL v3
+ *******************************************************************************
+ *
+ * Filename: convert.cpp
+ *
+ * Description:
+ *      Converts the text input into the binary dataset format
+ *
+ * Authors:
+ *          Wojciech Migda (wm)
+ *
+ *******************************************************************************
+ * History:
+ * --------
+ * Date         Who  Ticket     Description
+ * ----------   ---  ---------  ------------------------------------------------
+ * 2026-10-17   wm              Initial version
+ *
+ ******************************************************************************/
+
+#include <iostream>
+#include <string>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+
+#include "text_input.hpp"
+#include "binary_matrix.hpp"
+
+int main(int argc, char ** argv)
+{
+    BinaryMatrixHeader::DType dtype = BinaryMatrixHeader::F64;
+    BinaryMatrixHeader::Layout layout = BinaryMatrixHeader::PACKED_UPPER;
+    std::size_t n_workers = ThreadPool::default_workers();
+    const char * output_path = nullptr;
+
+    for (int iarg = 1; iarg < argc; ++iarg)
+    {
+        if ((!strcmp(argv[iarg], "-j") || !strcmp(argv[iarg], "--workers")) && (iarg + 1 < argc))
+        {
+            n_workers = std::strtoul(argv[++iarg], nullptr, 10);
+        }
+        else if (!strcmp(argv[iarg], "-q") || !strcmp(argv[iarg], "--quantized"))
+        {
+            dtype = BinaryMatrixHeader::U8;
+        }
+        else if (!strcmp(argv[iarg], "--dense"))
+        {
+            layout = BinaryMatrixHeader::DENSE;
+        }
+        else if (output_path == nullptr && argv[iarg][0] != '-')
+        {
+            output_path = argv[iarg];
+        }
+        else
+        {
+            output_path = nullptr;
+            break;
+        }
+    }
+
+    if (output_path == nullptr)
+    {
+        std::cerr << "Usage: " << argv[0] << " [-j|--workers N] [-q|--quantized] [--dense] output.bin < input" << std::endl;
+        return 1;
+    }
+
+    BlockReader reader(stdin);
+    ThreadPool thread_pool(n_workers);
+
+    std::size_t X{0};
+    std::size_t Y{0};
+
+    reader.next_integer(X);
+    reader.next_integer(Y);
+
+    BinaryMatrixWriter writer(output_path, X, Y, dtype, layout);
+
+    // a partial output would still carry a valid header, so never leave one behind
+    auto fail = [&writer, output_path](const char * message)
+    {
+        writer.close();
+        std::remove(output_path);
+        std::cerr << message << std::endl;
+        return 1;
+    };
+
+    if (!writer.good())
+    {
+        return fail((std::string("Cannot write ") + output_path).c_str());
+    }
+
+    const bool complete = read_similarity_rows(reader, X + Y, thread_pool,
+        [&writer](const std::size_t i, const double * cbegin, const double * cend)
+        {
+            writer.writeRow(i, cbegin, cend);
+        }
+    );
+
+    if (!complete)
+    {
+        return fail("Truncated similarity matrix in input");
+    }
+
+    std::string molecule;
+    std::size_t n_written{0};
+
+    for (; n_written < X + Y && reader.next_token(molecule); ++n_written)
+    {
+        writer.writeMolecule(molecule);
+    }
+
+    if (n_written != X + Y)
+    {
+        return fail("Truncated molecule records in input");
+    }
+
+    if (!writer.good() || !writer.close())
+    {
+        return fail((std::string("Cannot write ") + output_path).c_str());
+    }
+
+    return 0;
+}
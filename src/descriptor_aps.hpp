@@ -0,0 +1,256 @@
+/*******************************************************************************
+ * Copyright (c) 2015 Wojciech Migda
+ * All rights reserved
+ * Distributed under the terms of the GNU LGPL v3
+ *******************************************************************************
+ *
+ * Filename: descriptor_aps.hpp
+ *
+ * Description:
+ *      Batched descriptor APS over all molecule feature columns
+ *
+ * Authors:
+ *          Wojciech Migda (wm)
+ *
+ *******************************************************************************
+ * History:
+ * --------
+ * Date         Who  Ticket     Description
+ * ----------   ---  ---------  ------------------------------------------------
+ * 2026-10-17   wm              Initial version
+ *
+ ******************************************************************************/
+
+#ifndef DESCRIPTOR_APS_HPP_
+#define DESCRIPTOR_APS_HPP_
+
+#include "matrix.hpp"
+#include "parallel.hpp"
+#include "pair_scheduler.hpp"
+#include "CP.hpp"
+#include "instrument.hpp"
+
+#include <cstddef>
+#include <cmath>
+#include <valarray>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+/*
+ * APS of every descriptor column at once, under AbsLessEqual: CP(t) of a
+ * column is the fraction of agreeing activities among the training pairs
+ * whose values in that column are within t of each other.
+ *
+ * As CPsimCurve does for APSsim, every column gets a curve of CP over _N
+ * evenly spaced gap buckets from 0 to the range of the column. The curves
+ * are the per column CP caches and are built in a single tiled pass over
+ * the training pairs, each pair binned into all columns' histograms. The
+ * training values are kept column by column, so that scoring a column
+ * streams one contiguous array. Scoring a test molecule for a column is
+ * then a curve lookup per training molecule.
+ *
+ * Thresholds are quantized the way CPsimCurve quantizes similarities, so
+ * the scores approximate APS(), with its first-hit bucket cache, rather
+ * than reproduce it.
+ */
+template<typename _ValueType, std::size_t _N>
+struct DescriptorAPS
+{
+    typedef std::size_t size_type;
+    typedef _ValueType value_type;
+    typedef Matrix2d<value_type, SimdPadding, ColumnMajor> columns_type;
+    typedef Matrix2d<value_type> scores_type;
+    typedef CPsimHistogram<_N> histogram_type;
+
+    static constexpr size_type N{_N};
+
+    template<typename _MatrixType>
+    DescriptorAPS(
+        const _MatrixType & train_data,
+        const size_type n_descriptors,
+        const std::valarray<value_type> & activities,
+        const value_type activity_thr_A_star,
+        ThreadPool & thread_pool)
+    :
+        m_columns(train_data.rows(), n_descriptors),
+        m_activities(activities),
+        m_scales(n_descriptors, 0.0),
+        m_CPs(n_descriptors * N, 0.0)
+    {
+        const size_type X = train_data.rows();
+
+        for (size_type col{0}; col < n_descriptors; ++col)
+        {
+            value_type * values = m_columns.col_begin(col);
+
+            for (size_type row{0}; row < X; ++row)
+            {
+                values[row] = train_data.at(row, col);
+            }
+
+            const auto min_max = std::minmax_element(values, values + X);
+            const value_type range = X != 0 ? *min_max.second - *min_max.first : 0.0;
+
+            m_scales[col] = range > 0.0 ? (N - 1) / range : 0.0;
+        }
+
+        AM_COUNT(PAIRS_VISITED, X * (X - 1) / 2);
+
+        const ColumnHistograms histograms = reduce_tiles(thread_pool, TriangleTiling(X, X),
+            ColumnHistograms(n_descriptors),
+            [&](const PairTile & tile, ColumnHistograms & partial)
+            {
+                add_tile(tile, activity_thr_A_star, partial);
+            }
+        );
+
+        for (size_type col{0}; col < n_descriptors; ++col)
+        {
+            accumulate(col, histograms[col]);
+        }
+    }
+
+    size_type descriptors() const
+    {
+        return m_columns.cols();
+    }
+
+    // CP of pairs within `threshold` in column `col`, 0 for negative thresholds
+    value_type at(const size_type col, const value_type threshold) const
+    {
+        return threshold < 0.0 ? 0.0 : m_CPs[col * N + bucket(col, threshold)];
+    }
+
+    /*
+     * APS for column `col` of a molecule whose value in it is `feature`,
+     * the thresholds being `training value - feature` as in APS().
+     * Returns 0 when no training molecule gets a non-zero CP.
+     */
+    value_type score(const size_type col, const value_type feature) const
+    {
+        const value_type * values = m_columns.col_cbegin(col);
+        const size_type X = m_columns.rows();
+
+        value_type numerator{0.0};
+        value_type denominator{0.0};
+
+        for (size_type iidx{0}; iidx < X; ++iidx)
+        {
+            const value_type CP = at(col, values[iidx] - feature);
+
+            numerator += m_activities[iidx] * CP;
+            denominator += CP;
+        }
+
+        return denominator != 0.0 ? numerator / denominator : 0.0;
+    }
+
+    // scores of every row of `test_data` (rows) for every column (columns)
+    template<typename _MatrixType>
+    std::unique_ptr<scores_type> score(const _MatrixType & test_data, ThreadPool & thread_pool) const
+    {
+        const size_type n_descriptors = descriptors();
+        std::unique_ptr<scores_type> scores(new scores_type(test_data.rows(), n_descriptors));
+
+        thread_pool.parallel_for(0, test_data.rows() * n_descriptors,
+            [&](const size_type idx)
+            {
+                const size_type row = idx / n_descriptors;
+                const size_type col = idx % n_descriptors;
+
+                scores->write(row, col, score(col, test_data.at(row, col)));
+            },
+            16
+        );
+
+        return scores;
+    }
+
+private:
+    struct ColumnHistograms
+    {
+        explicit ColumnHistograms(const size_type n_columns)
+        :
+            m_histograms(n_columns)
+        {
+        }
+
+        ColumnHistograms & operator+=(const ColumnHistograms & other)
+        {
+            for (size_type col{0}; col < m_histograms.size(); ++col)
+            {
+                m_histograms[col] += other.m_histograms[col];
+            }
+
+            return *this;
+        }
+
+        histogram_type & operator[](const size_type col)
+        {
+            return m_histograms[col];
+        }
+
+        const histogram_type & operator[](const size_type col) const
+        {
+            return m_histograms[col];
+        }
+
+    private:
+        std::vector<histogram_type> m_histograms;
+    };
+
+    size_type bucket(const size_type col, const value_type gap) const
+    {
+        return std::min<size_type>(gap * m_scales[col] + 0.5, N - 1);
+    }
+
+    // every pair of the tile once, binned into all columns
+    void add_tile(const PairTile & tile, const value_type activity_thr_A_star, ColumnHistograms & histograms) const
+    {
+        const size_type n_descriptors = descriptors();
+
+        for (size_type iidx{tile.row_begin}; iidx < tile.row_end; ++iidx)
+        {
+            const value_type activity_iidx = m_activities[iidx];
+
+            for (size_type jidx{std::max(tile.col_begin, iidx + 1)}; jidx < tile.col_end; ++jidx)
+            {
+                const bool Delta_A_i_j_LE_A_star = fabs(activity_iidx - m_activities[jidx]) <= activity_thr_A_star;
+
+                for (size_type col{0}; col < n_descriptors; ++col)
+                {
+                    const value_type * values = m_columns.col_cbegin(col);
+
+                    histograms[col].add(bucket(col, fabs(values[iidx] - values[jidx])), Delta_A_i_j_LE_A_star);
+                }
+            }
+        }
+    }
+
+    // prefix sums: a threshold in bucket b takes the pairs of buckets <= b
+    void accumulate(const size_type col, const histogram_type & histogram)
+    {
+        size_type numerator{0};
+        size_type denominator{0};
+
+        for (size_type idx{0}; idx < N; ++idx)
+        {
+            numerator += histogram.numerator(idx);
+            denominator += histogram.denominator(idx);
+
+            m_CPs[col * N + idx] = denominator != 0 ? (value_type)numerator / denominator : 0.0;
+        }
+    }
+
+private:
+    // training values, column by column
+    columns_type m_columns;
+    const std::valarray<value_type> m_activities;
+    // gap to bucket factor of every column
+    std::vector<value_type> m_scales;
+    // N curve points per column
+    std::vector<value_type> m_CPs;
+};
+
+#endif /* DESCRIPTOR_APS_HPP_ */
@@ -0,0 +1,599 @@
+/*******************************************************************************
+ * Copyright (c) 2015 Wojciech Migda
+ * All rights reserved
+ * Distributed under the terms of the GNU LGPL v3
+ *******************************************************************************
+ *
+ * Filename: incremental_ranker.hpp
+ *
+ * Description:
+ *      Ranking engine updated in place as molecules are added
+ *
+ * Authors:
+ *          Wojciech Migda (wm)
+ *
+ *******************************************************************************
+ * History:
+ * --------
+ * Date         Who  Ticket     Description
+ * ----------   ---  ---------  ------------------------------------------------
+ * 2026-10-17   wm              Initial version
+ *
+ ******************************************************************************/
+
+#ifndef INCREMENTAL_RANKER_HPP_
+#define INCREMENTAL_RANKER_HPP_
+
+#include "ActiveMolecules.hpp"
+#include "molecule_input_placeholder.hpp"
+#include "jaccard_matrix.hpp"
+#include "algebra.hpp"
+#include "matrix.hpp"
+#include "quantize.hpp"
+#include "parallel.hpp"
+#include "pair_scheduler.hpp"
+#include "CP.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <valarray>
+#include <memory>
+#include <tuple>
+#include <algorithm>
+#include <iterator>
+
+/*
+ * Keeps everything ActiveMolecules::rank derives from its input so that
+ * molecules can be added without starting over:
+ *
+ *  - per column running statistics of the raw training and test rows,
+ *  - normalized descriptors and activities of every molecule,
+ *  - CPsim pair histograms of the similarity and Jaccard matrices over the
+ *    training pairs,
+ *  - bucket codes of the similarities and Jaccards between every test
+ *    molecule and every training molecule.
+ *
+ * Adding a training molecule bins its pairs with the existing training
+ * molecules and extends every test row by one code, which is O(N). Adding
+ * a test molecule computes its codes against the training set, also O(N).
+ * rank() then costs O(X) per test molecule.
+ *
+ * Normalization is frozen at fit(): added molecules are normalized with
+ * the column statistics snapshot taken then, although the running
+ * statistics keep being updated. refit() renormalizes everything with the
+ * current statistics and rebuilds the Jaccard part in O(N^2), after which
+ * the ranking equals ActiveMolecules::rank on the same data. Pairs agree
+ * when their normalized activities are within the A* of the RankOptions,
+ * as in the batch ranking. With the default A* = 0 this does not depend on
+ * the normalization and the similarity histogram survives refit()
+ * unchanged; with any other A* the training pair codes, X^2 / 2 bytes, are
+ * kept and rebinned by refit().
+ */
+struct IncrementalRanker
+{
+    typedef std::size_t size_type;
+    typedef std::vector<std::string> molecule_array_type;
+    typedef CPsimHistogram<101> histogram_type;
+    typedef CPsimCurve<double, 101> curve_type;
+    typedef SimilarityCodec<std::uint8_t> codec_type;
+    typedef MoleculeInputPlaceholder::ColumnStatistics statistics_type;
+    typedef std::vector<std::uint8_t> code_array_type;
+
+    static constexpr size_type N_COL{MoleculeInputPlaceholder::N_COL};
+    static constexpr size_type ACTIVITY_INDEX{21};
+    static constexpr size_type N_FEATURES{ACTIVITY_INDEX};
+
+    explicit IncrementalRanker(const RankOptions & options = RankOptions())
+    :
+        m_activity_thr_A_star(options.activity_thr_A_star),
+        m_thread_pool(options.n_workers),
+        m_train_mean(N_COL, 0.0),
+        m_train_stddev(N_COL, 1.0),
+        m_test_mean(N_COL, 0.0),
+        m_test_stddev(N_COL, 1.0)
+    {
+    }
+
+    /*
+     * Initial state from the same input as ActiveMolecules::rank, with
+     * the training molecules taking the leading rows of `similarities`.
+     */
+    template<typename _MatrixType>
+    void fit(
+        const molecule_array_type & training_data,
+        const molecule_array_type & testing_data,
+        const std::unique_ptr<_MatrixType> & similarities);
+
+    /*
+     * `similarities` holds the similarities of the new molecule to all
+     * current training molecules followed by all current test molecules.
+     */
+    void addTraining(const std::string & molecule, const double * similarities);
+
+    // `similarities` holds the similarities to all current training molecules
+    void addTesting(const std::string & molecule, const double * similarities);
+
+    void refit();
+
+    /*
+     * Test molecules from the best, numbered as by ActiveMolecules::rank,
+     * i.e. test molecule `y` (in order of arrival) is X + y.
+     */
+    std::vector<int> rank();
+
+    size_type trainingSize() const
+    {
+        return m_activities.size();
+    }
+
+    size_type testingSize() const
+    {
+        return m_test_norms.size();
+    }
+
+private:
+    static std::vector<double> parse(const molecule_array_type & molecules)
+    {
+        MoleculeInputPlaceholder placeholder;
+
+        placeholder.takeFrom(molecule_array_type(molecules));
+
+        const std::unique_ptr<MoleculeInputPlaceholder::matrix_type> matrix = placeholder.render();
+        std::vector<double> result;
+
+        result.reserve(matrix->rows() * N_COL);
+
+        for (size_type row{0}; row < matrix->rows(); ++row)
+        {
+            result.insert(result.end(), matrix->row_cbegin(row), matrix->row_cend(row));
+        }
+
+        return result;
+    }
+
+    static std::uint8_t code_of(const double similarity)
+    {
+        return codec_type::encode(similarity);
+    }
+
+    static std::uint8_t code_of(const std::uint8_t code)
+    {
+        return code;
+    }
+
+    /*
+     * Agreement of training molecule `lhs` with a molecule of raw activity
+     * `rhs_raw`, `rhs` normalized. With A* = 0 it is exact equality, which
+     * an affine normalization preserves, so raw activities are compared.
+     * This keeps pairs consistent across differently frozen normalizations.
+     */
+    bool agree(const size_type lhs, const double rhs_raw, const double rhs) const
+    {
+        return
+            m_activity_thr_A_star == 0.0 ?
+                fabs(m_train_raw[lhs * N_COL + ACTIVITY_INDEX] - rhs_raw) <= 0.0
+                :
+                fabs(m_activities[lhs] - rhs) <= m_activity_thr_A_star;
+    }
+
+    // agreement of training molecules `lhs` and `rhs`
+    bool agree(const size_type lhs, const size_type rhs) const
+    {
+        return agree(lhs, m_train_raw[rhs * N_COL + ACTIVITY_INDEX], m_activities[rhs]);
+    }
+
+    // `raw` normalized with `statistics`, which were accumulated over its rows in order
+    static std::unique_ptr<MoleculeInputPlaceholder::matrix_type>
+    normalized(const std::vector<double> & raw, const statistics_type & statistics)
+    {
+        const size_type n_rows = raw.size() / N_COL;
+        std::unique_ptr<MoleculeInputPlaceholder::matrix_type> matrix(
+            new MoleculeInputPlaceholder::matrix_type(n_rows, N_COL));
+
+        for (size_type row{0}; row < n_rows; ++row)
+        {
+            matrix->copyRowFrom(row, &raw[row * N_COL], &raw[(row + 1) * N_COL]);
+        }
+
+        statistics.normalize(*matrix, n_rows);
+
+        return matrix;
+    }
+
+    void renormalize();
+    void rebinSimilarities();
+    void rebuildJaccards();
+
+private:
+    const double m_activity_thr_A_star;
+    ThreadPool m_thread_pool;
+
+    // raw molecule rows, N_COL values each
+    std::vector<double> m_train_raw;
+    std::vector<double> m_test_raw;
+
+    statistics_type m_train_statistics;
+    statistics_type m_test_statistics;
+
+    // normalization frozen at the last fit/refit
+    std::vector<double> m_train_mean;
+    std::vector<double> m_train_stddev;
+    std::vector<double> m_test_mean;
+    std::vector<double> m_test_stddev;
+
+    // normalized descriptors, N_FEATURES values each, and their squared norms
+    std::vector<double> m_train_features;
+    std::vector<double> m_train_norms;
+    std::vector<double> m_test_features;
+    std::vector<double> m_test_norms;
+    std::valarray<double> m_activities;
+
+    histogram_type m_similarity_histogram;
+    histogram_type m_jaccard_histogram;
+
+    // with A* != 0, per training molecule, codes against the ones before it
+    std::vector<code_array_type> m_train_similarity_codes;
+
+    // per test molecule, codes against every training molecule
+    std::vector<code_array_type> m_test_similarity_codes;
+    std::vector<code_array_type> m_test_jaccard_codes;
+};
+
+template<typename _MatrixType>
+void
+IncrementalRanker::fit(
+    const molecule_array_type & training_data,
+    const molecule_array_type & testing_data,
+    const std::unique_ptr<_MatrixType> & similarities)
+{
+    const size_type X = training_data.size();
+    const size_type Y = testing_data.size();
+
+    m_train_raw = parse(training_data);
+    m_test_raw = parse(testing_data);
+
+    m_train_statistics = statistics_type();
+    m_test_statistics = statistics_type();
+
+    for (size_type idx{0}; idx < X; ++idx)
+    {
+        m_train_statistics.add(&m_train_raw[idx * N_COL]);
+    }
+
+    for (size_type idx{0}; idx < Y; ++idx)
+    {
+        m_test_statistics.add(&m_test_raw[idx * N_COL]);
+    }
+
+    renormalize();
+
+    m_similarity_histogram = reduce_tiles(m_thread_pool, TriangleTiling(X, X), histogram_type(),
+        [&](const PairTile & tile, histogram_type & partial)
+        {
+            for (size_type iidx{tile.row_begin}; iidx < tile.row_end; ++iidx)
+            {
+                for (size_type jidx{std::max(tile.col_begin, iidx + 1)}; jidx < tile.col_end; ++jidx)
+                {
+                    partial.add(code_of(similarities->at(iidx, jidx)), agree(iidx, jidx));
+                }
+            }
+        }
+    );
+
+    m_train_similarity_codes.clear();
+
+    if (m_activity_thr_A_star != 0.0)
+    {
+        m_train_similarity_codes.resize(X);
+
+        for (size_type jidx{0}; jidx < X; ++jidx)
+        {
+            m_train_similarity_codes[jidx].resize(jidx);
+
+            for (size_type iidx{0}; iidx < jidx; ++iidx)
+            {
+                m_train_similarity_codes[jidx][iidx] = code_of(similarities->at(iidx, jidx));
+            }
+        }
+    }
+
+    m_test_similarity_codes.assign(Y, code_array_type(X));
+
+    for (size_type yidx{0}; yidx < Y; ++yidx)
+    {
+        for (size_type iidx{0}; iidx < X; ++iidx)
+        {
+            m_test_similarity_codes[yidx][iidx] = code_of(similarities->at(iidx, X + yidx));
+        }
+    }
+
+    rebuildJaccards();
+}
+
+void
+IncrementalRanker::addTraining(const std::string & molecule, const double * similarities)
+{
+    const size_type X = trainingSize();
+    const size_type Y = testingSize();
+
+    const std::vector<double> raw = parse(molecule_array_type(1, molecule));
+
+    m_train_statistics.add(raw.data());
+    m_train_raw.insert(m_train_raw.end(), raw.cbegin(), raw.cend());
+
+    std::vector<double> features(N_FEATURES);
+
+    for (size_type col{0}; col < N_FEATURES; ++col)
+    {
+        features[col] = (raw[col] - m_train_mean[col]) / m_train_stddev[col];
+    }
+
+    const double activity = (raw[ACTIVITY_INDEX] - m_train_mean[ACTIVITY_INDEX]) / m_train_stddev[ACTIVITY_INDEX];
+    const double norm = squared_norm(features.data(), N_FEATURES);
+
+    for (size_type iidx{0}; iidx < X; ++iidx)
+    {
+        const bool Delta_A_i_j_LE_A_star = agree(iidx, raw[ACTIVITY_INDEX], activity);
+
+        m_similarity_histogram.add(code_of(similarities[iidx]), Delta_A_i_j_LE_A_star);
+        m_jaccard_histogram.add(
+            code_of(jaccard(features.data(), &m_train_features[iidx * N_FEATURES], N_FEATURES, norm, m_train_norms[iidx])),
+            Delta_A_i_j_LE_A_star);
+    }
+
+    for (size_type yidx{0}; yidx < Y; ++yidx)
+    {
+        m_test_similarity_codes[yidx].push_back(code_of(similarities[X + yidx]));
+        m_test_jaccard_codes[yidx].push_back(
+            code_of(jaccard(features.data(), &m_test_features[yidx * N_FEATURES], N_FEATURES, norm, m_test_norms[yidx])));
+    }
+
+    if (m_activity_thr_A_star != 0.0)
+    {
+        code_array_type similarity_codes(X);
+
+        std::transform(similarities, similarities + X, similarity_codes.begin(),
+            [](const double similarity)
+            {
+                return code_of(similarity);
+            }
+        );
+
+        m_train_similarity_codes.push_back(std::move(similarity_codes));
+    }
+
+    m_train_features.insert(m_train_features.end(), features.cbegin(), features.cend());
+    m_train_norms.push_back(norm);
+
+    std::valarray<double> activities(X + 1);
+
+    std::copy(std::begin(m_activities), std::end(m_activities), std::begin(activities));
+    activities[X] = activity;
+    m_activities.swap(activities);
+}
+
+void
+IncrementalRanker::addTesting(const std::string & molecule, const double * similarities)
+{
+    const size_type X = trainingSize();
+
+    const std::vector<double> raw = parse(molecule_array_type(1, molecule));
+
+    m_test_statistics.add(raw.data());
+    m_test_raw.insert(m_test_raw.end(), raw.cbegin(), raw.cend());
+
+    std::vector<double> features(N_FEATURES);
+
+    for (size_type col{0}; col < N_FEATURES; ++col)
+    {
+        features[col] = (raw[col] - m_test_mean[col]) / m_test_stddev[col];
+    }
+
+    const double norm = squared_norm(features.data(), N_FEATURES);
+
+    code_array_type similarity_codes(X);
+    code_array_type jaccard_codes(X);
+
+    for (size_type iidx{0}; iidx < X; ++iidx)
+    {
+        similarity_codes[iidx] = code_of(similarities[iidx]);
+        jaccard_codes[iidx] =
+            code_of(jaccard(features.data(), &m_train_features[iidx * N_FEATURES], N_FEATURES, norm, m_train_norms[iidx]));
+    }
+
+    m_test_features.insert(m_test_features.end(), features.cbegin(), features.cend());
+    m_test_norms.push_back(norm);
+    m_test_similarity_codes.push_back(std::move(similarity_codes));
+    m_test_jaccard_codes.push_back(std::move(jaccard_codes));
+}
+
+void
+IncrementalRanker::refit()
+{
+    renormalize();
+
+    // agreement with A* = 0 does not depend on the normalization
+    if (m_activity_thr_A_star != 0.0)
+    {
+        rebinSimilarities();
+    }
+
+    rebuildJaccards();
+}
+
+void
+IncrementalRanker::rebinSimilarities()
+{
+    const size_type X = trainingSize();
+
+    m_similarity_histogram = reduce_tiles(m_thread_pool, TriangleTiling(X, X), histogram_type(),
+        [&](const PairTile & tile, histogram_type & partial)
+        {
+            for (size_type iidx{tile.row_begin}; iidx < tile.row_end; ++iidx)
+            {
+                for (size_type jidx{std::max(tile.col_begin, iidx + 1)}; jidx < tile.col_end; ++jidx)
+                {
+                    partial.add(m_train_similarity_codes[jidx][iidx], agree(iidx, jidx));
+                }
+            }
+        }
+    );
+}
+
+/*
+ * Normalizes the stored raw rows with the running statistics, which saw
+ * them in the order ActiveMolecules::rank parses them, so the result is
+ * that of render_normalized() to the bit. Freezes the statistics for
+ * molecules added later. A test set too small to have a spread borrows the
+ * training normalization.
+ */
+void
+IncrementalRanker::renormalize()
+{
+    const size_type X = m_train_raw.size() / N_COL;
+    const size_type Y = m_test_raw.size() / N_COL;
+
+    m_train_statistics.snapshot(m_train_mean.data(), m_train_stddev.data());
+
+    if (Y >= 2)
+    {
+        m_test_statistics.snapshot(m_test_mean.data(), m_test_stddev.data());
+    }
+    else
+    {
+        m_test_mean = m_train_mean;
+        m_test_stddev = m_train_stddev;
+    }
+
+    const std::unique_ptr<MoleculeInputPlaceholder::matrix_type> train_data = normalized(m_train_raw, m_train_statistics);
+
+    m_train_features.resize(X * N_FEATURES);
+    m_train_norms.resize(X);
+    m_activities.resize(X);
+
+    for (size_type row{0}; row < X; ++row)
+    {
+        std::copy(train_data->row_cbegin(row), train_data->row_cbegin(row) + N_FEATURES, &m_train_features[row * N_FEATURES]);
+        m_train_norms[row] = squared_norm(&m_train_features[row * N_FEATURES], N_FEATURES);
+        m_activities[row] = train_data->at(row, ACTIVITY_INDEX);
+    }
+
+    m_test_features.resize(Y * N_FEATURES);
+    m_test_norms.resize(Y);
+
+    if (Y >= 2)
+    {
+        const std::unique_ptr<MoleculeInputPlaceholder::matrix_type> test_data = normalized(m_test_raw, m_test_statistics);
+
+        for (size_type row{0}; row < Y; ++row)
+        {
+            std::copy(test_data->row_cbegin(row), test_data->row_cbegin(row) + N_FEATURES, &m_test_features[row * N_FEATURES]);
+        }
+    }
+    else
+    {
+        for (size_type row{0}; row < Y; ++row)
+        {
+            for (size_type col{0}; col < N_FEATURES; ++col)
+            {
+                m_test_features[row * N_FEATURES + col] = (m_test_raw[row * N_COL + col] - m_test_mean[col]) / m_test_stddev[col];
+            }
+        }
+    }
+
+    for (size_type row{0}; row < Y; ++row)
+    {
+        m_test_norms[row] = squared_norm(&m_test_features[row * N_FEATURES], N_FEATURES);
+    }
+}
+
+void
+IncrementalRanker::rebuildJaccards()
+{
+    const size_type X = trainingSize();
+    const size_type Y = testingSize();
+
+    const MatrixView<double> train_features(m_train_features.data(), X, N_FEATURES);
+    const MatrixView<double> test_features(m_test_features.data(), Y, N_FEATURES);
+
+    const std::unique_ptr<SymmetricMatrix2d<std::uint8_t>> jaccards =
+        build_jaccard_matrix<std::uint8_t>(train_features, test_features, N_FEATURES, m_thread_pool);
+
+    m_jaccard_histogram = reduce_tiles(m_thread_pool, TriangleTiling(X, X), histogram_type(),
+        [&](const PairTile & tile, histogram_type & partial)
+        {
+            for (size_type iidx{tile.row_begin}; iidx < tile.row_end; ++iidx)
+            {
+                const std::uint8_t * row = jaccards->upper_row_cbegin(iidx);
+
+                for (size_type jidx{std::max(tile.col_begin, iidx + 1)}; jidx < tile.col_end; ++jidx)
+                {
+                    partial.add(row[jidx], agree(iidx, jidx));
+                }
+            }
+        }
+    );
+
+    m_test_jaccard_codes.assign(Y, code_array_type(X));
+
+    for (size_type yidx{0}; yidx < Y; ++yidx)
+    {
+        for (size_type iidx{0}; iidx < X; ++iidx)
+        {
+            m_test_jaccard_codes[yidx][iidx] = jaccards->at(iidx, X + yidx);
+        }
+    }
+}
+
+std::vector<int>
+IncrementalRanker::rank()
+{
+    const size_type X = trainingSize();
+    const size_type Y = testingSize();
+
+    const curve_type similarities_curve(m_similarity_histogram);
+    const curve_type jaccards_curve(m_jaccard_histogram);
+
+    typedef std::tuple<std::size_t, double> scored_tuple_type;
+    std::vector<scored_tuple_type> scored_tuples;
+    scored_tuples.reserve(Y);
+
+    for (size_type yidx{0}; yidx < Y; ++yidx)
+    {
+        scored_tuples.push_back(std::make_tuple(X + yidx, 0.0));
+    }
+
+    m_thread_pool.parallel_for(0, Y,
+        [&](const size_type yidx)
+        {
+            std::get<1>(scored_tuples[yidx]) =
+                APSsim(similarities_curve, m_test_similarity_codes[yidx].data(), m_activities);
+            std::get<1>(scored_tuples[yidx]) +=
+                APSsim(jaccards_curve, m_test_jaccard_codes[yidx].data(), m_activities);
+        },
+        16
+    );
+
+    std::sort(scored_tuples.begin(), scored_tuples.end(),
+        [](const scored_tuple_type & lhs, const scored_tuple_type & rhs)
+        {
+            return std::get<1>(lhs) > std::get<1>(rhs);
+        }
+    );
+
+    std::vector<int> result;
+    result.reserve(Y);
+    std::transform(scored_tuples.cbegin(), scored_tuples.cend(),
+        std::back_inserter(result),
+        [](const scored_tuple_type & item)
+        {
+            return std::get<0>(item);
+        }
+    );
+
+    return result;
+}
+
+#endif /* INCREMENTAL_RANKER_HPP_ */
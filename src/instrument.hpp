@@ -0,0 +1,269 @@
+/*******************************************************************************
+ * Copyright (c) 2015 Wojciech Migda
+ * All rights reserved
+ * Distributed under the terms of the GNU LGPL v3
+ *******************************************************************************
+ *
+ * Filename: instrument.hpp
+ *
+ * Description:
+ *      Opt-in phase timers, hot path counters and matrix memory accounting
+ *
+ * Authors:
+ *          Wojciech Migda (wm)
+ *
+ *******************************************************************************
+ * History:
+ * --------
+ * Date         Who  Ticket     Description
+ * ----------   ---  ---------  ------------------------------------------------
+ * 2026-10-17   wm              Initial version
+ *
+ ******************************************************************************/
+
+#ifndef INSTRUMENT_HPP_
+#define INSTRUMENT_HPP_
+
+/*
+ * Everything is reached through the AM_* macros below, which expand to
+ * nothing unless the build defines AM_INSTRUMENT (cmake -DAM_INSTRUMENT=ON).
+ *
+ *   AM_PHASE(name)             times the enclosing scope as phase `name`
+ *   AM_PHASE_SEQUENCE()        starts timing consecutive phases of a function,
+ *   AM_NEXT_PHASE(name)        each one ending where the next one starts
+ *   AM_END_PHASES()            or at the end of the scope
+ *   AM_COUNT(counter, n)       adds n to one of the Counter values
+ *   AM_MATRIX_ALLOCATED(bytes) / AM_MATRIX_RELEASED(bytes)
+ *                              track live and peak matrix storage
+ *   AM_REPORT()                writes the JSON report to the file named by
+ *                              the AM_INSTRUMENT_REPORT environment variable,
+ *                              or to stderr
+ */
+
+#ifdef AM_INSTRUMENT
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct Instrumentation
+{
+    typedef std::uint64_t count_type;
+
+    enum Counter
+    {
+        // CPsim() and its BucketCache, outside the curve based ranking
+        CPSIM_CALLS,
+        CACHE_HITS,
+        CACHE_MISSES,
+        // CPsimCurve, which the rankers score with
+        CURVE_BUILDS,
+        CURVE_LOOKUPS,
+        PAIRS_VISITED,
+        BYTES_PARSED,
+        N_COUNTERS
+    };
+
+    static Instrumentation & instance()
+    {
+        static Instrumentation the_instance;
+
+        return the_instance;
+    }
+
+    void count(const Counter counter, const count_type n)
+    {
+        m_counters[counter].fetch_add(n, std::memory_order_relaxed);
+    }
+
+    void allocated(const count_type bytes)
+    {
+        const count_type live = m_live_bytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+        count_type peak = m_peak_bytes.load(std::memory_order_relaxed);
+
+        while (live > peak && !m_peak_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    void released(const count_type bytes)
+    {
+        m_live_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+    }
+
+    // phases are reported in order of their first appearance
+    void phase(const char * name, const double seconds)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        for (auto & item : m_phases)
+        {
+            if (item.name == name)
+            {
+                item.seconds += seconds;
+                ++item.count;
+                return;
+            }
+        }
+
+        m_phases.push_back(Phase{name, seconds, 1});
+    }
+
+    void report() const
+    {
+        const char * path = std::getenv("AM_INSTRUMENT_REPORT");
+        std::FILE * stream = path != nullptr ? std::fopen(path, "w") : nullptr;
+
+        write(stream != nullptr ? stream : stderr);
+
+        if (stream != nullptr)
+        {
+            std::fclose(stream);
+        }
+    }
+
+    void write(std::FILE * stream) const
+    {
+        static const char * const COUNTER_NAMES[N_COUNTERS] =
+        {
+            "cpsim_calls", "cache_hits", "cache_misses", "curve_builds", "curve_lookups",
+            "pairs_visited", "bytes_parsed"
+        };
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        std::fprintf(stream, "{\n  \"phases\": [");
+
+        for (std::size_t idx{0}; idx < m_phases.size(); ++idx)
+        {
+            std::fprintf(stream, "%s\n    {\"name\": \"%s\", \"seconds\": %.6f, \"count\": %llu}",
+                idx ? "," : "", m_phases[idx].name.c_str(), m_phases[idx].seconds, (unsigned long long)m_phases[idx].count);
+        }
+
+        std::fprintf(stream, "\n  ],\n  \"counters\": {");
+
+        for (std::size_t idx{0}; idx < N_COUNTERS; ++idx)
+        {
+            std::fprintf(stream, "%s\n    \"%s\": %llu",
+                idx ? "," : "", COUNTER_NAMES[idx], (unsigned long long)m_counters[idx].load());
+        }
+
+        std::fprintf(stream, "\n  },\n  \"memory\": {\n    \"peak_matrix_bytes\": %llu\n  }\n}\n",
+            (unsigned long long)m_peak_bytes.load());
+    }
+
+private:
+    struct Phase
+    {
+        std::string name;
+        double seconds;
+        count_type count;
+    };
+
+    Instrumentation()
+    :
+        m_live_bytes(0),
+        m_peak_bytes(0)
+    {
+        for (auto & counter : m_counters)
+        {
+            counter = 0;
+        }
+    }
+
+private:
+    std::atomic<count_type> m_counters[N_COUNTERS];
+    std::atomic<count_type> m_live_bytes;
+    std::atomic<count_type> m_peak_bytes;
+    mutable std::mutex m_mutex;
+    std::vector<Phase> m_phases;
+};
+
+struct ScopedPhase
+{
+    explicit ScopedPhase(const char * name)
+    :
+        m_name(name),
+        m_start(std::chrono::steady_clock::now())
+    {
+    }
+
+    ~ScopedPhase()
+    {
+        Instrumentation::instance().phase(m_name,
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count());
+    }
+
+private:
+    const char * m_name;
+    const std::chrono::steady_clock::time_point m_start;
+};
+
+struct PhaseSequence
+{
+    PhaseSequence()
+    :
+        m_name(nullptr)
+    {
+    }
+
+    ~PhaseSequence()
+    {
+        stop();
+    }
+
+    void next(const char * name)
+    {
+        stop();
+
+        m_name = name;
+        m_start = std::chrono::steady_clock::now();
+    }
+
+    void stop()
+    {
+        if (m_name != nullptr)
+        {
+            Instrumentation::instance().phase(m_name,
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count());
+            m_name = nullptr;
+        }
+    }
+
+private:
+    const char * m_name;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+#define AM_CONCAT_IMPL(a, b) a ## b
+#define AM_CONCAT(a, b) AM_CONCAT_IMPL(a, b)
+
+#define AM_PHASE(name) const ScopedPhase AM_CONCAT(am_phase_, __LINE__)(name)
+#define AM_PHASE_SEQUENCE() PhaseSequence am_phase_sequence
+#define AM_NEXT_PHASE(name) am_phase_sequence.next(name)
+#define AM_END_PHASES() am_phase_sequence.stop()
+#define AM_COUNT(counter, n) Instrumentation::instance().count(Instrumentation::counter, (n))
+#define AM_MATRIX_ALLOCATED(bytes) Instrumentation::instance().allocated(bytes)
+#define AM_MATRIX_RELEASED(bytes) Instrumentation::instance().released(bytes)
+#define AM_REPORT() Instrumentation::instance().report()
+
+#else
+
+#define AM_PHASE(name) do {} while (0)
+#define AM_PHASE_SEQUENCE() do {} while (0)
+#define AM_NEXT_PHASE(name) do {} while (0)
+#define AM_END_PHASES() do {} while (0)
+#define AM_COUNT(counter, n) do {} while (0)
+#define AM_MATRIX_ALLOCATED(bytes) do {} while (0)
+#define AM_MATRIX_RELEASED(bytes) do {} while (0)
+#define AM_REPORT() do {} while (0)
+
+#endif /* AM_INSTRUMENT */
+
+#endif /* INSTRUMENT_HPP_ */
@@ -0,0 +1,400 @@
+/*******************************************************************************
+ * Copyright (c) 2015 Wojciech Migda
+ * All rights reserved
+ * Distributed under the terms of the GNU LGPL v3
+ *******************************************************************************
+ *
+ * Filename: jaccard_matrix.hpp
+ *
+ * Description:
+ *      Blocked builder of the Tanimoto/Jaccard similarity matrix
+ *
+ * Authors:
+ *          Wojciech Migda (wm)
+ *
+ *******************************************************************************
+ * History:
+ * --------
+ * Date         Who  Ticket     Description
+ * ----------   ---  ---------  ------------------------------------------------
+ * 2026-10-17   wm              Initial version
+ *
+ ******************************************************************************/
+
+#ifndef JACCARD_MATRIX_HPP_
+#define JACCARD_MATRIX_HPP_
+
+#include "symmetric_matrix.hpp"
+#include "quantize.hpp"
+#include "parallel.hpp"
+#include "pair_scheduler.hpp"
+#include "simd.hpp"
+#include "instrument.hpp"
+
+#include <cstddef>
+#include <cmath>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+/*
+ * Every inner product is summed feature by feature with separate multiply
+ * and add roundings at all SIMD levels, so the matrix is bit-identical
+ * whichever kernel runs; keep the compiler from contracting or
+ * reassociating them.
+ */
+#pragma GCC push_options
+#pragma GCC optimize("-fno-fast-math", "-ffp-contract=off")
+
+/*
+ * Computes a ROWS x n block of inner products
+ *
+ *     c[r * ldc + j] = sum_f a[r * n_features + f] * bt[f * ldb + j]
+ *
+ * where `a` holds ROWS consecutive feature rows and `bt` the transposed
+ * (feature major) rows of the other operand. `n` must be a multiple of
+ * COLS_ALIGNMENT.
+ */
+struct GramKernel
+{
+    typedef std::size_t size_type;
+    typedef void (*function_type)(
+        const double * a, size_type n_features,
+        const double * bt, size_type ldb, size_type n,
+        double * c, size_type ldc);
+
+    static constexpr size_type ROWS{4};
+    static constexpr size_type COLS_ALIGNMENT{16};
+
+    static inline
+    void multiply(
+        const double * a, size_type n_features,
+        const double * bt, size_type ldb, size_type n,
+        double * c, size_type ldc)
+    {
+        static const function_type fn = select();
+
+        fn(a, n_features, bt, ldb, n, c, ldc);
+    }
+
+    static
+    function_type select()
+    {
+        switch (simd_level())
+        {
+            case SimdLevel::AVX512:
+                return &multiply_avx512;
+            case SimdLevel::AVX2:
+                return &multiply_avx2;
+            default:
+                return &multiply_sse2;
+        }
+    }
+
+    static
+    void multiply_sse2(
+        const double * a, size_type n_features,
+        const double * bt, size_type ldb, size_type n,
+        double * c, size_type ldc)
+    {
+        for (size_type jidx{0}; jidx < n; jidx += 4)
+        {
+            __m128d acc[ROWS][2];
+
+            for (size_type ridx{0}; ridx < ROWS; ++ridx)
+            {
+                acc[ridx][0] = acc[ridx][1] = _mm_setzero_pd();
+            }
+
+            for (size_type fidx{0}; fidx < n_features; ++fidx)
+            {
+                const __m128d b0 = _mm_loadu_pd(bt + fidx * ldb + jidx);
+                const __m128d b1 = _mm_loadu_pd(bt + fidx * ldb + jidx + 2);
+
+                for (size_type ridx{0}; ridx < ROWS; ++ridx)
+                {
+                    const __m128d a_r = _mm_set1_pd(a[ridx * n_features + fidx]);
+
+                    acc[ridx][0] = _mm_add_pd(acc[ridx][0], _mm_mul_pd(a_r, b0));
+                    acc[ridx][1] = _mm_add_pd(acc[ridx][1], _mm_mul_pd(a_r, b1));
+                }
+            }
+
+            for (size_type ridx{0}; ridx < ROWS; ++ridx)
+            {
+                _mm_storeu_pd(c + ridx * ldc + jidx, acc[ridx][0]);
+                _mm_storeu_pd(c + ridx * ldc + jidx + 2, acc[ridx][1]);
+            }
+        }
+    }
+
+    __attribute__((target("avx2")))
+    static
+    void multiply_avx2(
+        const double * a, size_type n_features,
+        const double * bt, size_type ldb, size_type n,
+        double * c, size_type ldc)
+    {
+        for (size_type jidx{0}; jidx < n; jidx += 8)
+        {
+            __m256d acc[ROWS][2];
+
+            for (size_type ridx{0}; ridx < ROWS; ++ridx)
+            {
+                acc[ridx][0] = acc[ridx][1] = _mm256_setzero_pd();
+            }
+
+            for (size_type fidx{0}; fidx < n_features; ++fidx)
+            {
+                const __m256d b0 = _mm256_loadu_pd(bt + fidx * ldb + jidx);
+                const __m256d b1 = _mm256_loadu_pd(bt + fidx * ldb + jidx + 4);
+
+                for (size_type ridx{0}; ridx < ROWS; ++ridx)
+                {
+                    const __m256d a_r = _mm256_set1_pd(a[ridx * n_features + fidx]);
+
+                    acc[ridx][0] = _mm256_add_pd(acc[ridx][0], _mm256_mul_pd(a_r, b0));
+                    acc[ridx][1] = _mm256_add_pd(acc[ridx][1], _mm256_mul_pd(a_r, b1));
+                }
+            }
+
+            for (size_type ridx{0}; ridx < ROWS; ++ridx)
+            {
+                _mm256_storeu_pd(c + ridx * ldc + jidx, acc[ridx][0]);
+                _mm256_storeu_pd(c + ridx * ldc + jidx + 4, acc[ridx][1]);
+            }
+        }
+    }
+
+    __attribute__((target("avx512f")))
+    static
+    void multiply_avx512(
+        const double * a, size_type n_features,
+        const double * bt, size_type ldb, size_type n,
+        double * c, size_type ldc)
+    {
+        for (size_type jidx{0}; jidx < n; jidx += 16)
+        {
+            __m512d acc[ROWS][2];
+
+            for (size_type ridx{0}; ridx < ROWS; ++ridx)
+            {
+                acc[ridx][0] = acc[ridx][1] = _mm512_setzero_pd();
+            }
+
+            for (size_type fidx{0}; fidx < n_features; ++fidx)
+            {
+                const __m512d b0 = _mm512_loadu_pd(bt + fidx * ldb + jidx);
+                const __m512d b1 = _mm512_loadu_pd(bt + fidx * ldb + jidx + 8);
+
+                for (size_type ridx{0}; ridx < ROWS; ++ridx)
+                {
+                    const __m512d a_r = _mm512_set1_pd(a[ridx * n_features + fidx]);
+
+                    acc[ridx][0] = _mm512_add_pd(acc[ridx][0], _mm512_mul_pd(a_r, b0));
+                    acc[ridx][1] = _mm512_add_pd(acc[ridx][1], _mm512_mul_pd(a_r, b1));
+                }
+            }
+
+            for (size_type ridx{0}; ridx < ROWS; ++ridx)
+            {
+                _mm512_storeu_pd(c + ridx * ldc + jidx, acc[ridx][0]);
+                _mm512_storeu_pd(c + ridx * ldc + jidx + 8, acc[ridx][1]);
+            }
+        }
+    }
+};
+
+inline
+double squared_norm(const double * features, const std::size_t n_features)
+{
+    double result{0.0};
+
+    for (std::size_t fidx{0}; fidx < n_features; ++fidx)
+    {
+        result += features[fidx] * features[fidx];
+    }
+
+    return result;
+}
+
+/*
+ * Jaccard similarity of a single pair given the squared norms, with the
+ * same arithmetic as build_jaccard_matrix.
+ */
+inline
+double jaccard(
+    const double * lhs,
+    const double * rhs,
+    const std::size_t n_features,
+    const double lhs_norm,
+    const double rhs_norm)
+{
+    double inter{0.0};
+
+    for (std::size_t fidx{0}; fidx < n_features; ++fidx)
+    {
+        inter += lhs[fidx] * rhs[fidx];
+    }
+
+    return std::fabs(inter / (lhs_norm + rhs_norm - inter));
+}
+
+/*
+ * Operands of the blocked Jaccard builders: the training rows zero padded
+ * to whole GramKernel row blocks, all molecules (training, then test) feature
+ * major and zero padded to whole kernel columns, and the self inner
+ * product of every molecule, computed once up front.
+ */
+struct JaccardOperands
+{
+    typedef std::size_t size_type;
+
+    template<typename _MoleculeMatrixType>
+    JaccardOperands(
+        const _MoleculeMatrixType & train_data,
+        const _MoleculeMatrixType & test_data,
+        const size_type n_features)
+    :
+        m_n_features(n_features),
+        m_n_padded_cols(padded_cols(train_data.rows() + test_data.rows())),
+        m_features((train_data.rows() + GramKernel::ROWS - 1) / GramKernel::ROWS * GramKernel::ROWS * n_features, 0.0),
+        m_features_t(n_features * m_n_padded_cols, 0.0),
+        m_norms(train_data.rows() + test_data.rows(), 0.0)
+    {
+        const size_type X = train_data.rows();
+        const size_type N = m_norms.size();
+
+        for (size_type midx{0}; midx < N; ++midx)
+        {
+            const double * row = midx < X ? train_data.row_cbegin(midx) : test_data.row_cbegin(midx - X);
+
+            for (size_type fidx{0}; fidx < n_features; ++fidx)
+            {
+                if (midx < X)
+                {
+                    m_features[midx * n_features + fidx] = row[fidx];
+                }
+                m_features_t[fidx * m_n_padded_cols + midx] = row[fidx];
+            }
+
+            m_norms[midx] = squared_norm(row, n_features);
+        }
+    }
+
+    // `n` rounded up to whole kernel columns
+    static size_type padded_cols(const size_type n)
+    {
+        return (n + GramKernel::COLS_ALIGNMENT - 1) / GramKernel::COLS_ALIGNMENT * GramKernel::COLS_ALIGNMENT;
+    }
+
+    /*
+     * Inner products of the ROWS training rows from `row_begin` with the
+     * molecules [col_begin, col_end), into `products` with stride `ldc`.
+     * `ldc` must leave room for padded_cols(col_end - col_begin) columns.
+     */
+    void multiply(
+        const size_type row_begin,
+        const size_type col_begin,
+        const size_type col_end,
+        double * products,
+        const size_type ldc) const
+    {
+        GramKernel::multiply(
+            &m_features[row_begin * m_n_features], m_n_features,
+            &m_features_t[col_begin], m_n_padded_cols, padded_cols(col_end - col_begin),
+            products, ldc);
+    }
+
+    double similarity(const size_type ridx, const size_type cidx, const double inter) const
+    {
+        return std::fabs(inter / (m_norms[ridx] + m_norms[cidx] - inter));
+    }
+
+private:
+    const size_type m_n_features;
+    const size_type m_n_padded_cols;
+    std::vector<double> m_features;
+    std::vector<double> m_features_t;
+    std::vector<double> m_norms;
+};
+
+/*
+ * Jaccard (Tanimoto) similarities |<x, y>| / |<x, x> + <y, y> - <x, y>|
+ * over the first `n_features` columns of the molecule matrices, stored in
+ * the upper trapezoid used by the ranking: the rows are the training
+ * molecules, the columns all training molecules followed by the test ones.
+ * This covers the train x train pairs the CP curve is built from as well
+ * as the train x test pairs scored by APSsim.
+ *
+ * Inner products come from GramKernel (see JaccardOperands), applied to
+ * blocks of GramKernel::ROWS training rows against COLS_BLOCK wide panels
+ * of the transposed feature matrix. The trapezoid is cut into TILE_ROWS x
+ * COLS_BLOCK tiles which the pool's workers take with work stealing, see
+ * pair_scheduler.hpp.
+ */
+template<typename _SimilarityType, typename _MoleculeMatrixType>
+std::unique_ptr<SymmetricMatrix2d<_SimilarityType>>
+build_jaccard_matrix(
+    const _MoleculeMatrixType & train_data,
+    const _MoleculeMatrixType & test_data,
+    const std::size_t n_features,
+    ThreadPool & thread_pool)
+{
+    typedef std::size_t size_type;
+    typedef _SimilarityType similarity_type;
+
+    constexpr size_type ROWS{GramKernel::ROWS};
+    constexpr size_type COLS_BLOCK{256};
+    constexpr size_type TILE_ROWS{8 * ROWS};
+
+    const size_type X = train_data.rows();
+    const size_type N = X + test_data.rows();
+
+    AM_COUNT(PAIRS_VISITED, X * (X + 1) / 2 + X * (N - X));
+
+    const JaccardOperands operands(train_data, test_data, n_features);
+
+    std::unique_ptr<SymmetricMatrix2d<similarity_type>> jaccards(new SymmetricMatrix2d<similarity_type>(X, N));
+
+    for_each_tile(thread_pool, TriangleTiling(X, N, 0, TILE_ROWS, COLS_BLOCK),
+        [&](const PairTile & tile)
+        {
+            double products[ROWS * COLS_BLOCK];
+
+            for (size_type row_begin{tile.row_begin}; row_begin < tile.row_end; row_begin += ROWS)
+            {
+                const size_type row_end = std::min(row_begin + ROWS, tile.row_end);
+
+                // only columns from the diagonal on are stored
+                const size_type col_begin =
+                    std::max(tile.col_begin, row_begin / GramKernel::COLS_ALIGNMENT * GramKernel::COLS_ALIGNMENT);
+
+                if (col_begin >= tile.col_end)
+                {
+                    continue;
+                }
+
+                operands.multiply(row_begin, col_begin, tile.col_end, products, COLS_BLOCK);
+
+                for (size_type ridx{row_begin}; ridx < row_end; ++ridx)
+                {
+                    const double * row_products = products + (ridx - row_begin) * COLS_BLOCK - col_begin;
+                    similarity_type * out = jaccards->row_begin(ridx) - ridx;
+
+                    for (size_type cidx{std::max(col_begin, ridx)}; cidx < tile.col_end; ++cidx)
+                    {
+                        out[cidx] = SimilarityCodec<similarity_type>::encode(
+                            operands.similarity(ridx, cidx, row_products[cidx]));
+                    }
+                }
+            }
+        }
+    );
+
+    return jaccards;
+}
+
+#pragma GCC pop_options
+
+#endif /* JACCARD_MATRIX_HPP_ */
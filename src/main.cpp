@@ -26,61 +26,439 @@
 #include <string>
 #include <cstddef>
 #include <iterator>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <cstdint>
 
 #include "ActiveMolecules.hpp"
+#include "text_input.hpp"
+#include "binary_matrix.hpp"
+#include "tiled_matrix.hpp"
+#include "out_of_core.hpp"
+#include "sharded_ranker.hpp"
+#include "instrument.hpp"
 
-int main()
+namespace
 {
-    ActiveMolecules active_molecules;
 
-    int X;
-    int Y;
+/*
+ * rank(), or with `n_shards` set the same scores from that many forked
+ * workers (ShardedScorer). Returns false, having said why, when a shard
+ * could not be scored.
+ */
+template<typename _MatrixType>
+bool
+rank_matrix(
+    const ActiveMolecules & active_molecules,
+    const std::unique_ptr<_MatrixType> & similarities,
+    const std::size_t n_shards,
+    std::vector<std::string> & training_data,
+    std::vector<std::string> & testing_data,
+    std::vector<int> & result)
+{
+    if (n_shards == 0)
+    {
+        result = active_molecules.rank(training_data, testing_data, similarities);
 
-    std::cin >> X >> Y;
+        return true;
+    }
 
-    std::vector<double> similarities;
-    similarities.reserve(4000);
+    ShardedScorer<_MatrixType> scorer(similarities, active_molecules.options().activity_thr_A_star, n_shards);
 
-    for (int i = 0; i < X + Y; i++)
-    {
-        similarities.clear();
-        double d;
+    result = active_molecules.rank_scored(training_data, testing_data, scorer);
 
-        auto sim_iterator = std::back_inserter(similarities);
+    if (!scorer.good())
+    {
+        std::cerr << "Sharded ranking failed" << std::endl;
+        return false;
+    }
 
-        for (int j = 0; j < X + Y; j++)
-        {
-            std::cin >> d;
-            *sim_iterator++ = d;
-        }
+    return true;
+}
 
-        active_molecules.similarity(i, similarities);
+template<typename _Type>
+bool
+rank_mapped(
+    const ActiveMolecules & active_molecules,
+    const MappedBinaryMatrix & mapped,
+    const std::size_t n_shards,
+    std::vector<std::string> & training_data,
+    std::vector<std::string> & testing_data,
+    std::vector<int> & result)
+{
+    if (mapped.header().layout == BinaryMatrixHeader::PACKED_UPPER)
+    {
+        return rank_matrix(active_molecules, mapped.packed<_Type>(), n_shards, training_data, testing_data, result);
     }
+    else
+    {
+        return rank_matrix(active_molecules, mapped.dense<_Type>(), n_shards, training_data, testing_data, result);
+    }
+}
 
-    std::vector<std::string> training_data;
+void
+read_molecules(
+    BlockReader & reader,
+    const int X,
+    const int Y,
+    std::vector<std::string> & training_data,
+    std::vector<std::string> & testing_data)
+{
     auto train_iterator = std::back_inserter(training_data);
     std::string s;
 
     for (int i = 0; i < X; i++)
     {
-        std::cin >> s;
+        reader.next_token(s);
         *train_iterator++ = s;
     }
 
-    std::vector<std::string> testing_data;
     auto test_iterator = std::back_inserter(testing_data);
 
     for (int i = 0; i < Y; i++)
     {
-        std::cin >> s;
+        reader.next_token(s);
         *test_iterator++ = s;
     }
+}
+
+/*
+ * Streams the similarity rows into tiles under `directory` and ranks off
+ * them. Up to a quarter of `budget` bytes goes to the parse batch, though
+ * never less than one row, and the tiles are sized to the rest. Returns
+ * false, having said why, on truncated input or tile I/O errors.
+ */
+template<typename _Type>
+bool
+rank_out_of_core(
+    BlockReader & reader,
+    const int X,
+    const int Y,
+    const char * directory,
+    const std::size_t budget,
+    ThreadPool & thread_pool,
+    const ActiveMolecules & active_molecules,
+    std::vector<std::string> & training_data,
+    std::vector<std::string> & testing_data,
+    std::vector<int> & result)
+{
+    const std::size_t batch_values =
+        similarity_batch_values(X + Y, std::min(SIMILARITY_BATCH_VALUES, budget / 4 / sizeof (double)));
+    const std::size_t batch_bytes = batch_values * sizeof (double);
+    const std::size_t tile_size =
+        tile_size_for_budget(budget > batch_bytes ? budget - batch_bytes : 0, X + Y, sizeof (_Type));
+
+    TiledMatrixFile<_Type> similarities(directory, X, X + Y, tile_size);
+    TiledMatrixWriter<_Type> writer(similarities);
+
+    const bool complete = read_similarity_rows(reader, X + Y, thread_pool,
+        [&writer](const std::size_t i, const double * cbegin, const double * cend)
+        {
+            writer.writeRow(i, cbegin, cend);
+        },
+        batch_values
+    );
+
+    if (!complete)
+    {
+        std::cerr << "Truncated similarity matrix in input" << std::endl;
+        return false;
+    }
+
+    if (!writer.close())
+    {
+        std::cerr << "Tile I/O failed under " << directory << std::endl;
+        return false;
+    }
+
+    read_molecules(reader, X, Y, training_data, testing_data);
+
+    OutOfCoreScorer<_Type> scorer(similarities, active_molecules.options().activity_thr_A_star);
+
+    result = active_molecules.rank_scored(training_data, testing_data, scorer);
+
+    if (!scorer.good())
+    {
+        std::cerr << "Tile I/O failed under " << directory << std::endl;
+        return false;
+    }
 
-    auto result = active_molecules.rank(training_data, testing_data);
+    return true;
+}
+
+/*
+ * Parses the similarity rows into POSIX shared memory and ranks with
+ * `n_shards` worker processes reading them there. Returns false, having
+ * said why, on truncated input, when the memory cannot be had or when a
+ * shard could not be scored.
+ */
+template<typename _Type>
+bool
+rank_sharded(
+    BlockReader & reader,
+    const int X,
+    const int Y,
+    const std::size_t n_shards,
+    ThreadPool & thread_pool,
+    const ActiveMolecules & active_molecules,
+    std::vector<std::string> & training_data,
+    std::vector<std::string> & testing_data,
+    std::vector<int> & result)
+{
+    SharedSimilarityMatrix<_Type> shared(X, X + Y);
+
+    if (!shared.good())
+    {
+        std::cerr << "Sharded ranking failed" << std::endl;
+        return false;
+    }
+
+    const bool complete = read_similarity_rows(reader, X + Y, thread_pool,
+        [&shared](const std::size_t i, const double * cbegin, const double * cend)
+        {
+            shared.writeRow(i, cbegin, cend);
+        }
+    );
+
+    if (!complete)
+    {
+        std::cerr << "Truncated similarity matrix in input" << std::endl;
+        return false;
+    }
+
+    read_molecules(reader, X, Y, training_data, testing_data);
+
+    const std::unique_ptr<SymmetricMatrixView<_Type>> similarities = shared.view();
+
+    return rank_matrix(active_molecules, similarities, n_shards, training_data, testing_data, result);
+}
+
+}
+
+int main(int argc, char ** argv)
+{
+    RankOptions options;
+    const char * load_path = nullptr;
+    const char * tile_directory = nullptr;
+    std::size_t memory_budget_mb{256};
+    std::size_t n_shards{0};
+    bool sampling_tuned{false};
+
+    for (int iarg = 1; iarg < argc; ++iarg)
+    {
+        if ((!strcmp(argv[iarg], "-j") || !strcmp(argv[iarg], "--workers")) && (iarg + 1 < argc))
+        {
+            options.n_workers = std::strtoul(argv[++iarg], nullptr, 10);
+        }
+        else if (!strcmp(argv[iarg], "-q") || !strcmp(argv[iarg], "--quantized"))
+        {
+            options.quantized = true;
+        }
+        else if (!strcmp(argv[iarg], "--knn") && (iarg + 1 < argc))
+        {
+            options.knn = std::strtoul(argv[++iarg], nullptr, 10);
+        }
+        else if (!strcmp(argv[iarg], "--descriptor-weight") && (iarg + 1 < argc))
+        {
+            options.descriptor_weight = std::strtod(argv[++iarg], nullptr);
+        }
+        else if (!strcmp(argv[iarg], "--activity-threshold") && (iarg + 1 < argc))
+        {
+            options.activity_thr_A_star = std::strtod(argv[++iarg], nullptr);
+        }
+        else if (!strcmp(argv[iarg], "--cp-samples") && (iarg + 1 < argc))
+        {
+            options.sampling.budget = std::strtoul(argv[++iarg], nullptr, 10);
+        }
+        else if (!strcmp(argv[iarg], "--cp-error") && (iarg + 1 < argc))
+        {
+            options.sampling.target_error = std::strtod(argv[++iarg], nullptr);
+            sampling_tuned = true;
+        }
+        else if (!strcmp(argv[iarg], "--seed") && (iarg + 1 < argc))
+        {
+            options.sampling.seed = std::strtoull(argv[++iarg], nullptr, 10);
+            sampling_tuned = true;
+        }
+        else if (!strcmp(argv[iarg], "--load") && (iarg + 1 < argc))
+        {
+            load_path = argv[++iarg];
+        }
+        else if (!strcmp(argv[iarg], "--out-of-core") && (iarg + 1 < argc))
+        {
+            tile_directory = argv[++iarg];
+        }
+        else if (!strcmp(argv[iarg], "--memory-budget") && (iarg + 1 < argc))
+        {
+            memory_budget_mb = std::strtoul(argv[++iarg], nullptr, 10);
+        }
+        else if (!strcmp(argv[iarg], "--shards") && (iarg + 1 < argc))
+        {
+            n_shards = std::strtoul(argv[++iarg], nullptr, 10);
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [-j|--workers N] [-q|--quantized] [--knn K] [--descriptor-weight W]"
+                << " [--activity-threshold A]"
+                << " [--cp-samples N [--cp-error E] [--seed S]] [--load dataset.bin]"
+                << " [--out-of-core DIR [--memory-budget MB]] [--shards K] [< input]" << std::endl;
+            return 1;
+        }
+    }
+
+    // RankOptions leaves sampling off unless given a budget
+    if (sampling_tuned && options.sampling.budget == 0)
+    {
+        std::cerr << "--cp-error and --seed need --cp-samples" << std::endl;
+        return 1;
+    }
+
+    // sampled CP values come with their errors, on stderr to keep the ranking output as it is
+    if (options.sampling.budget != 0)
+    {
+        options.cp_error_report = &std::cerr;
+    }
+
+    // shard workers score with the full CPsim curves and APSsim
+    if (n_shards != 0 && (tile_directory != nullptr || options.knn != 0 || options.sampling.budget != 0))
+    {
+        std::cerr << "--shards does not combine with --out-of-core, --knn or --cp-samples" << std::endl;
+        return 1;
+    }
+
+    // tiles are swept in full, and a loaded file is paged in on demand anyway
+    if (tile_directory != nullptr && (load_path != nullptr || options.knn != 0 || options.sampling.budget != 0))
+    {
+        std::cerr << "--out-of-core does not combine with --load, --knn or --cp-samples" << std::endl;
+        return 1;
+    }
+
+    ActiveMolecules active_molecules(options);
+
+    std::vector<std::string> training_data;
+    std::vector<std::string> testing_data;
+    std::vector<int> result;
+
+    AM_PHASE_SEQUENCE();
+
+    if (load_path != nullptr)
+    {
+        AM_NEXT_PHASE("load_binary");
+
+        MappedBinaryMatrix mapped;
+
+        if (!mapped.open(load_path))
+        {
+            std::cerr << "Cannot load binary dataset " << load_path << std::endl;
+            return 1;
+        }
+
+        if (!mapped.molecules(training_data, testing_data))
+        {
+            std::cerr << "Truncated molecule records in " << load_path << std::endl;
+            return 1;
+        }
+
+        AM_NEXT_PHASE("rank");
+
+        const bool done =
+            mapped.header().dtype == BinaryMatrixHeader::U8 ?
+                rank_mapped<std::uint8_t>(active_molecules, mapped, n_shards, training_data, testing_data, result)
+                :
+                rank_mapped<double>(active_molecules, mapped, n_shards, training_data, testing_data, result);
+
+        if (!done)
+        {
+            return 1;
+        }
+    }
+    else
+    {
+        AM_NEXT_PHASE("parse_input");
+
+        const std::size_t budget = memory_budget_mb << 20;
+
+        // out of core, the input block is taken off the memory budget as well
+        const std::size_t block_size =
+            tile_directory != nullptr ?
+                std::min<std::size_t>(+BlockReader::DEFAULT_BLOCK_SIZE, budget / 4)
+                :
+                +BlockReader::DEFAULT_BLOCK_SIZE;
+
+        BlockReader reader(stdin, block_size);
+        ThreadPool thread_pool(options.n_workers);
+
+        int X{0};
+        int Y{0};
+
+        reader.next_integer(X);
+        reader.next_integer(Y);
+
+        if (tile_directory != nullptr)
+        {
+            const bool done =
+                options.quantized ?
+                    rank_out_of_core<std::uint8_t>(reader, X, Y, tile_directory, budget - block_size, thread_pool,
+                        active_molecules, training_data, testing_data, result)
+                    :
+                    rank_out_of_core<double>(reader, X, Y, tile_directory, budget - block_size, thread_pool,
+                        active_molecules, training_data, testing_data, result);
+
+            if (!done)
+            {
+                return 1;
+            }
+        }
+        else if (n_shards != 0)
+        {
+            const bool done =
+                options.quantized ?
+                    rank_sharded<std::uint8_t>(reader, X, Y, n_shards, thread_pool,
+                        active_molecules, training_data, testing_data, result)
+                    :
+                    rank_sharded<double>(reader, X, Y, n_shards, thread_pool,
+                        active_molecules, training_data, testing_data, result);
+
+            if (!done)
+            {
+                return 1;
+            }
+        }
+        else
+        {
+            active_molecules.reserve(X + Y);
+
+            const bool complete = read_similarity_rows(reader, X + Y, thread_pool,
+                [&active_molecules](const std::size_t i, const double * cbegin, const double * cend)
+                {
+                    active_molecules.similarity(i, cbegin, cend);
+                }
+            );
+
+            if (!complete)
+            {
+                std::cerr << "Truncated similarity matrix in input" << std::endl;
+                return 1;
+            }
+
+            read_molecules(reader, X, Y, training_data, testing_data);
+
+            AM_NEXT_PHASE("rank");
+
+            result = active_molecules.rank(training_data, testing_data);
+        }
+    }
+
+    AM_NEXT_PHASE("output");
 
     std::copy(result.cbegin(), result.cend(), std::ostream_iterator<int>(std::cout, "\n"));
 
     std::cout << std::flush;
 
+    AM_END_PHASES();
+    AM_REPORT();
+
     return 0;
 }
@@ -1,5 +1,5 @@
 #!/bin/sh
 
-cat header.hpp matrix.hpp algebra.hpp cache.hpp CP.hpp molecule_input_placeholder.hpp similarities_input_placeholder.hpp ActiveMolecules.hpp | grep -v "#include \"" > submission.cpp
-g++ -std=c++11 -c submission.cpp
+cat header.hpp instrument.hpp allocator.hpp matrix.hpp symmetric_matrix.hpp algebra.hpp cache.hpp parallel.hpp pair_scheduler.hpp simd.hpp quantize.hpp jaccard_matrix.hpp CP.hpp sampled_cp.hpp descriptor_aps.hpp number_parser.hpp molecule_input_placeholder.hpp similarities_input_placeholder.hpp ActiveMolecules.hpp | grep -v "#include \"" > submission.cpp
+g++ -std=c++11 -pthread -c submission.cpp
 gvim submission.cpp &
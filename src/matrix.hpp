@@ -24,11 +24,127 @@
 #ifndef MATRIX_HPP_
 #define MATRIX_HPP_
 
+#include "allocator.hpp"
+#include "instrument.hpp"
+
 #include <cstddef>
 #include <algorithm>
 #include <valarray>
+#include <type_traits>
+
+/*
+ * Row padding policies: the leading dimension (distance in elements between
+ * consecutive rows, or columns for column-major matrices) for a given
+ * number of elements per row.
+ */
+struct NoPadding
+{
+    template<typename _Type>
+    static std::size_t leading_dimension(const std::size_t n_elem)
+    {
+        return n_elem;
+    }
+};
+
+// round rows up to a multiple of _Elements elements
+template<std::size_t _Elements>
+struct PadToElements
+{
+    template<typename _Type>
+    static std::size_t leading_dimension(const std::size_t n_elem)
+    {
+        return n_elem % _Elements ? n_elem + _Elements - n_elem % _Elements : n_elem;
+    }
+};
+
+// round rows up so that each of them starts on a _Bytes boundary
+template<std::size_t _Bytes>
+struct PadToBytes
+{
+    template<typename _Type>
+    static std::size_t leading_dimension(const std::size_t n_elem)
+    {
+        return PadToElements<(_Bytes > sizeof (_Type) ? _Bytes / sizeof (_Type) : 1)>::template leading_dimension<_Type>(n_elem);
+    }
+};
+
+typedef PadToBytes<64> CacheLinePadding;
+// widest vector register in use (AVX-512)
+typedef PadToBytes<64> SimdPadding;
 
+// element order policies
+struct RowMajor {};
+struct ColumnMajor {};
+
+/*
+ * Non-owning view of `size` elements placed `stride` apart, i.e. a matrix
+ * row or column. _Type may be const qualified for read-only access. Views
+ * are cheap to copy and are only valid as long as the matrix is.
+ */
 template<typename _Type>
+struct StridedView
+{
+    typedef typename std::remove_const<_Type>::type value_type;
+    typedef _Type * pointer;
+    typedef _Type & reference;
+    typedef std::size_t size_type;
+
+    StridedView(pointer data, size_type size, size_type stride)
+    :
+        m_data(data),
+        m_size(size),
+        m_stride(stride)
+    {
+    }
+
+    // read-only view of a mutable one
+    template<typename _OtherType>
+    StridedView(const StridedView<_OtherType> & other,
+        typename std::enable_if<std::is_convertible<_OtherType *, _Type *>::value>::type * = nullptr)
+    :
+        m_data(other.data()),
+        m_size(other.size()),
+        m_stride(other.stride())
+    {
+    }
+
+    reference operator[](const size_type index) const
+    {
+        return m_data[index * m_stride];
+    }
+
+    pointer data() const
+    {
+        return m_data;
+    }
+
+    size_type size() const
+    {
+        return m_size;
+    }
+
+    size_type stride() const
+    {
+        return m_stride;
+    }
+
+private:
+    pointer m_data;
+    size_type m_size;
+    size_type m_stride;
+};
+
+/*
+ * Dense 2D matrix parametrized with the row padding, the element order and
+ * the storage allocator (see allocator.hpp). row_begin/row_end are only
+ * available for row-major matrices and col_begin/col_end only for
+ * column-major ones; at(), write(), row() and col() work for both.
+ */
+template<
+    typename _Type,
+    typename _Padding = CacheLinePadding,
+    typename _Order = RowMajor,
+    typename _Allocator = AlignedAllocator<>>
 struct Matrix2d
 {
     typedef _Type value_type;
@@ -37,25 +153,56 @@ struct Matrix2d
     typedef std::size_t size_type;
     typedef std::valarray<value_type> column_type;
     typedef std::valarray<value_type> row_type;
+    typedef _Padding padding_type;
+    typedef _Order order_type;
+    typedef _Allocator allocator_type;
 
+    static constexpr bool ROW_MAJOR{std::is_same<order_type, RowMajor>::value};
 
     Matrix2d(size_type n_row, size_type n_col, value_type value = value_type())
     :
         m_n_row(n_row),
         m_n_col(n_col),
-        m_eff_row_size(effective_row_size(n_col)),
-        m_data(effective_nelem())
+        m_leading_dim(padding_type::template leading_dimension<value_type>(ROW_MAJOR ? n_col : n_row)),
+        m_data(static_cast<pointer>(allocator_type::allocate(nbytes())))
     {
+        AM_MATRIX_ALLOCATED(nbytes());
+
+        if (value != value_type())
+        {
+            for (size_type row{0}; row < m_n_row; ++row)
+            {
+                for (size_type col{0}; col < m_n_col; ++col)
+                {
+                    write(row, col, value);
+                }
+            }
+        }
     }
 
+    Matrix2d(const Matrix2d &) = delete;
+    Matrix2d & operator=(const Matrix2d &) = delete;
+
     void copyRowFrom(size_type row_index, const_pointer cbegin, const_pointer cend)
     {
-        std::copy(cbegin, cend, row_begin(row_index));
+        for (size_type col{0}; cbegin != cend; ++col)
+        {
+            write(row_index, col, *cbegin++);
+        }
+    }
+
+    void copyColFrom(size_type col_index, const_pointer cbegin, const_pointer cend)
+    {
+        for (size_type row{0}; cbegin != cend; ++row)
+        {
+            write(row, col_index, *cbegin++);
+        }
     }
 
     pointer row_begin(const size_type & index)
     {
-        return &m_data[row_start(index)];
+        static_assert(ROW_MAJOR, "row pointers need a row-major matrix");
+        return m_data + index * m_leading_dim;
     }
 
     pointer row_end(const size_type & index)
@@ -65,7 +212,8 @@ struct Matrix2d
 
     const_pointer row_cbegin(const size_type & index) const
     {
-        return &m_data[row_start(index)];
+        static_assert(ROW_MAJOR, "row pointers need a row-major matrix");
+        return m_data + index * m_leading_dim;
     }
 
     const_pointer row_cend(const size_type & index) const
@@ -73,14 +221,41 @@ struct Matrix2d
         return row_cbegin(index) + m_n_col;
     }
 
+    const_pointer upper_row_cbegin(const size_type & index) const
+    {
+        return row_cbegin(index);
+    }
+
+    pointer col_begin(const size_type & index)
+    {
+        static_assert(!ROW_MAJOR, "column pointers need a column-major matrix");
+        return m_data + index * m_leading_dim;
+    }
+
+    pointer col_end(const size_type & index)
+    {
+        return col_begin(index) + m_n_row;
+    }
+
+    const_pointer col_cbegin(const size_type & index) const
+    {
+        static_assert(!ROW_MAJOR, "column pointers need a column-major matrix");
+        return m_data + index * m_leading_dim;
+    }
+
+    const_pointer col_cend(const size_type & index) const
+    {
+        return col_cbegin(index) + m_n_row;
+    }
+
     value_type at(const size_type row, const size_type column) const
     {
-        return *(row_cbegin(row) + column);
+        return m_data[offset(row, column)];
     }
 
     void write(const size_type row, const size_type column, value_type value)
     {
-        *(row_begin(row) + column) = value;
+        m_data[offset(row, column)] = value;
     }
 
     size_type rows() const
@@ -93,55 +268,143 @@ struct Matrix2d
         return m_n_col;
     }
 
+    // distance in elements between rows (row-major) or columns (column-major)
+    size_type leading_dimension() const
+    {
+        return m_leading_dim;
+    }
+
+    StridedView<value_type> row_view(const size_type index)
+    {
+        return StridedView<value_type>(m_data + offset(index, 0), m_n_col, ROW_MAJOR ? 1 : m_leading_dim);
+    }
+
+    StridedView<const value_type> row_view(const size_type index) const
+    {
+        return StridedView<const value_type>(m_data + offset(index, 0), m_n_col, ROW_MAJOR ? 1 : m_leading_dim);
+    }
+
+    StridedView<value_type> col_view(const size_type index)
+    {
+        return StridedView<value_type>(m_data + offset(0, index), m_n_row, ROW_MAJOR ? m_leading_dim : 1);
+    }
+
+    StridedView<const value_type> col_view(const size_type index) const
+    {
+        return StridedView<const value_type>(m_data + offset(0, index), m_n_row, ROW_MAJOR ? m_leading_dim : 1);
+    }
+
     std::valarray<value_type> row(const size_type index) const
     {
-        return m_data[std::slice(index * m_eff_row_size, m_n_col, 1)];
+        std::valarray<value_type> result(m_n_col);
+
+        for (size_type col{0}; col < m_n_col; ++col)
+        {
+            result[col] = at(index, col);
+        }
+
+        return result;
     }
 
     std::valarray<value_type> col(const size_type index) const
     {
-        return m_data[std::slice(index , m_n_row, m_eff_row_size)];
+        std::valarray<value_type> result(m_n_row);
+
+        for (size_type row{0}; row < m_n_row; ++row)
+        {
+            result[row] = at(row, index);
+        }
+
+        return result;
     }
 
-    std::slice_array<value_type> col(const size_type index)
+    ~Matrix2d()
     {
-        return m_data[std::slice(index , m_n_row, m_eff_row_size)];
+        AM_MATRIX_RELEASED(nbytes());
+        allocator_type::deallocate(m_data, nbytes());
     }
 
-    ~Matrix2d()
+private:
+    size_type nbytes() const
     {
+        return (ROW_MAJOR ? m_n_row : m_n_col) * m_leading_dim * sizeof (value_type);
+    }
+
+    size_type offset(const size_type row, const size_type column) const
+    {
+        return ROW_MAJOR ? row * m_leading_dim + column : column * m_leading_dim + row;
     }
 
 private:
-    size_type effective_row_size(const size_type & x_dim) const
+    const size_type m_n_row;
+    const size_type m_n_col;
+    const size_type m_leading_dim;
+    const pointer m_data;
+};
+
+/*
+ * Read-only view with the Matrix2d access API over dense, unpadded
+ * row-major storage owned elsewhere, e.g. a memory mapped file.
+ */
+template<typename _Type>
+struct MatrixView
+{
+    typedef _Type value_type;
+    typedef const value_type * const_pointer;
+    typedef std::size_t size_type;
+
+    MatrixView(const_pointer data, size_type n_row, size_type n_col)
+    :
+        m_n_row(n_row),
+        m_n_col(n_col),
+        m_data(data)
     {
-        auto constexpr round_up = [](const size_type & what, const size_type & mult) -> size_type
-        {
-            return
-                what % mult ?
-                    what + mult - what % mult
-                    :
-                    what;
-        };
+    }
 
-        return round_up(x_dim, 512);
+    const_pointer row_cbegin(const size_type & index) const
+    {
+        return m_data + index * m_n_col;
+    }
+
+    const_pointer row_cend(const size_type & index) const
+    {
+        return row_cbegin(index) + m_n_col;
     }
 
-    size_type effective_nelem() const
+    const_pointer upper_row_cbegin(const size_type & index) const
     {
-        return m_n_row * m_eff_row_size;
+        return row_cbegin(index);
     }
 
-    size_type row_start(const size_type & index) const
+    value_type at(const size_type row, const size_type column) const
     {
-        return index * m_eff_row_size;
+        return *(row_cbegin(row) + column);
+    }
+
+    StridedView<const value_type> row_view(const size_type index) const
+    {
+        return StridedView<const value_type>(row_cbegin(index), m_n_col, 1);
+    }
+
+    StridedView<const value_type> col_view(const size_type index) const
+    {
+        return StridedView<const value_type>(m_data + index, m_n_row, m_n_col);
+    }
+
+    size_type rows() const
+    {
+        return m_n_row;
+    }
+
+    size_type cols() const
+    {
+        return m_n_col;
     }
 
 private:
     const size_type m_n_row;
     const size_type m_n_col;
-    const size_type m_eff_row_size;
-    std::valarray<value_type> m_data;
+    const_pointer m_data;
 };
 
 #endif /* MATRIX_HPP_ */
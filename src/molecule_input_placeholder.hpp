@@ -24,18 +24,23 @@
 #ifndef MOLECULE_INPUT_PLACEHOLDER_HPP_
 #define MOLECULE_INPUT_PLACEHOLDER_HPP_
 
+#include "matrix.hpp"
+#include "number_parser.hpp"
+
 #include <vector>
 #include <string>
 #include <utility>
 #include <cstddef>
-#include <cstdio>
-#include <sstream>
+#include <cmath>
 #include <memory>
+#include <algorithm>
 
 struct MoleculeInputPlaceholder
 {
     typedef std::size_t size_type;
     typedef std::vector<std::string> array_type;
+    // rows are short (N_COL doubles) and read whole by the Jaccard sweep
+    typedef Matrix2d<double, CacheLinePadding, RowMajor, AlignedAllocator<>> matrix_type;
     static constexpr size_type N_COL{22};
 
     void takeFrom(array_type && array)
@@ -43,30 +48,137 @@ struct MoleculeInputPlaceholder
         m_array = std::move(array);
     }
 
-    std::unique_ptr<Matrix2d<double>> render() const
+    std::unique_ptr<matrix_type> render() const
     {
-        std::unique_ptr<Matrix2d<double>> result(new Matrix2d<double>(m_array.size(), N_COL));
+        std::unique_ptr<matrix_type> result(new matrix_type(m_array.size(), N_COL));
 
         for (size_type row = 0; row < m_array.size(); ++row)
         {
-            std::stringstream stream(m_array[row]);
-            std::string token;
-            for (size_type index = 0; (index < 14) && std::getline(stream, token, ','); ++index)
+            parse_record(m_array[row], result->row_begin(row));
+        }
+
+        return result;
+    }
+
+    /*
+     * Welford's running mean and sample variance of all N_COL columns,
+     * updated a whole row at a time so that the updates vectorize. Every
+     * path that normalizes molecule rows goes through it, so a ranking that
+     * is rebuilt from running statistics matches render_normalized() bit for
+     * bit.
+     */
+    struct ColumnStatistics
+    {
+        ColumnStatistics()
+        :
+            m_count(0),
+            m_mean(),
+            m_m2()
+        {
+        }
+
+        void add(const double * values)
+        {
+            const double count = ++m_count;
+
+            for (size_type col = 0; col < N_COL; ++col)
+            {
+                const double delta = values[col] - m_mean[col];
+
+                m_mean[col] += delta / count;
+                m_m2[col] += delta * (values[col] - m_mean[col]);
+            }
+        }
+
+        size_type count() const
+        {
+            return m_count;
+        }
+
+        // the normalization of the rows added so far, N_COL values each
+        void snapshot(double * mean, double * stddev) const
+        {
+            for (size_type col = 0; col < N_COL; ++col)
             {
-                sscanf(token.c_str(), "%lf", result->row_begin(row) + index);
+                mean[col] = m_mean[col];
+                stddev[col] = sqrt(m_m2[col] / (m_count - 1));
             }
+        }
+
+        // normalizes the leading `n_rows` rows of `matrix` in place
+        void normalize(matrix_type & matrix, const size_type n_rows) const
+        {
+            double mean[N_COL];
+            double stddev[N_COL];
 
-            std::getline(stream, token, ','); // skip formula
+            snapshot(mean, stddev);
 
-            for (size_type index = 14; (index < 22) && std::getline(stream, token, ','); ++index)
+            for (size_type row = 0; row < n_rows; ++row)
             {
-                sscanf(token.c_str(), "%lf", result->row_begin(row) + index);
+                double * values = matrix.row_begin(row);
+
+                for (size_type col = 0; col < N_COL; ++col)
+                {
+                    values[col] = (values[col] - mean[col]) / stddev[col];
+                }
             }
         }
 
+    private:
+        size_type m_count;
+        double m_mean[N_COL];
+        double m_m2[N_COL];
+    };
+
+    // render() and normalize_columns() in one pass over the records
+    std::unique_ptr<matrix_type> render_normalized() const
+    {
+        std::unique_ptr<matrix_type> result(new matrix_type(m_array.size(), N_COL));
+        ColumnStatistics statistics;
+
+        for (size_type row = 0; row < m_array.size(); ++row)
+        {
+            parse_record(m_array[row], result->row_begin(row));
+            statistics.add(result->row_begin(row));
+        }
+
+        statistics.normalize(*result, m_array.size());
+
         return result;
     }
 
+private:
+    /*
+     * Parses a record in place into N_COL values: 14 descriptors, the
+     * formula (skipped), 7 descriptors and the activity, which testing
+     * records lack and is left 0.
+     */
+    static void parse_record(const std::string & record, double * values)
+    {
+        constexpr size_type FORMULA_FIELD{14};
+
+        const char * pos = record.data();
+        const char * const end = pos + record.size();
+        size_type index{0};
+
+        for (size_type field{0}; index < N_COL && pos != end; ++field)
+        {
+            const char * const field_end = std::find(pos, end, ',');
+
+            if (field != FORMULA_FIELD)
+            {
+                parse_double(skip_spaces(pos, field_end), field_end, values[index++], ',');
+            }
+
+            pos = field_end != end ? field_end + 1 : end;
+        }
+
+        for (; index < N_COL; ++index)
+        {
+            values[index] = 0.0;
+        }
+    }
+
 private:
     array_type m_array;
 };
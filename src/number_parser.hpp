@@ -0,0 +1,195 @@
+/*******************************************************************************
+ * Copyright (c) 2015 Wojciech Migda
+ * All rights reserved
+ * Distributed under the terms of the GNU LGPL v3
+ *******************************************************************************
+ *
+ * Filename: number_parser.hpp
+ *
+ * Description:
+ *      Locale-free parsing of decimal numbers from character ranges
+ *
+ * Authors:
+ *          Wojciech Migda (wm)
+ *
+ *******************************************************************************
+ * History:
+ * --------
+ * Date         Who  Ticket     Description
+ * ----------   ---  ---------  ------------------------------------------------
+ * 2026-10-17   wm              Initial version
+ *
+ ******************************************************************************/
+
+#ifndef NUMBER_PARSER_HPP_
+#define NUMBER_PARSER_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+
+// the fast path below relies on exact IEEE division, see parse_double
+#pragma GCC push_options
+#pragma GCC optimize ( "-fno-fast-math" )
+
+inline
+bool is_space(const char c)
+{
+    // ' ' or one of \t \n \v \f \r
+    return c == ' ' || (unsigned char)(c - '\t') <= (unsigned char)('\r' - '\t');
+}
+
+inline
+const char * skip_spaces(const char * pos, const char * end)
+{
+    while (pos != end && is_space(*pos))
+    {
+        ++pos;
+    }
+
+    return pos;
+}
+
+inline
+const char * skip_token(const char * pos, const char * end)
+{
+    while (pos != end && !is_space(*pos))
+    {
+        ++pos;
+    }
+
+    return pos;
+}
+
+/*
+ * Parses one decimal number starting at `pos`, stopping at `end` or at the
+ * first whitespace or `delimiter` character, and returns the position
+ * after it.
+ *
+ * Numbers whose significand fits in 53 bits and whose decimal exponent is
+ * within +/-22 are converted with a single exactly rounded multiplication
+ * or division (Clinger's fast path), which gives the same double as strtod.
+ * Anything else (long significands, large exponents, inf/nan) is handed to
+ * strtod, so the result always matches `std::cin >> double`.
+ */
+inline
+const char * parse_double(const char * pos, const char * end, double & value, const char delimiter = ' ')
+{
+    static const double POW10[] =
+    {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    constexpr std::uint64_t MAX_EXACT_SIGNIFICAND{std::uint64_t(1) << 53};
+    constexpr std::uint64_t MAX_ACCUMULATED{(UINT64_MAX - 9) / 10};
+
+    const char * const begin = pos;
+
+    bool negative = false;
+
+    if (pos != end && (*pos == '-' || *pos == '+'))
+    {
+        negative = *pos == '-';
+        ++pos;
+    }
+
+    std::uint64_t significand{0};
+    int exponent{0};
+    bool exact = true;
+    bool any_digit = false;
+
+    for (; pos != end && *pos >= '0' && *pos <= '9'; ++pos)
+    {
+        any_digit = true;
+
+        if (significand <= MAX_ACCUMULATED)
+        {
+            significand = significand * 10 + (*pos - '0');
+        }
+        else
+        {
+            exact = false;
+        }
+    }
+
+    if (pos != end && *pos == '.')
+    {
+        ++pos;
+
+        for (; pos != end && *pos >= '0' && *pos <= '9'; ++pos)
+        {
+            any_digit = true;
+
+            if (significand <= MAX_ACCUMULATED)
+            {
+                significand = significand * 10 + (*pos - '0');
+                --exponent;
+            }
+            else
+            {
+                exact = false;
+            }
+        }
+    }
+
+    if (any_digit && pos != end && (*pos == 'e' || *pos == 'E'))
+    {
+        const char * exp_pos = pos + 1;
+        bool exp_negative = false;
+
+        if (exp_pos != end && (*exp_pos == '-' || *exp_pos == '+'))
+        {
+            exp_negative = *exp_pos == '-';
+            ++exp_pos;
+        }
+
+        if (exp_pos != end && *exp_pos >= '0' && *exp_pos <= '9')
+        {
+            int exp_value{0};
+
+            for (; exp_pos != end && *exp_pos >= '0' && *exp_pos <= '9'; ++exp_pos)
+            {
+                if (exp_value < 100000)
+                {
+                    exp_value = exp_value * 10 + (*exp_pos - '0');
+                }
+            }
+
+            exponent += exp_negative ? -exp_value : exp_value;
+            pos = exp_pos;
+        }
+    }
+
+    const bool terminated = pos == end || is_space(*pos) || *pos == delimiter;
+
+    if (any_digit && terminated && exact && significand <= MAX_EXACT_SIGNIFICAND && exponent >= -22 && exponent <= 22)
+    {
+        const double magnitude =
+            exponent < 0 ?
+                (double)significand / POW10[-exponent]
+                :
+                (double)significand * POW10[exponent];
+
+        value = negative ? -magnitude : magnitude;
+
+        return pos;
+    }
+
+    // slow path, strtod wants a terminated string
+    const char * token_end = begin;
+
+    while (token_end != end && !is_space(*token_end) && *token_end != delimiter)
+    {
+        ++token_end;
+    }
+
+    const std::string token(begin, token_end);
+    value = std::strtod(token.c_str(), nullptr);
+
+    return token_end;
+}
+
+#pragma GCC pop_options
+
+#endif /* NUMBER_PARSER_HPP_ */
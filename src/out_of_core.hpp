@@ -0,0 +1,326 @@
+/*******************************************************************************
+ * Copyright (c) 2015 Wojciech Migda
+ * All rights reserved
+ * Distributed under the terms of the GNU LGPL v3
+ *******************************************************************************
+ *
+ * Filename: out_of_core.hpp
+ *
+ * Description:
+ *      Ranking sweeps over similarity trapezoids kept on disk as tiles
+ *
+ * Authors:
+ *          Wojciech Migda (wm)
+ *
+ *******************************************************************************
+ * History:
+ * --------
+ * Date         Who  Ticket     Description
+ * ----------   ---  ---------  ------------------------------------------------
+ * 2026-10-17   wm              Initial version
+ *
+ ******************************************************************************/
+
+#ifndef OUT_OF_CORE_HPP_
+#define OUT_OF_CORE_HPP_
+
+#include "tiled_matrix.hpp"
+#include "CP.hpp"
+#include "jaccard_matrix.hpp"
+#include "quantize.hpp"
+#include "parallel.hpp"
+#include "instrument.hpp"
+
+#include <cstddef>
+#include <cmath>
+#include <valarray>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+
+/*
+ * The sweeps below reproduce the in-memory ranking bit for bit, so keep
+ * the compiler from reassociating their sums.
+ */
+#pragma GCC push_options
+#pragma GCC optimize("-fno-fast-math", "-ffp-contract=off")
+
+/*
+ * Fills `jaccards`, an X x N TiledMatrixFile, with the trapezoid that
+ * build_jaccard_matrix() keeps in memory, with the same arithmetic. One
+ * tile row is computed at a time, its tiles spread over the pool, and
+ * written out in one go, so only a tile row is held.
+ */
+template<typename _Type, typename _MoleculeMatrixType>
+bool build_tiled_jaccard(
+    const _MoleculeMatrixType & train_data,
+    const _MoleculeMatrixType & test_data,
+    const std::size_t n_features,
+    TiledMatrixFile<_Type> & jaccards,
+    ThreadPool & thread_pool)
+{
+    typedef std::size_t size_type;
+
+    constexpr size_type ROWS{GramKernel::ROWS};
+
+    const size_type X = jaccards.rows();
+    const size_type N = jaccards.cols();
+    const size_type T = jaccards.tile_size();
+
+    AM_COUNT(PAIRS_VISITED, X * (X + 1) / 2 + X * (N - X));
+
+    const JaccardOperands operands(train_data, test_data, n_features);
+
+    std::vector<_Type> band(jaccards.tile_cols() * jaccards.tile_elements());
+
+    for (size_type tile_row{0}; tile_row < jaccards.tile_rows() && jaccards.good(); ++tile_row)
+    {
+        const size_type n_tiles = jaccards.tile_cols() - tile_row;
+        const size_type row_begin = tile_row * T;
+        const size_type row_end = std::min(row_begin + T, X);
+
+        thread_pool.parallel_for(0, n_tiles,
+            [&](const size_type idx)
+            {
+                const size_type col_begin = (tile_row + idx) * T;
+                const size_type col_end = std::min(col_begin + T, N);
+
+                _Type * tile = &band[idx * jaccards.tile_elements()];
+                std::vector<double> products(ROWS * T);
+
+                for (size_type block{row_begin}; block < row_end; block += ROWS)
+                {
+                    operands.multiply(block, col_begin, col_end, products.data(), T);
+
+                    for (size_type ridx{block}; ridx < std::min(block + ROWS, row_end); ++ridx)
+                    {
+                        const double * row_products = &products[(ridx - block) * T] - col_begin;
+                        _Type * out = tile + (ridx - row_begin) * T - col_begin;
+
+                        for (size_type cidx{std::max(col_begin, ridx)}; cidx < col_end; ++cidx)
+                        {
+                            out[cidx] = SimilarityCodec<_Type>::encode(operands.similarity(ridx, cidx, row_products[cidx]));
+                        }
+                    }
+                }
+            }
+        );
+
+        jaccards.write_tiles(TileIndex{tile_row, tile_row}, n_tiles, band.data());
+    }
+
+    return jaccards.good();
+}
+
+/*
+ * CPsimCurve over the training pairs i < j < X of a tiled trapezoid, X
+ * being the number of activities: the tiles left of column X are swept
+ * once, the rows of each spread over the pool's workers, each of which
+ * bins into a histogram of its own.
+ */
+template<typename _Type, std::size_t _N>
+CPsimCurve<double, _N> tiled_cpsim_curve(
+    const TiledMatrixFile<_Type> & similarities,
+    const double activity_thr_A_star,
+    const std::valarray<double> & activities,
+    ThreadPool & thread_pool)
+{
+    typedef std::size_t size_type;
+    typedef CPsimCurve<double, _N> curve_type;
+    typedef typename curve_type::histogram_type histogram_type;
+
+    const size_type X = activities.size();
+    const size_type T = similarities.tile_size();
+
+    std::vector<TileIndex> order;
+
+    for (size_type tile_row{0}; tile_row < similarities.tile_rows(); ++tile_row)
+    {
+        for (size_type tile_col{tile_row}; tile_col * T < X; ++tile_col)
+        {
+            order.push_back(TileIndex{tile_row, tile_col});
+        }
+    }
+
+    AM_COUNT(PAIRS_VISITED, X * (X - 1) / 2);
+
+    std::vector<histogram_type> partials(thread_pool.workers());
+
+    for_each_stored_tile(similarities, order,
+        [&](const TileIndex & tile, const _Type * data)
+        {
+            const size_type row_begin = tile.row * T;
+            const size_type row_end = std::min(row_begin + T, X);
+            const size_type col_begin = tile.col * T;
+            const size_type col_end = std::min(col_begin + T, X);
+
+            std::atomic<size_type> next(row_begin);
+
+            thread_pool.run_on_workers(
+                [&](const size_type worker)
+                {
+                    histogram_type & histogram = partials[worker];
+
+                    for (size_type iidx = next++; iidx < row_end; iidx = next++)
+                    {
+                        const double activity_iidx = activities[iidx];
+                        const _Type * row = data + (iidx - row_begin) * T - col_begin;
+
+                        for (size_type jidx{std::max(col_begin, iidx + 1)}; jidx < col_end; ++jidx)
+                        {
+                            const bool Delta_A_i_j_LE_A_star = fabs(activity_iidx - activities[jidx]) <= activity_thr_A_star;
+
+                            histogram.add(curve_type::indexFor(row[jidx]), Delta_A_i_j_LE_A_star);
+                        }
+                    }
+                }
+            );
+        }
+    );
+
+    histogram_type histogram;
+
+    for (const auto & partial : partials)
+    {
+        histogram += partial;
+    }
+
+    return curve_type(histogram);
+}
+
+/*
+ * Adds the APSsim of every test molecule, i.e. of the columns X .. N - 1
+ * of a tiled trapezoid, to `scores`. Each column band's training tiles are
+ * swept once, top down, so every column's APSSums take the training
+ * molecules in order, as APSsim() does. Within a tile the workers take
+ * chunks of columns and go down the tile's rows.
+ */
+template<typename _Type, std::size_t _N>
+void tiled_apssim(
+    const TiledMatrixFile<_Type> & similarities,
+    const CPsimCurve<double, _N> & curve,
+    const std::valarray<double> & activities,
+    ThreadPool & thread_pool,
+    std::vector<double> & scores)
+{
+    typedef std::size_t size_type;
+
+    constexpr size_type CHUNK{16};
+
+    const size_type X = activities.size();
+    const size_type N = similarities.cols();
+    const size_type T = similarities.tile_size();
+
+    std::vector<TileIndex> order;
+
+    for (size_type tile_col{X / T}; tile_col < similarities.tile_cols(); ++tile_col)
+    {
+        for (size_type tile_row{0}; tile_row < similarities.tile_rows(); ++tile_row)
+        {
+            order.push_back(TileIndex{tile_row, tile_col});
+        }
+    }
+
+    std::vector<APSSums<double>> sums(N - X);
+
+    for_each_stored_tile(similarities, order,
+        [&](const TileIndex & tile, const _Type * data)
+        {
+            const size_type row_begin = tile.row * T;
+            const size_type row_end = std::min(row_begin + T, X);
+            const size_type col_begin = std::max(tile.col * T, X);
+            const size_type col_end = std::min(tile.col * T + T, N);
+            const size_type n_chunks = (col_end - col_begin + CHUNK - 1) / CHUNK;
+
+            AM_COUNT(CURVE_LOOKUPS, (row_end - row_begin) * (col_end - col_begin));
+
+            thread_pool.parallel_for(0, n_chunks,
+                [&](const size_type chunk)
+                {
+                    const size_type first = col_begin + chunk * CHUNK;
+                    const size_type last = std::min(first + CHUNK, col_end);
+
+                    for (size_type iidx{row_begin}; iidx < row_end; ++iidx)
+                    {
+                        const _Type * row = data + (iidx - row_begin) * T - tile.col * T;
+
+                        for (size_type jidx{first}; jidx < last; ++jidx)
+                        {
+                            sums[jidx - X].add(activities[iidx], curve.at(row[jidx]));
+                        }
+                    }
+                }
+            );
+        }
+    );
+
+    for (size_type idx{0}; idx < N - X; ++idx)
+    {
+        scores[idx] += sums[idx].result();
+    }
+}
+
+/*
+ * Scorer for ActiveMolecules::rank_scored() off a similarity trapezoid
+ * kept on disk: the sum of the similarity and Jaccard APSsim, as rank()
+ * computes it from matrices in memory. The Jaccard trapezoid is tiled the
+ * same way into a file of its own next to the similarity one. good()
+ * tells whether all tile I/O went through.
+ */
+template<typename _Type>
+struct OutOfCoreScorer
+{
+    OutOfCoreScorer(const TiledMatrixFile<_Type> & similarities, const double activity_thr_A_star)
+    :
+        m_similarities(similarities),
+        m_activity_thr_A_star(activity_thr_A_star),
+        m_good(true)
+    {
+    }
+
+    bool good() const
+    {
+        return m_good;
+    }
+
+    template<typename _MoleculeMatrixType>
+    void operator()(
+        const _MoleculeMatrixType & train_data,
+        const _MoleculeMatrixType & test_data,
+        const std::size_t n_features,
+        const std::valarray<double> & activities,
+        ThreadPool & thread_pool,
+        std::vector<double> & scores)
+    {
+        AM_PHASE_SEQUENCE();
+        AM_NEXT_PHASE("tiled_jaccard");
+
+        TiledMatrixFile<_Type> jaccards(m_similarities.directory(),
+            m_similarities.rows(), m_similarities.cols(), m_similarities.tile_size());
+
+        build_tiled_jaccard(train_data, test_data, n_features, jaccards, thread_pool);
+
+        AM_NEXT_PHASE("tiled_cpsim_curves");
+
+        const CPsimCurve<double, 101> similarities_curve =
+            tiled_cpsim_curve<_Type, 101>(m_similarities, m_activity_thr_A_star, activities, thread_pool);
+        const CPsimCurve<double, 101> jaccards_curve =
+            tiled_cpsim_curve<_Type, 101>(jaccards, m_activity_thr_A_star, activities, thread_pool);
+
+        AM_NEXT_PHASE("tiled_apssim_scoring");
+
+        tiled_apssim(m_similarities, similarities_curve, activities, thread_pool, scores);
+        tiled_apssim(jaccards, jaccards_curve, activities, thread_pool, scores);
+
+        m_good = m_similarities.good() && jaccards.good();
+    }
+
+private:
+    const TiledMatrixFile<_Type> & m_similarities;
+    const double m_activity_thr_A_star;
+    bool m_good;
+};
+
+#pragma GCC pop_options
+
+#endif /* OUT_OF_CORE_HPP_ */
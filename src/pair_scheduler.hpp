@@ -0,0 +1,290 @@
+/*******************************************************************************
+ * Copyright (c) 2015 Wojciech Migda
+ * All rights reserved
+ * Distributed under the terms of the GNU LGPL v3
+ *******************************************************************************
+ *
+ * Filename: pair_scheduler.hpp
+ *
+ * Description:
+ *      Tiled, work stealing parallel sweeps over the upper triangle of pairs
+ *
+ * Authors:
+ *          Wojciech Migda (wm)
+ *
+ *******************************************************************************
+ * History:
+ * --------
+ * Date         Who  Ticket     Description
+ * ----------   ---  ---------  ------------------------------------------------
+ * 2026-10-17   wm              Initial version
+ *
+ ******************************************************************************/
+
+#ifndef PAIR_SCHEDULER_HPP_
+#define PAIR_SCHEDULER_HPP_
+
+#include "parallel.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+
+/*
+ * Rectangular block of the pair space, rows [row_begin, row_end) against
+ * columns [col_begin, col_end). Tile functions still have to skip the
+ * columns left of the diagonal in tiles crossing it.
+ */
+struct PairTile
+{
+    std::size_t row_begin;
+    std::size_t row_end;
+    std::size_t col_begin;
+    std::size_t col_end;
+};
+
+/*
+ * The pairs (r, c) with r < n_row and r + diagonal_offset <= c < n_col cut
+ * into tile_rows x tile_cols tiles aligned to multiples of the tile size,
+ * tiles with no such pair left out. diagonal_offset is 1 for the i < j
+ * sweeps and 0 when the diagonal is part of the work.
+ *
+ * Rows of the triangle get shorter and shorter, so every tile carries its
+ * pair count, which is what the schedulers balance on.
+ */
+struct TriangleTiling
+{
+    typedef std::size_t size_type;
+
+    // 64 rows against 2048 doubles keep a tile's column panel within L1/L2
+    static constexpr size_type DEFAULT_TILE_ROWS{64};
+    static constexpr size_type DEFAULT_TILE_COLS{2048};
+
+    TriangleTiling(
+        const size_type n_row,
+        const size_type n_col,
+        const size_type diagonal_offset = 1,
+        const size_type tile_rows = DEFAULT_TILE_ROWS,
+        const size_type tile_cols = DEFAULT_TILE_COLS)
+    {
+        for (size_type row_begin{0}; row_begin < n_row; row_begin += tile_rows)
+        {
+            const size_type row_end = std::min(row_begin + tile_rows, n_row);
+
+            for (size_type col_begin = (row_begin + diagonal_offset) / tile_cols * tile_cols;
+                col_begin < n_col;
+                col_begin += tile_cols)
+            {
+                const PairTile tile{row_begin, row_end, col_begin, std::min(col_begin + tile_cols, n_col)};
+                size_type pairs{0};
+
+                for (size_type row{row_begin}; row < row_end; ++row)
+                {
+                    const size_type first = std::max(tile.col_begin, row + diagonal_offset);
+
+                    pairs += first < tile.col_end ? tile.col_end - first : 0;
+                }
+
+                if (pairs != 0)
+                {
+                    m_tiles.push_back(tile);
+                    m_pairs.push_back(pairs);
+                }
+            }
+        }
+    }
+
+    size_type size() const
+    {
+        return m_tiles.size();
+    }
+
+    const PairTile & operator[](const size_type index) const
+    {
+        return m_tiles[index];
+    }
+
+    size_type pairs(const size_type index) const
+    {
+        return m_pairs[index];
+    }
+
+private:
+    std::vector<PairTile> m_tiles;
+    std::vector<size_type> m_pairs;
+};
+
+/*
+ * Per worker ranges of tile indices. Tiles are first split into contiguous
+ * runs of roughly equal pair count, one run per worker. A worker takes
+ * tiles from the front of its own run and, once that is empty, steals
+ * single tiles from the back of the others' runs.
+ *
+ * A run is a [front, back) pair packed into one 64-bit word, so the owner
+ * and the thieves agree through compare-and-swap alone.
+ */
+struct TileQueues
+{
+    typedef std::size_t size_type;
+    typedef std::uint64_t range_type;
+
+    TileQueues(const TriangleTiling & tiling, const size_type n_workers)
+    :
+        m_ranges(n_workers)
+    {
+        size_type total{0};
+
+        for (size_type idx{0}; idx < tiling.size(); ++idx)
+        {
+            total += tiling.pairs(idx);
+        }
+
+        size_type tile{0};
+        size_type done{0};
+
+        for (size_type worker{0}; worker < n_workers; ++worker)
+        {
+            const size_type front = tile;
+            const size_type quota = total / n_workers * (worker + 1) + (worker + 1 == n_workers ? total % n_workers : 0);
+
+            while (tile < tiling.size() && done < quota)
+            {
+                done += tiling.pairs(tile++);
+            }
+
+            m_ranges[worker].bounds.store(pack(front, tile), std::memory_order_relaxed);
+        }
+    }
+
+    bool pop(const size_type worker, size_type & tile)
+    {
+        if (take(worker, true, tile))
+        {
+            return true;
+        }
+
+        for (size_type step{1}; step < m_ranges.size(); ++step)
+        {
+            if (take((worker + step) % m_ranges.size(), false, tile))
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+private:
+    static range_type pack(const size_type front, const size_type back)
+    {
+        return (range_type(front) << 32) | range_type(back);
+    }
+
+    bool take(const size_type victim, const bool from_front, size_type & tile)
+    {
+        std::atomic<range_type> & bounds = m_ranges[victim].bounds;
+        range_type range = bounds.load(std::memory_order_relaxed);
+
+        while (true)
+        {
+            const size_type front = range >> 32;
+            const size_type back = range & 0xFFFFFFFFu;
+
+            if (front >= back)
+            {
+                return false;
+            }
+
+            const range_type next = from_front ? pack(front + 1, back) : pack(front, back - 1);
+
+            if (bounds.compare_exchange_weak(range, next, std::memory_order_acq_rel, std::memory_order_relaxed))
+            {
+                tile = from_front ? front : back - 1;
+                return true;
+            }
+        }
+    }
+
+private:
+    // padded so that workers updating their own runs do not share cache lines
+    struct Range
+    {
+        Range()
+        :
+            bounds(0)
+        {
+        }
+
+        std::atomic<range_type> bounds;
+        char padding[64 - sizeof (std::atomic<range_type>)];
+    };
+
+    std::vector<Range> m_ranges;
+};
+
+/*
+ * Calls fn(tile) for every tile on all workers of the pool. The tile
+ * functions must write disjoint outputs.
+ */
+template<typename _TileFunction>
+void for_each_tile(ThreadPool & thread_pool, const TriangleTiling & tiling, _TileFunction && fn)
+{
+    TileQueues queues(tiling, thread_pool.workers());
+
+    thread_pool.run_on_workers(
+        [&](const std::size_t worker)
+        {
+            std::size_t tile{0};
+
+            while (queues.pop(worker, tile))
+            {
+                fn(tiling[tile]);
+            }
+        }
+    );
+}
+
+/*
+ * Calls fn(tile, partial) for every tile, each worker accumulating into a
+ * partial result of its own that starts as a copy of `zero`. The partials
+ * are then summed with += in worker order. For integer counts the sum is
+ * exact, so the result does not depend on which worker got which tile.
+ */
+template<typename _Accumulator, typename _TileFunction>
+_Accumulator reduce_tiles(
+    ThreadPool & thread_pool,
+    const TriangleTiling & tiling,
+    const _Accumulator & zero,
+    _TileFunction && fn)
+{
+    TileQueues queues(tiling, thread_pool.workers());
+    std::vector<_Accumulator> partials(thread_pool.workers(), zero);
+
+    thread_pool.run_on_workers(
+        [&](const std::size_t worker)
+        {
+            _Accumulator partial(zero);
+            std::size_t tile{0};
+
+            while (queues.pop(worker, tile))
+            {
+                fn(tiling[tile], partial);
+            }
+
+            partials[worker] = partial;
+        }
+    );
+
+    _Accumulator result(zero);
+
+    for (const auto & partial : partials)
+    {
+        result += partial;
+    }
+
+    return result;
+}
+
+#endif /* PAIR_SCHEDULER_HPP_ */
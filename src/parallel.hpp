@@ -0,0 +1,244 @@
+/*******************************************************************************
+ * Copyright (c) 2015 Wojciech Migda
+ * All rights reserved
+ * Distributed under the terms of the GNU LGPL v3
+ *******************************************************************************
+ *
+ * Filename: parallel.hpp
+ *
+ * Description:
+ *      Fixed-size thread pool with a blocking parallel_for
+ *
+ * Authors:
+ *          Wojciech Migda (wm)
+ *
+ *******************************************************************************
+ * History:
+ * --------
+ * Date         Who  Ticket     Description
+ * ----------   ---  ---------  ------------------------------------------------
+ * 2026-10-17   wm              Initial version
+ *
+ ******************************************************************************/
+
+#ifndef PARALLEL_HPP_
+#define PARALLEL_HPP_
+
+#include <cstddef>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include <exception>
+
+/*
+ * The calling thread always takes part in the work, so a pool of n workers
+ * spawns n - 1 threads and a pool of one worker runs everything inline.
+ * The caller is worker 0, the spawned threads are workers 1..n-1.
+ * Iterations are handed out in chunks of `grain` from a shared counter;
+ * the caller is responsible for making each iteration write only its own
+ * output slot, which keeps results independent of the schedule.
+ * An exception thrown by any worker is held until all workers are done
+ * and then rethrown on the calling thread; only the first one is kept.
+ */
+struct ThreadPool
+{
+    typedef std::size_t size_type;
+
+    static size_type default_workers()
+    {
+        const size_type hw = std::thread::hardware_concurrency();
+
+        return hw != 0 ? hw : 1;
+    }
+
+    explicit ThreadPool(size_type n_workers = default_workers())
+    :
+        m_n_workers(std::max<size_type>(n_workers, 1)),
+        m_generation(0),
+        m_busy(0),
+        m_quit(false)
+    {
+        m_threads.reserve(m_n_workers - 1);
+
+        for (size_type idx{1}; idx < m_n_workers; ++idx)
+        {
+            m_threads.emplace_back(&ThreadPool::run, this, idx);
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool & operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_quit = true;
+        }
+        m_wake.notify_all();
+
+        for (auto & thread : m_threads)
+        {
+            thread.join();
+        }
+    }
+
+    size_type workers() const
+    {
+        return m_n_workers;
+    }
+
+    template<typename _Function>
+    void parallel_for(size_type begin, size_type end, _Function && fn, size_type grain = 1)
+    {
+        if (begin >= end)
+        {
+            return;
+        }
+
+        grain = std::max<size_type>(grain, 1);
+
+        if (m_threads.empty() || (end - begin) <= grain)
+        {
+            for (size_type idx{begin}; idx < end; ++idx)
+            {
+                fn(idx);
+            }
+            return;
+        }
+
+        std::atomic<size_type> next(begin);
+
+        run_on_workers([&next, end, grain, &fn](const size_type)
+        {
+            try
+            {
+                for (size_type lo = next.fetch_add(grain); lo < end; lo = next.fetch_add(grain))
+                {
+                    const size_type hi = std::min(lo + grain, end);
+
+                    for (size_type idx{lo}; idx < hi; ++idx)
+                    {
+                        fn(idx);
+                    }
+                }
+            }
+            catch (...)
+            {
+                // the other workers stop at their next chunk
+                next = end;
+                throw;
+            }
+        });
+    }
+
+    // calls fn(worker) once on every worker and waits for all of them
+    template<typename _Function>
+    void run_on_workers(_Function && fn)
+    {
+        if (m_threads.empty())
+        {
+            fn(size_type(0));
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_job = fn;
+            m_busy = m_threads.size();
+            m_error = nullptr;
+            ++m_generation;
+        }
+        m_wake.notify_all();
+
+        try
+        {
+            fn(size_type(0));
+        }
+        catch (...)
+        {
+            keep_error(std::current_exception());
+        }
+
+        std::exception_ptr error;
+
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_done.wait(lock, [this]{ return m_busy == 0; });
+            m_job = nullptr;
+            std::swap(error, m_error);
+        }
+
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    void keep_error(std::exception_ptr error)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (!m_error)
+        {
+            m_error = error;
+        }
+    }
+
+    void run(const size_type worker)
+    {
+        size_type seen_generation{0};
+
+        while (true)
+        {
+            std::function<void(size_type)> job;
+
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wake.wait(lock, [this, seen_generation]{ return m_quit || m_generation != seen_generation; });
+
+                if (m_quit)
+                {
+                    return;
+                }
+
+                seen_generation = m_generation;
+                job = m_job;
+            }
+
+            try
+            {
+                job(worker);
+            }
+            catch (...)
+            {
+                keep_error(std::current_exception());
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                --m_busy;
+            }
+            m_done.notify_one();
+        }
+    }
+
+private:
+    const size_type m_n_workers;
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    std::function<void(size_type)> m_job;
+    std::exception_ptr m_error;
+    size_type m_generation;
+    size_type m_busy;
+    bool m_quit;
+};
+
+#endif /* PARALLEL_HPP_ */
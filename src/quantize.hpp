@@ -0,0 +1,109 @@
+/*******************************************************************************
+ * Copyright (c) 2015 Wojciech Migda
+ * All rights reserved
+ * Distributed under the terms of the GNU LGPL v3
+ *******************************************************************************
+ *
+ * Filename: quantize.hpp
+ *
+ * Description:
+ *      Quantization of [0, 1] similarities into threshold buckets
+ *
+ * Authors:
+ *          Wojciech Migda (wm)
+ *
+ *******************************************************************************
+ * History:
+ * --------
+ * Date         Who  Ticket     Description
+ * ----------   ---  ---------  ------------------------------------------------
+ * 2026-10-17   wm              Initial version
+ *
+ ******************************************************************************/
+
+#ifndef QUANTIZE_HPP_
+#define QUANTIZE_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+
+/*
+ * Maps a similarity onto one of _N evenly spaced buckets over [0, 1],
+ * rounding to the nearest one and clamping values outside the range.
+ */
+template<typename _ValueType, std::size_t _N>
+struct SimilarityQuantizer
+{
+    typedef std::size_t size_type;
+    typedef _ValueType value_type;
+
+    static constexpr size_type N{_N};
+
+    static inline
+    size_type indexFor(const value_type & similarity)
+    {
+        if (similarity <= 0.0)
+        {
+            return 0;
+        }
+        else if (similarity >= 1.0)
+        {
+            return N - 1;
+        }
+        else
+        {
+            return round(similarity * (N - 1));
+        }
+    }
+
+    static inline
+    value_type valueFor(const size_type index)
+    {
+        return (value_type)index / (N - 1);
+    }
+};
+
+/*
+ * Element type used to store a similarity. Doubles are kept as they are,
+ * bytes hold the bucket index from SimilarityQuantizer and decode to the
+ * bucket centre.
+ */
+template<typename _Type>
+struct SimilarityCodec;
+
+template<>
+struct SimilarityCodec<double>
+{
+    static inline
+    double encode(const double & similarity)
+    {
+        return similarity;
+    }
+
+    static inline
+    double decode(const double & similarity)
+    {
+        return similarity;
+    }
+};
+
+template<>
+struct SimilarityCodec<std::uint8_t>
+{
+    typedef SimilarityQuantizer<double, 101> quantizer_type;
+
+    static inline
+    std::uint8_t encode(const double & similarity)
+    {
+        return quantizer_type::indexFor(similarity);
+    }
+
+    static inline
+    double decode(const std::uint8_t & code)
+    {
+        return quantizer_type::valueFor(code);
+    }
+};
+
+#endif /* QUANTIZE_HPP_ */
@@ -0,0 +1,299 @@
+/*******************************************************************************
+ * Copyright (c) 2015 Wojciech Migda
+ * All rights reserved
+ * Distributed under the terms of the GNU LGPL v3
+ *******************************************************************************
+ *
+ * Filename: rank_server.hpp
+ *
+ * Description:
+ *      Framed request protocol of the long running ranking server
+ *
+ * Authors:
+ *          Wojciech Migda (wm)
+ *
+ *******************************************************************************
+ * History:
+ * --------
+ * Date         Who  Ticket     Description
+ * ----------   ---  ---------  ------------------------------------------------
+ * 2026-10-17   wm              Initial version
+ *
+ ******************************************************************************/
+
+#ifndef RANK_SERVER_HPP_
+#define RANK_SERVER_HPP_
+
+#include "incremental_ranker.hpp"
+#include "number_parser.hpp"
+
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sstream>
+
+/*
+ * Every message, in both directions, is a frame: a 32-bit payload length
+ * in network byte order followed by the payload. Payloads are text, the
+ * first line being the command or the status:
+ *
+ *   RANK                               -> OK, then one test index per line
+ *   ADD_TRAINING\n<molecule>\n<sims>   -> OK
+ *   ADD_TESTING\n<molecule>\n<sims>    -> OK
+ *   REFIT                              -> OK
+ *   INFO                               -> OK\nX Y
+ *   SHUTDOWN                           -> OK, the server then exits
+ *
+ * <sims> are the whitespace separated similarities of the new molecule as
+ * expected by IncrementalRanker::addTraining/addTesting. Failed requests
+ * are answered with ERROR and a message on the second line.
+ */
+struct FrameChannel
+{
+    typedef std::uint32_t length_type;
+
+    static constexpr length_type MAX_FRAME_SIZE{length_type(1) << 30};
+
+    FrameChannel(int in_fd, int out_fd)
+    :
+        m_in_fd(in_fd),
+        m_out_fd(out_fd)
+    {
+    }
+
+    // false on end of stream, error or an oversized frame
+    bool read(std::string & payload)
+    {
+        length_type length{0};
+
+        if (!read_fully(&length, sizeof (length)))
+        {
+            return false;
+        }
+
+        length = ntohl(length);
+
+        if (length > MAX_FRAME_SIZE)
+        {
+            return false;
+        }
+
+        payload.resize(length);
+
+        return length == 0 || read_fully(&payload[0], length);
+    }
+
+    bool write(const std::string & payload)
+    {
+        const length_type length = htonl(payload.size());
+
+        return write_fully(&length, sizeof (length)) && write_fully(payload.data(), payload.size());
+    }
+
+private:
+    bool read_fully(void * buffer, std::size_t size)
+    {
+        char * pos = static_cast<char *>(buffer);
+
+        while (size != 0)
+        {
+            const ssize_t n_read = ::read(m_in_fd, pos, size);
+
+            if (n_read < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            else if (n_read <= 0)
+            {
+                return false;
+            }
+
+            pos += n_read;
+            size -= n_read;
+        }
+
+        return true;
+    }
+
+    bool write_fully(const void * buffer, std::size_t size)
+    {
+        const char * pos = static_cast<const char *>(buffer);
+
+        while (size != 0)
+        {
+            const ssize_t n_written = ::write(m_out_fd, pos, size);
+
+            if (n_written < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            else if (n_written <= 0)
+            {
+                return false;
+            }
+
+            pos += n_written;
+            size -= n_written;
+        }
+
+        return true;
+    }
+
+private:
+    const int m_in_fd;
+    const int m_out_fd;
+};
+
+/*
+ * Answers requests against an IncrementalRanker which stays resident
+ * between them, so a RANK costs only the scoring of the test molecules.
+ */
+struct RankServer
+{
+    typedef std::size_t size_type;
+
+    explicit RankServer(IncrementalRanker & ranker)
+    :
+        m_ranker(ranker),
+        m_shutdown(false)
+    {
+    }
+
+    // serves requests until the peer disconnects or SHUTDOWN arrives
+    void serve(FrameChannel & channel)
+    {
+        std::string request;
+
+        while (!m_shutdown && channel.read(request))
+        {
+            if (!channel.write(handle(request)))
+            {
+                break;
+            }
+        }
+    }
+
+    std::string handle(const std::string & request)
+    {
+        const size_type command_end = std::min(request.find('\n'), request.size());
+        const std::string command = request.substr(0, command_end);
+        const char * body = request.data() + std::min(command_end + 1, request.size());
+        const char * end = request.data() + request.size();
+
+        if (command == "RANK")
+        {
+            std::ostringstream response;
+
+            response << "OK\n";
+
+            for (const int index : m_ranker.rank())
+            {
+                response << index << '\n';
+            }
+
+            return response.str();
+        }
+        else if (command == "ADD_TRAINING" || command == "ADD_TESTING")
+        {
+            const bool training = command == "ADD_TRAINING";
+            const size_type expected =
+                m_ranker.trainingSize() + (training ? m_ranker.testingSize() : 0);
+
+            std::string molecule;
+            std::vector<double> similarities;
+
+            if (!parse_addition(body, end, expected, molecule, similarities))
+            {
+                std::ostringstream response;
+
+                response << "ERROR\nexpected a molecule line and " << expected << " similarities";
+
+                return response.str();
+            }
+
+            if (training)
+            {
+                m_ranker.addTraining(molecule, similarities.data());
+            }
+            else
+            {
+                m_ranker.addTesting(molecule, similarities.data());
+            }
+
+            return "OK\n";
+        }
+        else if (command == "REFIT")
+        {
+            m_ranker.refit();
+
+            return "OK\n";
+        }
+        else if (command == "INFO")
+        {
+            std::ostringstream response;
+
+            response << "OK\n" << m_ranker.trainingSize() << ' ' << m_ranker.testingSize() << '\n';
+
+            return response.str();
+        }
+        else if (command == "SHUTDOWN")
+        {
+            m_shutdown = true;
+
+            return "OK\n";
+        }
+        else
+        {
+            return "ERROR\nunknown command " + command;
+        }
+    }
+
+    bool stopped() const
+    {
+        return m_shutdown;
+    }
+
+private:
+    static bool parse_addition(
+        const char * pos,
+        const char * end,
+        const size_type expected,
+        std::string & molecule,
+        std::vector<double> & similarities)
+    {
+        const char * eol = std::find(pos, end, '\n');
+
+        molecule.assign(pos, eol);
+
+        if (molecule.empty() || eol == end)
+        {
+            return false;
+        }
+
+        similarities.resize(expected);
+        pos = skip_spaces(eol + 1, end);
+
+        for (size_type idx{0}; idx < expected; ++idx)
+        {
+            if (pos == end)
+            {
+                return false;
+            }
+
+            pos = skip_spaces(skip_token(parse_double(pos, end, similarities[idx]), end), end);
+        }
+
+        return pos == end;
+    }
+
+private:
+    IncrementalRanker & m_ranker;
+    bool m_shutdown;
+};
+
+#endif /* RANK_SERVER_HPP_ */
@@ -0,0 +1,405 @@
+/*******************************************************************************
+ * Copyright (c) 2015 Wojciech Migda
+ * All rights reserved
+ * Distributed under the terms of the GNU LGPL v3
+ *******************************************************************************
+ *
+ * Filename: sampled_cp.hpp
+ *
+ * Description:
+ *      CP/CPsim estimated from random pair samples, with error bounds
+ *
+ * Authors:
+ *          Wojciech Migda (wm)
+ *
+ *******************************************************************************
+ * History:
+ * --------
+ * Date         Who  Ticket     Description
+ * ----------   ---  ---------  ------------------------------------------------
+ * 2026-10-17   wm              Initial version
+ *
+ ******************************************************************************/
+
+#ifndef SAMPLED_CP_HPP_
+#define SAMPLED_CP_HPP_
+
+#include "CP.hpp"
+#include "quantize.hpp"
+#include "instrument.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <random>
+#include <vector>
+#include <valarray>
+#include <memory>
+#include <algorithm>
+
+/*
+ * CP values are fractions of agreeing pairs among the pairs passing a
+ * threshold. Instead of enumerating all N (N - 1) / 2 pairs the estimators
+ * below draw unordered pairs uniformly at random, with replacement, in
+ * rounds of ROUND pairs. They stop once `budget` pairs have been drawn or,
+ * with a non-zero `target_error`, as soon as the confidence interval
+ * half-width of every estimate is within the target. When the budget
+ * covers all pairs the exact enumeration is used instead.
+ *
+ * Errors are normal approximation half-widths z * sqrt(p (1 - p) / n),
+ * n being the number of sampled pairs passing the threshold. p is Laplace
+ * smoothed, so that estimates of 0 or 1 from few pairs do not claim to be
+ * exact. Estimates with no pairs at all are 0 with an error of 1.
+ */
+struct SamplingOptions
+{
+    SamplingOptions()
+    :
+        budget(1 << 20),
+        target_error(0.0),
+        z(1.96),
+        min_pairs(30),
+        seed(1)
+    {
+    }
+
+    // most pairs drawn per estimate
+    std::size_t budget;
+    // stop early when all half-widths are within this, 0 uses the budget
+    double target_error;
+    // 1.96 for 95% confidence intervals
+    double z;
+    // curve buckets hit by fewer sampled pairs do not hold up early stopping
+    std::size_t min_pairs;
+    std::uint64_t seed;
+};
+
+template<typename _ValueType>
+struct CPEstimate
+{
+    _ValueType value;
+    _ValueType error;
+    // sampled pairs passing the threshold, or all such pairs when exact
+    std::size_t pairs;
+    bool exact;
+};
+
+/*
+ * Uniform random unordered pairs i < j of N items.
+ */
+struct PairSampler
+{
+    typedef std::size_t size_type;
+
+    static constexpr size_type ROUND{4096};
+
+    PairSampler(const size_type N, const std::uint64_t seed)
+    :
+        m_engine(seed),
+        m_first(0, N - 1),
+        m_second(0, N - 2)
+    {
+    }
+
+    static size_type total_pairs(const size_type N)
+    {
+        return N * (N - 1) / 2;
+    }
+
+    template<typename _PairFunction>
+    void draw(const size_type n_pairs, _PairFunction && fn)
+    {
+        for (size_type idx{0}; idx < n_pairs; ++idx)
+        {
+            const size_type first = m_first(m_engine);
+            size_type second = m_second(m_engine);
+
+            second += second >= first;
+
+            fn(std::min(first, second), std::max(first, second));
+        }
+    }
+
+private:
+    std::mt19937_64 m_engine;
+    std::uniform_int_distribution<size_type> m_first;
+    std::uniform_int_distribution<size_type> m_second;
+};
+
+template<typename _ValueType>
+_ValueType cp_error(const std::size_t numerator, const std::size_t denominator, const _ValueType z)
+{
+    if (denominator == 0)
+    {
+        return 1.0;
+    }
+
+    const _ValueType p = (numerator + 1.0) / (denominator + 2.0);
+
+    return z * std::sqrt(p * (1.0 - p) / denominator);
+}
+
+/*
+ * Draws rounds of pairs, handing each to `fn`, while `more()` holds and
+ * the budget lasts.
+ */
+template<typename _PairFunction, typename _Predicate>
+std::size_t sample_pairs(
+    const std::size_t N,
+    const SamplingOptions & options,
+    _PairFunction && fn,
+    _Predicate && more)
+{
+    PairSampler sampler(N, options.seed);
+    std::size_t drawn{0};
+
+    while (drawn < options.budget && (drawn == 0 || more()))
+    {
+        // std::min takes references, which ROUND, lacking a definition, cannot bind
+        const std::size_t n_pairs = std::min<std::size_t>(+PairSampler::ROUND, options.budget - drawn);
+
+        sampler.draw(n_pairs, fn);
+        drawn += n_pairs;
+    }
+
+    AM_COUNT(PAIRS_VISITED, drawn);
+
+    return drawn;
+}
+
+template<typename _ValueType>
+CPEstimate<_ValueType> make_estimate(const PairCounts & counts, const SamplingOptions & options, const bool exact)
+{
+    const _ValueType value = counts.denominator != 0 ? (_ValueType)counts.numerator / counts.denominator : 0.0;
+    const _ValueType error = exact ? 0.0 : cp_error<_ValueType>(counts.numerator, counts.denominator, options.z);
+
+    return CPEstimate<_ValueType>{value, error, counts.denominator, exact};
+}
+
+template<typename _ValueType, typename _Compare>
+CPEstimate<_ValueType> CP_sampled(
+    const _ValueType distance,
+    const _ValueType activity_thr_A_star,
+    const std::valarray<_ValueType> & distances,
+    const std::valarray<_ValueType> & activities,
+    _Compare compare,
+    const SamplingOptions & options
+    )
+{
+    const std::size_t N = activities.size();
+
+    if (N < 2 || PairSampler::total_pairs(N) <= options.budget)
+    {
+        const _ValueType value = CP(distance, activity_thr_A_star, distances, activities, compare);
+
+        return CPEstimate<_ValueType>{value, 0.0, PairSampler::total_pairs(N), true};
+    }
+
+    PairCounts counts{0, 0};
+
+    sample_pairs(N, options,
+        [&](const std::size_t iidx, const std::size_t jidx)
+        {
+            if (compare(distances[iidx] - distances[jidx], distance))
+            {
+                ++counts.denominator;
+                counts.numerator += fabs(activities[iidx] - activities[jidx]) <= activity_thr_A_star;
+            }
+        },
+        [&]()
+        {
+            return options.target_error == 0.0 ||
+                cp_error<_ValueType>(counts.numerator, counts.denominator, options.z) > options.target_error;
+        }
+    );
+
+    return make_estimate<_ValueType>(counts, options, false);
+}
+
+template<typename _ValueType, typename _MatrixType>
+CPEstimate<_ValueType> CPsim_sampled(
+    const _ValueType distance,
+    const _ValueType activity_thr_A_star,
+    const std::unique_ptr<_MatrixType> & similarities,
+    const std::valarray<_ValueType> & activities,
+    const SamplingOptions & options
+    )
+{
+    typedef typename _MatrixType::value_type element_type;
+
+    const std::size_t N = activities.size();
+
+    if (N < 2 || PairSampler::total_pairs(N) <= options.budget)
+    {
+        const _ValueType value = CPsim(distance, activity_thr_A_star, similarities, activities);
+
+        return CPEstimate<_ValueType>{value, 0.0, PairSampler::total_pairs(N), true};
+    }
+
+    const element_type threshold = SimilarityCodec<element_type>::encode(distance);
+
+    PairCounts counts{0, 0};
+
+    AM_COUNT(CPSIM_CALLS, 1);
+
+    sample_pairs(N, options,
+        [&](const std::size_t iidx, const std::size_t jidx)
+        {
+            if (similarities->upper_row_cbegin(iidx)[jidx] >= threshold)
+            {
+                ++counts.denominator;
+                counts.numerator += fabs(activities[iidx] - activities[jidx]) <= activity_thr_A_star;
+            }
+        },
+        [&]()
+        {
+            return options.target_error == 0.0 ||
+                cp_error<_ValueType>(counts.numerator, counts.denominator, options.z) > options.target_error;
+        }
+    );
+
+    return make_estimate<_ValueType>(counts, options, false);
+}
+
+/*
+ * CPsimCurve built from a histogram of sampled pairs, with the error of
+ * the CP value of every bucket. curve() plugs into APSsim as it is.
+ */
+template<typename _ValueType, std::size_t _N>
+struct SampledCPsimCurve
+{
+    typedef std::size_t size_type;
+    typedef _ValueType value_type;
+    typedef CPsimCurve<_ValueType, _N> curve_type;
+    typedef typename curve_type::histogram_type histogram_type;
+
+    static constexpr size_type N{_N};
+
+    template<typename _MatrixType>
+    SampledCPsimCurve(
+        const _ValueType activity_thr_A_star,
+        const std::unique_ptr<_MatrixType> & similarities,
+        const std::valarray<_ValueType> & activities,
+        const SamplingOptions & options)
+    :
+        m_curve(histogram_type()),
+        m_errors(N, 0.0),
+        m_pairs(N, 0),
+        m_drawn(0),
+        m_exact(false)
+    {
+        const size_type NA = activities.size();
+
+        histogram_type histogram;
+
+        auto add_pair = [&](const size_type iidx, const size_type jidx)
+        {
+            const bool Delta_A_i_j_LE_A_star = fabs(activities[iidx] - activities[jidx]) <= activity_thr_A_star;
+
+            histogram.add(m_curve.indexFor(similarities->upper_row_cbegin(iidx)[jidx]), Delta_A_i_j_LE_A_star);
+        };
+
+        if (NA < 2 || PairSampler::total_pairs(NA) <= options.budget)
+        {
+            AM_COUNT(PAIRS_VISITED, PairSampler::total_pairs(NA));
+
+            for (size_type iidx{0}; iidx < NA; ++iidx)
+            {
+                for (size_type jidx{iidx + 1}; jidx < NA; ++jidx)
+                {
+                    add_pair(iidx, jidx);
+                }
+            }
+
+            m_drawn = PairSampler::total_pairs(NA);
+            m_exact = true;
+        }
+        else
+        {
+            m_drawn = sample_pairs(NA, options, add_pair,
+                [&]()
+                {
+                    return options.target_error == 0.0 || max_error(histogram, options) > options.target_error;
+                }
+            );
+        }
+
+        m_curve = curve_type(histogram);
+
+        size_type numerator{0};
+        size_type denominator{0};
+
+        for (size_type bucket{N}; bucket-- > 0;)
+        {
+            numerator += histogram.numerator(bucket);
+            denominator += histogram.denominator(bucket);
+
+            m_errors[bucket] = m_exact ? 0.0 : cp_error<value_type>(numerator, denominator, options.z);
+            m_pairs[bucket] = denominator;
+        }
+    }
+
+    const curve_type & curve() const
+    {
+        return m_curve;
+    }
+
+    template<typename _SimilarityType>
+    value_type at(const _SimilarityType & similarity) const
+    {
+        return m_curve.at(similarity);
+    }
+
+    template<typename _SimilarityType>
+    value_type error_at(const _SimilarityType & similarity) const
+    {
+        return m_errors[m_curve.indexFor(similarity)];
+    }
+
+    template<typename _SimilarityType>
+    size_type pairs_at(const _SimilarityType & similarity) const
+    {
+        return m_pairs[m_curve.indexFor(similarity)];
+    }
+
+    // pairs drawn, or all pairs when exact
+    size_type drawn() const
+    {
+        return m_drawn;
+    }
+
+    bool exact() const
+    {
+        return m_exact;
+    }
+
+private:
+    static value_type max_error(const histogram_type & histogram, const SamplingOptions & options)
+    {
+        size_type numerator{0};
+        size_type denominator{0};
+        value_type result{0.0};
+
+        for (size_type bucket{N}; bucket-- > 0;)
+        {
+            numerator += histogram.numerator(bucket);
+            denominator += histogram.denominator(bucket);
+
+            if (denominator >= options.min_pairs)
+            {
+                result = std::max(result, cp_error<value_type>(numerator, denominator, options.z));
+            }
+        }
+
+        return result;
+    }
+
+private:
+    curve_type m_curve;
+    std::vector<value_type> m_errors;
+    std::vector<size_type> m_pairs;
+    size_type m_drawn;
+    bool m_exact;
+};
+
+#endif /* SAMPLED_CP_HPP_ */
@@ -0,0 +1,432 @@
+/*******************************************************************************
+ * Copyright (c) 2015 Wojciech Migda
+ * All rights reserved
+ * Distributed under the terms of the GNU LGPL v3
+ *******************************************************************************
+ *
+ * Filename: server.cpp
+ *
+ * Description:
+ *      Long running ranking server over stdin/stdout or a Unix socket
+ *
+ * Authors:
+ *          Wojciech Migda (wm)
+ *
+ *******************************************************************************
+ * History:
+ * --------
+ * Date         Who  Ticket     Description
+ * ----------   ---  ---------  ------------------------------------------------
+ * 2026-10-17   wm              Initial version
+ *
+ ******************************************************************************/
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include <csignal>
+#include <cerrno>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "incremental_ranker.hpp"
+#include "rank_server.hpp"
+#include "text_input.hpp"
+#include "binary_matrix.hpp"
+
+namespace
+{
+
+template<typename _Type, typename _Visitor>
+bool visit_mapped(const MappedBinaryMatrix & mapped, _Visitor & visit)
+{
+    std::vector<std::string> training_data;
+    std::vector<std::string> testing_data;
+
+    if (!mapped.molecules(training_data, testing_data))
+    {
+        return false;
+    }
+
+    if (mapped.header().layout == BinaryMatrixHeader::PACKED_UPPER)
+    {
+        visit(training_data, testing_data, mapped.packed<_Type>());
+    }
+    else
+    {
+        visit(training_data, testing_data, mapped.dense<_Type>());
+    }
+
+    return true;
+}
+
+/*
+ * Loads the dataset at `path` and calls visit(training_data, testing_data,
+ * similarities). Binary datasets (see convert) are mapped, anything else
+ * is read as text.
+ */
+template<typename _Visitor>
+bool visit_dataset(const char * path, const std::size_t n_workers, _Visitor && visit)
+{
+    MappedBinaryMatrix mapped;
+
+    if (mapped.open(path))
+    {
+        return
+            mapped.header().dtype == BinaryMatrixHeader::U8 ?
+                visit_mapped<std::uint8_t>(mapped, visit)
+                :
+                visit_mapped<double>(mapped, visit);
+    }
+
+    std::FILE * stream = std::fopen(path, "rb");
+
+    if (stream == nullptr)
+    {
+        return false;
+    }
+
+    BlockReader reader(stream);
+    ThreadPool thread_pool(n_workers);
+
+    std::size_t X{0};
+    std::size_t Y{0};
+
+    reader.next_integer(X);
+    reader.next_integer(Y);
+
+    // the ranker keeps only bucket codes, so the bytes are enough
+    SimilaritiesInputPlaceholder similarities;
+
+    similarities.setQuantized(true);
+    similarities.allocate(X + Y);
+
+    const bool complete = read_similarity_rows(reader, X + Y, thread_pool,
+        [&similarities](const std::size_t i, const double * cbegin, const double * cend)
+        {
+            similarities.takeFrom(i, cbegin, cend);
+        }
+    );
+
+    if (!complete)
+    {
+        std::fclose(stream);
+        return false;
+    }
+
+    std::vector<std::string> training_data(X);
+    std::vector<std::string> testing_data(Y);
+
+    for (auto & molecule : training_data)
+    {
+        reader.next_token(molecule);
+    }
+
+    for (auto & molecule : testing_data)
+    {
+        reader.next_token(molecule);
+    }
+
+    std::fclose(stream);
+
+    visit(training_data, testing_data, similarities.render<std::uint8_t>());
+
+    return true;
+}
+
+struct FitVisitor
+{
+    IncrementalRanker & ranker;
+
+    template<typename _MatrixType>
+    void operator()(
+        std::vector<std::string> & training_data,
+        std::vector<std::string> & testing_data,
+        const std::unique_ptr<_MatrixType> & similarities)
+    {
+        ranker.fit(training_data, testing_data, similarities);
+    }
+};
+
+/*
+ * The leading molecules of each set and their similarities, indexed as a
+ * dataset of its own, as fit() takes them: training molecules first, then
+ * test molecules.
+ */
+template<typename _MatrixType>
+struct LeadingMolecules
+{
+    typedef std::size_t size_type;
+    typedef typename _MatrixType::value_type value_type;
+
+    LeadingMolecules(const _MatrixType & matrix, const size_type X, const size_type n_training)
+    :
+        m_matrix(matrix),
+        m_X(X),
+        m_n_training(n_training)
+    {
+    }
+
+    value_type at(const size_type row, const size_type col) const
+    {
+        return m_matrix.at(index(row), index(col));
+    }
+
+private:
+    size_type index(const size_type idx) const
+    {
+        return idx < m_n_training ? idx : m_X + idx - m_n_training;
+    }
+
+private:
+    const _MatrixType & m_matrix;
+    const size_type m_X;
+    const size_type m_n_training;
+};
+
+/*
+ * Fits an IncrementalRanker with the last `n_held` training and test
+ * molecules held back, adds them back as ADD_TRAINING and ADD_TESTING
+ * would, refits and checks that the ranking equals that of
+ * ActiveMolecules::rank over the whole dataset.
+ */
+struct VerifyVisitor
+{
+    const RankOptions & options;
+    const std::size_t n_held;
+    bool & equal;
+
+    template<typename _MatrixType>
+    void operator()(
+        std::vector<std::string> & training_data,
+        std::vector<std::string> & testing_data,
+        const std::unique_ptr<_MatrixType> & similarities)
+    {
+        typedef std::size_t size_type;
+        typedef SimilarityCodec<typename _MatrixType::value_type> codec_type;
+        typedef LeadingMolecules<_MatrixType> leading_type;
+
+        const size_type X = training_data.size();
+        const size_type Y = testing_data.size();
+        // fit() needs two training molecules for a spread, rank() a test one
+        const size_type X0 = X - std::min(n_held, X - std::min<size_type>(X, 2));
+        const size_type Y0 = Y - std::min(n_held, Y - std::min<size_type>(Y, 1));
+
+        IncrementalRanker ranker(options);
+
+        ranker.fit(
+            std::vector<std::string>(training_data.cbegin(), training_data.cbegin() + X0),
+            std::vector<std::string>(testing_data.cbegin(), testing_data.cbegin() + Y0),
+            std::unique_ptr<leading_type>(new leading_type(*similarities, X, X0)));
+
+        std::vector<double> row;
+
+        for (size_type xidx{X0}; xidx < X; ++xidx)
+        {
+            row.clear();
+
+            for (size_type iidx{0}; iidx < xidx; ++iidx)
+            {
+                row.push_back(codec_type::decode(similarities->at(iidx, xidx)));
+            }
+            for (size_type yidx{0}; yidx < Y0; ++yidx)
+            {
+                row.push_back(codec_type::decode(similarities->at(xidx, X + yidx)));
+            }
+
+            ranker.addTraining(training_data[xidx], row.data());
+        }
+
+        for (size_type yidx{Y0}; yidx < Y; ++yidx)
+        {
+            row.clear();
+
+            for (size_type iidx{0}; iidx < X; ++iidx)
+            {
+                row.push_back(codec_type::decode(similarities->at(iidx, X + yidx)));
+            }
+
+            ranker.addTesting(testing_data[yidx], row.data());
+        }
+
+        ranker.refit();
+
+        equal = ranker.rank() == ActiveMolecules(options).rank(training_data, testing_data, similarities);
+    }
+};
+
+/*
+ * Removes what a previous server left at `path`, i.e. only a socket, so
+ * that a mistyped --socket does not take a regular file with it. Returns
+ * false when something else is in the way.
+ */
+bool remove_socket(const char * path)
+{
+    struct stat st;
+
+    if (lstat(path, &st) != 0)
+    {
+        return errno == ENOENT;
+    }
+
+    return S_ISSOCK(st.st_mode) && unlink(path) == 0;
+}
+
+int listen_on(const char * path)
+{
+    sockaddr_un address;
+
+    if (std::strlen(path) >= sizeof (address.sun_path))
+    {
+        return -1;
+    }
+
+    std::memset(&address, 0, sizeof (address));
+    address.sun_family = AF_UNIX;
+    std::strcpy(address.sun_path, path);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    if (!remove_socket(path))
+    {
+        close(fd);
+        return -1;
+    }
+
+    if (bind(fd, reinterpret_cast<const sockaddr *>(&address), sizeof (address)) != 0 || listen(fd, 8) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+}
+
+int main(int argc, char ** argv)
+{
+    RankOptions options;
+    const char * socket_path = nullptr;
+    const char * dataset_path = nullptr;
+    std::size_t n_verify{0};
+
+    for (int iarg = 1; iarg < argc; ++iarg)
+    {
+        if ((!strcmp(argv[iarg], "-j") || !strcmp(argv[iarg], "--workers")) && (iarg + 1 < argc))
+        {
+            options.n_workers = std::strtoul(argv[++iarg], nullptr, 10);
+        }
+        else if (!strcmp(argv[iarg], "--socket") && (iarg + 1 < argc))
+        {
+            socket_path = argv[++iarg];
+        }
+        else if (!strcmp(argv[iarg], "--activity-threshold") && (iarg + 1 < argc))
+        {
+            options.activity_thr_A_star = std::strtod(argv[++iarg], nullptr);
+        }
+        else if (!strcmp(argv[iarg], "--verify") && (iarg + 1 < argc))
+        {
+            n_verify = std::strtoul(argv[++iarg], nullptr, 10);
+        }
+        else if (dataset_path == nullptr && argv[iarg][0] != '-')
+        {
+            dataset_path = argv[iarg];
+        }
+        else
+        {
+            dataset_path = nullptr;
+            break;
+        }
+    }
+
+    if (dataset_path == nullptr)
+    {
+        std::cerr << "Usage: " << argv[0] << " [-j|--workers N] [--activity-threshold A]"
+            << " [--socket path | --verify N] dataset" << std::endl;
+        return 1;
+    }
+
+    // ranks with N molecules of each set added incrementally against a full rank
+    if (n_verify != 0)
+    {
+        bool equal{false};
+
+        if (!visit_dataset(dataset_path, options.n_workers, VerifyVisitor{options, n_verify, equal}))
+        {
+            std::cerr << "Cannot load dataset " << dataset_path << std::endl;
+            return 1;
+        }
+
+        std::cout << (equal ? "OK" : "MISMATCH") << std::endl;
+
+        return equal ? 0 : 1;
+    }
+
+    IncrementalRanker ranker(options);
+
+    if (!visit_dataset(dataset_path, options.n_workers, FitVisitor{ranker}))
+    {
+        std::cerr << "Cannot load dataset " << dataset_path << std::endl;
+        return 1;
+    }
+
+    RankServer server(ranker);
+
+    if (socket_path == nullptr)
+    {
+        FrameChannel channel(STDIN_FILENO, STDOUT_FILENO);
+
+        server.serve(channel);
+
+        return 0;
+    }
+
+    // a client going away mid-response must not take the server down
+    std::signal(SIGPIPE, SIG_IGN);
+
+    const int listen_fd = listen_on(socket_path);
+
+    if (listen_fd < 0)
+    {
+        std::cerr << "Cannot listen on " << socket_path << std::endl;
+        return 1;
+    }
+
+    while (!server.stopped())
+    {
+        const int fd = accept(listen_fd, nullptr, nullptr);
+
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            break;
+        }
+
+        FrameChannel channel(fd, fd);
+
+        server.serve(channel);
+        close(fd);
+    }
+
+    close(listen_fd);
+    remove_socket(socket_path);
+
+    return 0;
+}
@@ -0,0 +1,349 @@
+/*******************************************************************************
+ * Copyright (c) 2015 Wojciech Migda
+ * All rights reserved
+ * Distributed under the terms of the GNU LGPL v3
+ *******************************************************************************
+ *
+ * Filename: sharded_ranker.hpp
+ *
+ * Description:
+ *      Test molecules scored in forked worker processes over shared memory
+ *
+ * Authors:
+ *          Wojciech Migda (wm)
+ *
+ *******************************************************************************
+ * History:
+ * --------
+ * Date         Who  Ticket     Description
+ * ----------   ---  ---------  ------------------------------------------------
+ * 2026-10-17   wm              Initial version
+ *
+ ******************************************************************************/
+
+#ifndef SHARDED_RANKER_HPP_
+#define SHARDED_RANKER_HPP_
+
+#include "symmetric_matrix.hpp"
+#include "jaccard_matrix.hpp"
+#include "CP.hpp"
+#include "quantize.hpp"
+#include "parallel.hpp"
+#include "instrument.hpp"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <valarray>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+
+/*
+ * Read-write mapping of a fresh POSIX shared memory object. The name is
+ * unlinked as soon as the object is mapped, so it goes away with the last
+ * mapping, be it this process's or that of a child forked from it, and
+ * nothing is left behind by a crash.
+ */
+struct SharedMemorySegment
+{
+    typedef std::size_t size_type;
+
+    explicit SharedMemorySegment(const size_type size)
+    :
+        m_data(nullptr),
+        m_size(size)
+    {
+        static std::atomic<unsigned> sequence(0);
+
+        const std::string name =
+            "/am_shm_" + std::to_string(::getpid()) + "_" + std::to_string(sequence++);
+
+        const int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+
+        if (fd < 0)
+        {
+            return;
+        }
+
+        ::shm_unlink(name.c_str());
+
+        // mmap does not take empty mappings
+        if (::ftruncate(fd, std::max<size_type>(m_size, 1)) == 0)
+        {
+            void * data = ::mmap(nullptr, std::max<size_type>(m_size, 1), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+            m_data = data != MAP_FAILED ? data : nullptr;
+        }
+
+        ::close(fd);
+    }
+
+    SharedMemorySegment(const SharedMemorySegment &) = delete;
+    SharedMemorySegment & operator=(const SharedMemorySegment &) = delete;
+
+    ~SharedMemorySegment()
+    {
+        if (m_data != nullptr)
+        {
+            ::munmap(m_data, std::max<size_type>(m_size, 1));
+        }
+    }
+
+    bool good() const
+    {
+        return m_data != nullptr;
+    }
+
+    void * data() const
+    {
+        return m_data;
+    }
+
+    size_type size() const
+    {
+        return m_size;
+    }
+
+private:
+    void * m_data;
+    const size_type m_size;
+};
+
+/*
+ * Similarity trapezoid, packed as in SymmetricMatrix2d(n_row, n_col), in
+ * a SharedMemorySegment. It is filled from full matrix rows, as
+ * read_similarity_rows() delivers them, rows past the trapezoid being
+ * dropped, and read through a SymmetricMatrixView, so worker processes
+ * forked afterwards all read the one copy.
+ */
+template<typename _Type>
+struct SharedSimilarityMatrix
+{
+    typedef std::size_t size_type;
+    typedef _Type value_type;
+    typedef SymmetricMatrixView<value_type> view_type;
+
+    SharedSimilarityMatrix(const size_type n_row, const size_type n_col)
+    :
+        m_n_row(std::min(n_row, n_col)),
+        m_n_col(n_col),
+        m_segment(SymmetricMatrix2d<value_type>::packed_size(m_n_row, m_n_col) * sizeof (value_type))
+    {
+    }
+
+    bool good() const
+    {
+        return m_segment.good();
+    }
+
+    // `cbegin` .. `cend` is the full row `index` of the similarity matrix
+    void writeRow(const size_type index, const double * cbegin, const double * cend)
+    {
+        if (index >= m_n_row)
+        {
+            return;
+        }
+
+        value_type * row = static_cast<value_type *>(m_segment.data()) +
+            SymmetricMatrix2d<value_type>::packed_row_offset(m_n_col, index);
+
+        std::transform(cbegin + index, cbegin + std::min<size_type>(cend - cbegin, m_n_col), row + index,
+            SimilarityCodec<value_type>::encode);
+    }
+
+    std::unique_ptr<view_type> view() const
+    {
+        return std::unique_ptr<view_type>(
+            new view_type(static_cast<const value_type *>(m_segment.data()), m_n_row, m_n_col));
+    }
+
+private:
+    const size_type m_n_row;
+    const size_type m_n_col;
+    SharedMemorySegment m_segment;
+};
+
+/*
+ * Scorer for ActiveMolecules::rank_scored() which spreads the test
+ * molecules over `n_shards` forked worker processes. The Jaccard matrix
+ * and the CPsim curves need all training pairs, so the coordinator, i.e.
+ * the calling process, builds them up front with its thread pool. The
+ * workers then see them, and the similarity matrix, through the memory
+ * they share with the coordinator: copy-on-write pages they never write,
+ * or a shared mapping such as SharedSimilarityMatrix or a loaded binary
+ * file. Each worker scores a contiguous shard of the test molecules, as
+ * rank() does, into a shared score array and exits.
+ *
+ * A worker that dies or fails is replaced by a new one for its shard, up
+ * to `n_retries` times; a shard that fails to fork is scored by the
+ * coordinator. good() tells whether every shard got scored.
+ */
+template<typename _MatrixType>
+struct ShardedScorer
+{
+    typedef std::size_t size_type;
+
+    ShardedScorer(
+        const std::unique_ptr<_MatrixType> & similarities,
+        const double activity_thr_A_star,
+        const size_type n_shards,
+        const size_type n_retries = 1)
+    :
+        m_similarities(similarities),
+        m_activity_thr_A_star(activity_thr_A_star),
+        m_n_shards(std::max<size_type>(n_shards, 1)),
+        m_n_retries(n_retries),
+        m_good(true)
+    {
+    }
+
+    bool good() const
+    {
+        return m_good;
+    }
+
+    template<typename _MoleculeMatrixType>
+    void operator()(
+        const _MoleculeMatrixType & train_data,
+        const _MoleculeMatrixType & test_data,
+        const std::size_t n_features,
+        const std::valarray<double> & activities,
+        ThreadPool & thread_pool,
+        std::vector<double> & scores)
+    {
+        typedef typename _MatrixType::value_type similarity_type;
+
+        const size_type X = train_data.rows();
+        const size_type Y = scores.size();
+
+        AM_PHASE_SEQUENCE();
+        AM_NEXT_PHASE("jaccard_matrix");
+
+        const std::unique_ptr<SymmetricMatrix2d<similarity_type>> jaccards =
+            build_jaccard_matrix<similarity_type>(train_data, test_data, n_features, thread_pool);
+
+        AM_NEXT_PHASE("cpsim_curves");
+
+        const CPsimCurve<double, 101> similarities_curve(m_activity_thr_A_star, m_similarities, activities, thread_pool);
+        const CPsimCurve<double, 101> jaccards_curve(m_activity_thr_A_star, jaccards, activities, thread_pool);
+
+        AM_NEXT_PHASE("sharded_scoring");
+
+        SharedMemorySegment shared_scores(Y * sizeof (double));
+
+        if (!shared_scores.good())
+        {
+            m_good = false;
+            return;
+        }
+
+        double * out = static_cast<double *>(shared_scores.data());
+
+        auto score_shard = [&](const size_type shard)
+        {
+            for (size_type idx{Y * shard / m_n_shards}; idx < Y * (shard + 1) / m_n_shards; ++idx)
+            {
+                double score = APSsim(idx + X, similarities_curve, m_similarities, activities);
+
+                score += APSsim(idx + X, jaccards_curve, jaccards, activities);
+
+                out[idx] = score;
+            }
+        };
+
+        std::vector<pid_t> workers(m_n_shards);
+
+        for (size_type shard{0}; shard < m_n_shards; ++shard)
+        {
+            workers[shard] = spawn(shard, score_shard);
+        }
+
+        for (size_type shard{0}; shard < m_n_shards; ++shard)
+        {
+            size_type attempt{0};
+            bool scored{true};
+
+            while (!wait(workers[shard]))
+            {
+                if (attempt++ == m_n_retries)
+                {
+                    m_good = scored = false;
+                    break;
+                }
+
+                workers[shard] = spawn(shard, score_shard);
+            }
+
+            // a worker process's counts go away with it, two APSsim per molecule
+            if (scored && workers[shard] != 0)
+            {
+                AM_COUNT(CURVE_LOOKUPS, 2 * X * (Y * (shard + 1) / m_n_shards - Y * shard / m_n_shards));
+            }
+        }
+
+        std::copy(out, out + Y, scores.begin());
+    }
+
+private:
+    /*
+     * Runs fn(shard) in a child process, which leaves with _exit() so that
+     * none of the coordinator's atexit handlers or stdio buffers run twice.
+     * Runs it in place when fork fails, returning 0 for a worker that is
+     * already done.
+     */
+    template<typename _ShardFunction>
+    static pid_t spawn(const size_type shard, _ShardFunction & fn)
+    {
+        const pid_t pid = ::fork();
+
+        if (pid == 0)
+        {
+            fn(shard);
+            ::_exit(0);
+        }
+        else if (pid < 0)
+        {
+            fn(shard);
+            return 0;
+        }
+
+        return pid;
+    }
+
+    // true when the worker ran to completion
+    static bool wait(const pid_t pid)
+    {
+        if (pid == 0)
+        {
+            return true;
+        }
+
+        int status{0};
+        pid_t result;
+
+        do
+        {
+            result = ::waitpid(pid, &status, 0);
+        } while (result < 0 && errno == EINTR);
+
+        return result == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+
+private:
+    const std::unique_ptr<_MatrixType> & m_similarities;
+    const double m_activity_thr_A_star;
+    const size_type m_n_shards;
+    const size_type m_n_retries;
+    bool m_good;
+};
+
+#endif /* SHARDED_RANKER_HPP_ */
@@ -0,0 +1,779 @@
+/*******************************************************************************
+ * Copyright (c) 2015 Wojciech Migda
+ * All rights reserved
+ * Distributed under the terms of the GNU LGPL v3
+ *******************************************************************************
+ *
+ * Filename: simd.hpp
+ *
+ * Description:
+ *      Runtime-dispatched SSE2/AVX2/AVX-512 pair counting kernels
+ *
+ * Authors:
+ *          Wojciech Migda (wm)
+ *
+ *******************************************************************************
+ * History:
+ * --------
+ * Date         Who  Ticket     Description
+ * ----------   ---  ---------  ------------------------------------------------
+ * 2026-10-17   wm              Initial version
+ *
+ ******************************************************************************/
+
+#ifndef SIMD_HPP_
+#define SIMD_HPP_
+
+#include <immintrin.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+
+enum class SimdLevel
+{
+    SSE2,
+    AVX2,
+    AVX512
+};
+
+/*
+ * Picks the widest instruction set supported by the CPU. The AM_SIMD
+ * environment variable (sse2, avx2, avx512) can lower the choice, which
+ * is handy for comparing the variants on a single machine.
+ */
+inline
+SimdLevel detect_simd_level()
+{
+    __builtin_cpu_init();
+
+    SimdLevel level = SimdLevel::SSE2;
+
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        level = SimdLevel::AVX512;
+    }
+    else if (__builtin_cpu_supports("avx2"))
+    {
+        level = SimdLevel::AVX2;
+    }
+
+    const char * requested = std::getenv("AM_SIMD");
+
+    if (requested != nullptr)
+    {
+        if (!strcmp(requested, "sse2"))
+        {
+            level = SimdLevel::SSE2;
+        }
+        else if (!strcmp(requested, "avx2") && level != SimdLevel::SSE2)
+        {
+            level = SimdLevel::AVX2;
+        }
+    }
+
+    return level;
+}
+
+inline
+SimdLevel simd_level()
+{
+    static const SimdLevel level = detect_simd_level();
+
+    return level;
+}
+
+/*
+ * Comparators understood by the vector kernels. Each one provides the
+ * scalar predicate plus a lane mask for every supported register width.
+ */
+struct GreaterEqual
+{
+    bool operator()(const double & lhs, const double & rhs) const
+    {
+        return lhs >= rhs;
+    }
+
+    static inline int mask(__m128d lhs, __m128d rhs)
+    {
+        return _mm_movemask_pd(_mm_cmpge_pd(lhs, rhs));
+    }
+
+    __attribute__((target("avx2")))
+    static inline int mask(__m256d lhs, __m256d rhs)
+    {
+        return _mm256_movemask_pd(_mm256_cmp_pd(lhs, rhs, _CMP_GE_OQ));
+    }
+
+    __attribute__((target("avx512f")))
+    static inline int mask(__m512d lhs, __m512d rhs)
+    {
+        return _mm512_cmp_pd_mask(lhs, rhs, _CMP_GE_OQ);
+    }
+};
+
+struct LessEqual
+{
+    bool operator()(const double & lhs, const double & rhs) const
+    {
+        return lhs <= rhs;
+    }
+
+    static inline int mask(__m128d lhs, __m128d rhs)
+    {
+        return _mm_movemask_pd(_mm_cmple_pd(lhs, rhs));
+    }
+
+    __attribute__((target("avx2")))
+    static inline int mask(__m256d lhs, __m256d rhs)
+    {
+        return _mm256_movemask_pd(_mm256_cmp_pd(lhs, rhs, _CMP_LE_OQ));
+    }
+
+    __attribute__((target("avx512f")))
+    static inline int mask(__m512d lhs, __m512d rhs)
+    {
+        return _mm512_cmp_pd_mask(lhs, rhs, _CMP_LE_OQ);
+    }
+};
+
+struct AbsGreaterEqual
+{
+    bool operator()(const double & lhs, const double & rhs) const
+    {
+        return fabs(lhs) >= rhs;
+    }
+
+    static inline int mask(__m128d lhs, __m128d rhs)
+    {
+        return GreaterEqual::mask(_mm_andnot_pd(_mm_set1_pd(-0.0), lhs), rhs);
+    }
+
+    __attribute__((target("avx2")))
+    static inline int mask(__m256d lhs, __m256d rhs)
+    {
+        return GreaterEqual::mask(_mm256_andnot_pd(_mm256_set1_pd(-0.0), lhs), rhs);
+    }
+
+    __attribute__((target("avx512f")))
+    static inline int mask(__m512d lhs, __m512d rhs)
+    {
+        return _mm512_cmp_pd_mask(_mm512_abs_pd(lhs), rhs, _CMP_GE_OQ);
+    }
+};
+
+struct AbsLessEqual
+{
+    bool operator()(const double & lhs, const double & rhs) const
+    {
+        return fabs(lhs) <= rhs;
+    }
+
+    static inline int mask(__m128d lhs, __m128d rhs)
+    {
+        return LessEqual::mask(_mm_andnot_pd(_mm_set1_pd(-0.0), lhs), rhs);
+    }
+
+    __attribute__((target("avx2")))
+    static inline int mask(__m256d lhs, __m256d rhs)
+    {
+        return LessEqual::mask(_mm256_andnot_pd(_mm256_set1_pd(-0.0), lhs), rhs);
+    }
+
+    __attribute__((target("avx512f")))
+    static inline int mask(__m512d lhs, __m512d rhs)
+    {
+        return _mm512_cmp_pd_mask(_mm512_abs_pd(lhs), rhs, _CMP_LE_OQ);
+    }
+};
+
+template<typename _Compare>
+struct is_simd_comparator
+{
+    static constexpr bool value = false;
+};
+
+template<> struct is_simd_comparator<GreaterEqual> { static constexpr bool value = true; };
+template<> struct is_simd_comparator<LessEqual> { static constexpr bool value = true; };
+template<> struct is_simd_comparator<AbsGreaterEqual> { static constexpr bool value = true; };
+template<> struct is_simd_comparator<AbsLessEqual> { static constexpr bool value = true; };
+
+/*
+ * Activity criteria decide whether the activities of a pair agree, given
+ * the threshold A*. Like the comparators they provide the scalar test and
+ * a lane mask per register width; criteria without the masks are run by
+ * the scalar kernels only.
+ */
+struct ActivityWithin
+{
+    // |A_i - A_j| <= A*
+    bool operator()(const double & activity_i, const double & activity_j, const double & activity_thr) const
+    {
+        return fabs(activity_i - activity_j) <= activity_thr;
+    }
+
+    static inline int mask(__m128d activity_i, __m128d activity_j, __m128d activity_thr)
+    {
+        return AbsLessEqual::mask(_mm_sub_pd(activity_i, activity_j), activity_thr);
+    }
+
+    __attribute__((target("avx2")))
+    static inline int mask(__m256d activity_i, __m256d activity_j, __m256d activity_thr)
+    {
+        return AbsLessEqual::mask(_mm256_sub_pd(activity_i, activity_j), activity_thr);
+    }
+
+    __attribute__((target("avx512f")))
+    static inline int mask(__m512d activity_i, __m512d activity_j, __m512d activity_thr)
+    {
+        return AbsLessEqual::mask(_mm512_sub_pd(activity_i, activity_j), activity_thr);
+    }
+};
+
+template<typename _Agree>
+struct is_simd_criterion
+{
+    static constexpr bool value = false;
+};
+
+template<> struct is_simd_criterion<ActivityWithin> { static constexpr bool value = true; };
+
+struct PairCounts
+{
+    std::size_t numerator;
+    std::size_t denominator;
+
+    PairCounts & operator+=(const PairCounts & other)
+    {
+        numerator += other.numerator;
+        denominator += other.denominator;
+
+        return *this;
+    }
+};
+
+/*
+ * Counts, over j in [0, n), the pairs whose value passes _Compare against
+ * `threshold` (denominator) and, among those, the pairs whose activities
+ * agree under _Agree with `activity_thr` (numerator). With _Difference the
+ * compared value is `value_i - values[j]`, otherwise it is `values[j]`.
+ */
+template<typename _Compare, bool _Difference, typename _Agree = ActivityWithin>
+struct PairCountKernel
+{
+    typedef std::size_t size_type;
+    typedef void (*function_type)(
+        const double * values, const double * activities, size_type n,
+        double value_i, double activity_i, double threshold, double activity_thr,
+        PairCounts & counts);
+
+    static inline
+    void count(
+        const double * values, const double * activities, size_type n,
+        double value_i, double activity_i, double threshold, double activity_thr,
+        PairCounts & counts)
+    {
+        static const function_type fn = select();
+
+        fn(values, activities, n, value_i, activity_i, threshold, activity_thr, counts);
+    }
+
+    static
+    function_type select()
+    {
+        switch (simd_level())
+        {
+            case SimdLevel::AVX512:
+                return &count_avx512;
+            case SimdLevel::AVX2:
+                return &count_avx2;
+            default:
+                return &count_sse2;
+        }
+    }
+
+    static inline
+    void count_scalar(
+        const double * values, const double * activities, size_type begin, size_type n,
+        double value_i, double activity_i, double threshold, double activity_thr,
+        PairCounts & counts)
+    {
+        for (size_type jidx{begin}; jidx < n; ++jidx)
+        {
+            const bool Dist_i_j = _Compare()(_Difference ? value_i - values[jidx] : values[jidx], threshold);
+            const bool Delta_A_i_j_LE_A_star = _Agree()(activity_i, activities[jidx], activity_thr);
+
+            counts.denominator += Dist_i_j;
+            counts.numerator += Dist_i_j & Delta_A_i_j_LE_A_star;
+        }
+    }
+
+    static
+    void count_sse2(
+        const double * values, const double * activities, size_type n,
+        double value_i, double activity_i, double threshold, double activity_thr,
+        PairCounts & counts)
+    {
+        const __m128d v_value_i = _mm_set1_pd(value_i);
+        const __m128d v_activity_i = _mm_set1_pd(activity_i);
+        const __m128d v_threshold = _mm_set1_pd(threshold);
+        const __m128d v_activity_thr = _mm_set1_pd(activity_thr);
+
+        size_type jidx{0};
+
+        for (; jidx + 2 <= n; jidx += 2)
+        {
+            const __m128d v_values = _mm_loadu_pd(values + jidx);
+            const int m_dist = _Compare::mask(_Difference ? _mm_sub_pd(v_value_i, v_values) : v_values, v_threshold);
+            const int m_act = _Agree::mask(v_activity_i, _mm_loadu_pd(activities + jidx), v_activity_thr);
+
+            counts.denominator += __builtin_popcount(m_dist);
+            counts.numerator += __builtin_popcount(m_dist & m_act);
+        }
+
+        count_scalar(values, activities, jidx, n, value_i, activity_i, threshold, activity_thr, counts);
+    }
+
+    __attribute__((target("avx2,popcnt")))
+    static
+    void count_avx2(
+        const double * values, const double * activities, size_type n,
+        double value_i, double activity_i, double threshold, double activity_thr,
+        PairCounts & counts)
+    {
+        const __m256d v_value_i = _mm256_set1_pd(value_i);
+        const __m256d v_activity_i = _mm256_set1_pd(activity_i);
+        const __m256d v_threshold = _mm256_set1_pd(threshold);
+        const __m256d v_activity_thr = _mm256_set1_pd(activity_thr);
+
+        size_type jidx{0};
+
+        for (; jidx + 4 <= n; jidx += 4)
+        {
+            const __m256d v_values = _mm256_loadu_pd(values + jidx);
+            const int m_dist = _Compare::mask(_Difference ? _mm256_sub_pd(v_value_i, v_values) : v_values, v_threshold);
+            const int m_act = _Agree::mask(v_activity_i, _mm256_loadu_pd(activities + jidx), v_activity_thr);
+
+            counts.denominator += __builtin_popcount(m_dist);
+            counts.numerator += __builtin_popcount(m_dist & m_act);
+        }
+
+        count_scalar(values, activities, jidx, n, value_i, activity_i, threshold, activity_thr, counts);
+    }
+
+    __attribute__((target("avx512f,popcnt")))
+    static
+    void count_avx512(
+        const double * values, const double * activities, size_type n,
+        double value_i, double activity_i, double threshold, double activity_thr,
+        PairCounts & counts)
+    {
+        const __m512d v_value_i = _mm512_set1_pd(value_i);
+        const __m512d v_activity_i = _mm512_set1_pd(activity_i);
+        const __m512d v_threshold = _mm512_set1_pd(threshold);
+        const __m512d v_activity_thr = _mm512_set1_pd(activity_thr);
+
+        size_type jidx{0};
+
+        for (; jidx + 8 <= n; jidx += 8)
+        {
+            const __m512d v_values = _mm512_loadu_pd(values + jidx);
+            const int m_dist = _Compare::mask(_Difference ? _mm512_sub_pd(v_value_i, v_values) : v_values, v_threshold);
+            const int m_act = _Agree::mask(v_activity_i, _mm512_loadu_pd(activities + jidx), v_activity_thr);
+
+            counts.denominator += __builtin_popcount(m_dist);
+            counts.numerator += __builtin_popcount(m_dist & m_act);
+        }
+
+        count_scalar(values, activities, jidx, n, value_i, activity_i, threshold, activity_thr, counts);
+    }
+};
+
+/*
+ * Byte-coded counterpart of PairCountKernel for quantized similarities:
+ * the denominator counts values[j] >= threshold and the numerator those
+ * pairs whose activities also agree under _Agree. Bytes are compared
+ * 16/32/64 at a time and the activity masks are assembled from the
+ * matching double lanes.
+ */
+template<typename _Agree = ActivityWithin>
+struct ByteCountKernel
+{
+    typedef std::size_t size_type;
+    typedef void (*function_type)(
+        const std::uint8_t * values, const double * activities, size_type n,
+        std::uint8_t threshold, double activity_i, double activity_thr,
+        PairCounts & counts);
+
+    static inline
+    void count(
+        const std::uint8_t * values, const double * activities, size_type n,
+        std::uint8_t threshold, double activity_i, double activity_thr,
+        PairCounts & counts)
+    {
+        static const function_type fn = select();
+
+        fn(values, activities, n, threshold, activity_i, activity_thr, counts);
+    }
+
+    static
+    function_type select()
+    {
+        if (simd_level() == SimdLevel::AVX512 && __builtin_cpu_supports("avx512bw"))
+        {
+            return &count_avx512;
+        }
+        else if (simd_level() != SimdLevel::SSE2)
+        {
+            return &count_avx2;
+        }
+        else
+        {
+            return &count_sse2;
+        }
+    }
+
+    static inline
+    void count_scalar(
+        const std::uint8_t * values, const double * activities, size_type begin, size_type n,
+        std::uint8_t threshold, double activity_i, double activity_thr,
+        PairCounts & counts)
+    {
+        for (size_type jidx{begin}; jidx < n; ++jidx)
+        {
+            const bool Dist_i_j = values[jidx] >= threshold;
+            const bool Delta_A_i_j_LE_A_star = _Agree()(activity_i, activities[jidx], activity_thr);
+
+            counts.denominator += Dist_i_j;
+            counts.numerator += Dist_i_j & Delta_A_i_j_LE_A_star;
+        }
+    }
+
+    static
+    void count_sse2(
+        const std::uint8_t * values, const double * activities, size_type n,
+        std::uint8_t threshold, double activity_i, double activity_thr,
+        PairCounts & counts)
+    {
+        const __m128i v_threshold = _mm_set1_epi8(threshold);
+        const __m128d v_activity_i = _mm_set1_pd(activity_i);
+        const __m128d v_activity_thr = _mm_set1_pd(activity_thr);
+
+        size_type jidx{0};
+
+        for (; jidx + 16 <= n; jidx += 16)
+        {
+            const __m128i v_values = _mm_loadu_si128((const __m128i *)(values + jidx));
+            const unsigned int m_dist = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(v_values, v_threshold), v_values));
+
+            if (m_dist == 0)
+            {
+                continue;
+            }
+
+            unsigned int m_act{0};
+
+            for (size_type vidx{0}; vidx < 16; vidx += 2)
+            {
+                m_act |= _Agree::mask(
+                    v_activity_i, _mm_loadu_pd(activities + jidx + vidx), v_activity_thr) << vidx;
+            }
+
+            counts.denominator += __builtin_popcount(m_dist);
+            counts.numerator += __builtin_popcount(m_dist & m_act);
+        }
+
+        count_scalar(values, activities, jidx, n, threshold, activity_i, activity_thr, counts);
+    }
+
+    __attribute__((target("avx2,popcnt")))
+    static
+    void count_avx2(
+        const std::uint8_t * values, const double * activities, size_type n,
+        std::uint8_t threshold, double activity_i, double activity_thr,
+        PairCounts & counts)
+    {
+        const __m256i v_threshold = _mm256_set1_epi8(threshold);
+        const __m256d v_activity_i = _mm256_set1_pd(activity_i);
+        const __m256d v_activity_thr = _mm256_set1_pd(activity_thr);
+
+        size_type jidx{0};
+
+        for (; jidx + 32 <= n; jidx += 32)
+        {
+            const __m256i v_values = _mm256_loadu_si256((const __m256i *)(values + jidx));
+            const unsigned int m_dist = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(v_values, v_threshold), v_values));
+
+            if (m_dist == 0)
+            {
+                continue;
+            }
+
+            unsigned int m_act{0};
+
+            for (size_type vidx{0}; vidx < 32; vidx += 4)
+            {
+                m_act |= (unsigned int)_Agree::mask(
+                    v_activity_i, _mm256_loadu_pd(activities + jidx + vidx), v_activity_thr) << vidx;
+            }
+
+            counts.denominator += __builtin_popcount(m_dist);
+            counts.numerator += __builtin_popcount(m_dist & m_act);
+        }
+
+        count_scalar(values, activities, jidx, n, threshold, activity_i, activity_thr, counts);
+    }
+
+    __attribute__((target("avx512f,avx512bw,popcnt")))
+    static
+    void count_avx512(
+        const std::uint8_t * values, const double * activities, size_type n,
+        std::uint8_t threshold, double activity_i, double activity_thr,
+        PairCounts & counts)
+    {
+        const __m512i v_threshold = _mm512_set1_epi8(threshold);
+        const __m512d v_activity_i = _mm512_set1_pd(activity_i);
+        const __m512d v_activity_thr = _mm512_set1_pd(activity_thr);
+
+        size_type jidx{0};
+
+        for (; jidx + 64 <= n; jidx += 64)
+        {
+            const __m512i v_values = _mm512_loadu_si512((const void *)(values + jidx));
+            const std::uint64_t m_dist = _mm512_cmpge_epu8_mask(v_values, v_threshold);
+
+            if (m_dist == 0)
+            {
+                continue;
+            }
+
+            std::uint64_t m_act{0};
+
+            for (size_type vidx{0}; vidx < 64; vidx += 8)
+            {
+                m_act |= (std::uint64_t)_Agree::mask(
+                    v_activity_i, _mm512_loadu_pd(activities + jidx + vidx), v_activity_thr) << vidx;
+            }
+
+            counts.denominator += __builtin_popcountll(m_dist);
+            counts.numerator += __builtin_popcountll(m_dist & m_act);
+        }
+
+        count_scalar(values, activities, jidx, n, threshold, activity_i, activity_thr, counts);
+    }
+};
+
+/*
+ * Pair counting against a precomputed bitset of agreeing pairs, see
+ * ActivityAgreementMask: every 64 columns of a row become a 64-bit mask
+ * of values[j] >= threshold, whose bits the denominator counts and whose
+ * bits also set in the agreement word the numerator does. Past the
+ * compares that is one AND and two popcounts per 64 pairs. `values` and
+ * `agree` are indexed with absolute column and word numbers and only the
+ * whole words [word_begin, word_end) are counted. Elements are doubles or
+ * byte codes.
+ */
+template<typename _ElementType>
+struct MaskCountKernel
+{
+    typedef std::size_t size_type;
+    typedef void (*function_type)(
+        const _ElementType * values, const std::uint64_t * agree, size_type word_begin, size_type word_end,
+        _ElementType threshold, PairCounts & counts);
+
+    static constexpr size_type WORD_BITS{64};
+
+    static inline
+    void count(
+        const _ElementType * values, const std::uint64_t * agree, size_type word_begin, size_type word_end,
+        _ElementType threshold, PairCounts & counts)
+    {
+        static const function_type fn = select();
+
+        fn(values, agree, word_begin, word_end, threshold, counts);
+    }
+
+    typedef std::uint64_t (*word_function_type)(const _ElementType * values, _ElementType threshold);
+
+    // the mask of values[0, 64) >= threshold
+    static inline
+    std::uint64_t word(const _ElementType * values, _ElementType threshold)
+    {
+        static const word_function_type fn = select_word();
+
+        return fn(values, threshold);
+    }
+
+    static
+    bool has_avx512()
+    {
+        return simd_level() == SimdLevel::AVX512 && __builtin_cpu_supports("avx512bw");
+    }
+
+    static
+    function_type select()
+    {
+        return has_avx512() ? &count_avx512 : simd_level() != SimdLevel::SSE2 ? &count_avx2 : &count_sse2;
+    }
+
+    static
+    word_function_type select_word()
+    {
+        return has_avx512() ? &word_avx512_entry : simd_level() != SimdLevel::SSE2 ? &word_avx2_entry : &word_sse2_entry;
+    }
+
+    static
+    void count_sse2(
+        const _ElementType * values, const std::uint64_t * agree, size_type word_begin, size_type word_end,
+        _ElementType threshold, PairCounts & counts)
+    {
+        for (size_type widx{word_begin}; widx < word_end; ++widx)
+        {
+            const std::uint64_t m_dist = word_sse2(values + widx * WORD_BITS, threshold);
+
+            counts.denominator += __builtin_popcountll(m_dist);
+            counts.numerator += __builtin_popcountll(m_dist & agree[widx]);
+        }
+    }
+
+    __attribute__((target("avx2,popcnt")))
+    static
+    void count_avx2(
+        const _ElementType * values, const std::uint64_t * agree, size_type word_begin, size_type word_end,
+        _ElementType threshold, PairCounts & counts)
+    {
+        for (size_type widx{word_begin}; widx < word_end; ++widx)
+        {
+            const std::uint64_t m_dist = word_avx2(values + widx * WORD_BITS, threshold);
+
+            counts.denominator += __builtin_popcountll(m_dist);
+            counts.numerator += __builtin_popcountll(m_dist & agree[widx]);
+        }
+    }
+
+    __attribute__((target("avx512f,avx512bw,popcnt")))
+    static
+    void count_avx512(
+        const _ElementType * values, const std::uint64_t * agree, size_type word_begin, size_type word_end,
+        _ElementType threshold, PairCounts & counts)
+    {
+        for (size_type widx{word_begin}; widx < word_end; ++widx)
+        {
+            const std::uint64_t m_dist = word_avx512(values + widx * WORD_BITS, threshold);
+
+            counts.denominator += __builtin_popcountll(m_dist);
+            counts.numerator += __builtin_popcountll(m_dist & agree[widx]);
+        }
+    }
+
+private:
+    static
+    std::uint64_t word_sse2_entry(const _ElementType * values, _ElementType threshold)
+    {
+        return word_sse2(values, threshold);
+    }
+
+    __attribute__((target("avx2")))
+    static
+    std::uint64_t word_avx2_entry(const _ElementType * values, _ElementType threshold)
+    {
+        return word_avx2(values, threshold);
+    }
+
+    __attribute__((target("avx512f,avx512bw")))
+    static
+    std::uint64_t word_avx512_entry(const _ElementType * values, _ElementType threshold)
+    {
+        return word_avx512(values, threshold);
+    }
+
+    static inline
+    std::uint64_t word_sse2(const double * values, const double threshold)
+    {
+        const __m128d v_threshold = _mm_set1_pd(threshold);
+        std::uint64_t result{0};
+
+        for (size_type vidx{0}; vidx < WORD_BITS; vidx += 2)
+        {
+            result |= (std::uint64_t)GreaterEqual::mask(_mm_loadu_pd(values + vidx), v_threshold) << vidx;
+        }
+
+        return result;
+    }
+
+    static inline
+    std::uint64_t word_sse2(const std::uint8_t * values, const std::uint8_t threshold)
+    {
+        const __m128i v_threshold = _mm_set1_epi8(threshold);
+        std::uint64_t result{0};
+
+        for (size_type vidx{0}; vidx < WORD_BITS; vidx += 16)
+        {
+            const __m128i v_values = _mm_loadu_si128((const __m128i *)(values + vidx));
+
+            result |= (std::uint64_t)(unsigned int)_mm_movemask_epi8(
+                _mm_cmpeq_epi8(_mm_max_epu8(v_values, v_threshold), v_values)) << vidx;
+        }
+
+        return result;
+    }
+
+    __attribute__((target("avx2")))
+    static inline
+    std::uint64_t word_avx2(const double * values, const double threshold)
+    {
+        const __m256d v_threshold = _mm256_set1_pd(threshold);
+        std::uint64_t result{0};
+
+        for (size_type vidx{0}; vidx < WORD_BITS; vidx += 4)
+        {
+            result |= (std::uint64_t)GreaterEqual::mask(_mm256_loadu_pd(values + vidx), v_threshold) << vidx;
+        }
+
+        return result;
+    }
+
+    __attribute__((target("avx2")))
+    static inline
+    std::uint64_t word_avx2(const std::uint8_t * values, const std::uint8_t threshold)
+    {
+        const __m256i v_threshold = _mm256_set1_epi8(threshold);
+        std::uint64_t result{0};
+
+        for (size_type vidx{0}; vidx < WORD_BITS; vidx += 32)
+        {
+            const __m256i v_values = _mm256_loadu_si256((const __m256i *)(values + vidx));
+
+            result |= (std::uint64_t)(unsigned int)_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(_mm256_max_epu8(v_values, v_threshold), v_values)) << vidx;
+        }
+
+        return result;
+    }
+
+    __attribute__((target("avx512f")))
+    static inline
+    std::uint64_t word_avx512(const double * values, const double threshold)
+    {
+        const __m512d v_threshold = _mm512_set1_pd(threshold);
+        std::uint64_t result{0};
+
+        for (size_type vidx{0}; vidx < WORD_BITS; vidx += 8)
+        {
+            result |= (std::uint64_t)GreaterEqual::mask(_mm512_loadu_pd(values + vidx), v_threshold) << vidx;
+        }
+
+        return result;
+    }
+
+    __attribute__((target("avx512f,avx512bw")))
+    static inline
+    std::uint64_t word_avx512(const std::uint8_t * values, const std::uint8_t threshold)
+    {
+        return _mm512_cmpge_epu8_mask(_mm512_loadu_si512((const void *)values), _mm512_set1_epi8(threshold));
+    }
+};
+
+#endif /* SIMD_HPP_ */
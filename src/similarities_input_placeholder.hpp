@@ -24,42 +24,141 @@
 #ifndef SIMILARITIES_INPUT_PLACEHOLDER_HPP_
 #define SIMILARITIES_INPUT_PLACEHOLDER_HPP_
 
-#include "matrix.hpp"
+#include "symmetric_matrix.hpp"
+#include "quantize.hpp"
 
 #include <utility>
 #include <vector>
 #include <cstddef>
 #include <memory>
+#include <algorithm>
+#include <cstdint>
 
+/*
+ * Collects similarity rows straight into the packed matrix which is later
+ * handed over to the ranking, so the input is never held twice. The
+ * storage type (doubles or quantized bytes) has to be chosen before the
+ * first row arrives; the matrix is sized either by allocate() or, failing
+ * that, by the length of the first row.
+ */
 struct SimilaritiesInputPlaceholder
 {
 private:
     typedef std::size_t size_type;
     typedef std::vector<double> row_type;
-    typedef std::vector<row_type> array_type;
 
 public:
+    SimilaritiesInputPlaceholder()
+    :
+        m_quantized(false)
+    {
+    }
+
+    void setQuantized(const bool quantized)
+    {
+        m_quantized = quantized;
+    }
+
+    void allocate(const size_type n_molecules)
+    {
+        if (m_quantized)
+        {
+            m_quantized_similarities.reset(new SymmetricMatrix2d<std::uint8_t>(n_molecules));
+        }
+        else
+        {
+            m_similarities.reset(new SymmetricMatrix2d<double>(n_molecules));
+        }
+    }
+
+    void takeFrom(const size_type index, const double * cbegin, const double * cend)
+    {
+        if (m_quantized)
+        {
+            copy_row(m_quantized_similarities, index, cbegin, cend);
+        }
+        else
+        {
+            copy_row(m_similarities, index, cbegin, cend);
+        }
+    }
+
     void takeFrom(const size_type index, row_type && row)
     {
-        m_array.resize(row.size());
+        takeFrom(index, row.data(), row.data() + row.size());
+    }
 
-        m_array[index] = std::move(row);
+    /*
+     * Hands over the packed similarity matrix. With _Type = std::uint8_t each
+     * similarity is stored as its SimilarityQuantizer bucket index instead.
+     * Asking for the type that was not collected converts the matrix.
+     */
+    template<typename _Type = double>
+    std::unique_ptr<SymmetricMatrix2d<_Type>> render()
+    {
+        std::unique_ptr<SymmetricMatrix2d<_Type>> & stored = storage((_Type *)nullptr);
+
+        if (stored)
+        {
+            return std::move(stored);
+        }
+        else if (m_quantized)
+        {
+            return transcode<_Type>(std::move(m_quantized_similarities));
+        }
+        else
+        {
+            return transcode<_Type>(std::move(m_similarities));
+        }
+    }
+
+private:
+    std::unique_ptr<SymmetricMatrix2d<double>> & storage(double *)
+    {
+        return m_similarities;
     }
 
-    std::unique_ptr<Matrix2d<double>> render() const
+    std::unique_ptr<SymmetricMatrix2d<std::uint8_t>> & storage(std::uint8_t *)
     {
-        std::unique_ptr<Matrix2d<double>> result(new Matrix2d<double>(m_array.size(), m_array.size()));
+        return m_quantized_similarities;
+    }
+
+    template<typename _Type>
+    void copy_row(std::unique_ptr<SymmetricMatrix2d<_Type>> & matrix, const size_type index, const double * cbegin, const double * cend)
+    {
+        if (!matrix)
+        {
+            matrix.reset(new SymmetricMatrix2d<_Type>(cend - cbegin));
+        }
+
+        std::transform(cbegin + index, cend, matrix->row_begin(index), SimilarityCodec<_Type>::encode);
+    }
+
+    template<typename _Type, typename _SourceType>
+    static
+    std::unique_ptr<SymmetricMatrix2d<_Type>> transcode(std::unique_ptr<SymmetricMatrix2d<_SourceType>> && source)
+    {
+        const size_type n_molecules = source ? source->cols() : 0;
+
+        std::unique_ptr<SymmetricMatrix2d<_Type>> result(new SymmetricMatrix2d<_Type>(n_molecules));
 
-        for (size_type index = 0; index < m_array.size(); ++index)
+        for (size_type index = 0; index < n_molecules; ++index)
         {
-            result->copyRowFrom(index, m_array[index].data(), m_array[index].data() + m_array[index].size());
+            std::transform(source->row_cbegin(index), source->row_cend(index), result->row_begin(index),
+                [](const _SourceType & value)
+                {
+                    return SimilarityCodec<_Type>::encode(SimilarityCodec<_SourceType>::decode(value));
+                }
+            );
         }
 
         return result;
     }
 
 private:
-    array_type m_array;
+    bool m_quantized;
+    std::unique_ptr<SymmetricMatrix2d<double>> m_similarities;
+    std::unique_ptr<SymmetricMatrix2d<std::uint8_t>> m_quantized_similarities;
 };
 
 #endif /* SIMILARITIES_INPUT_PLACEHOLDER_HPP_ */
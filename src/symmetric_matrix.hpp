@@ -0,0 +1,234 @@
+/*******************************************************************************
+ * Copyright (c) 2015 Wojciech Migda
+ * All rights reserved
+ * Distributed under the terms of the GNU LGPL v3
+ *******************************************************************************
+ *
+ * Filename: symmetric_matrix.hpp
+ *
+ * Description:
+ *      Symmetric matrix with packed upper-triangular storage
+ *
+ * Authors:
+ *          Wojciech Migda (wm)
+ *
+ *******************************************************************************
+ * History:
+ * --------
+ * Date         Who  Ticket     Description
+ * ----------   ---  ---------  ------------------------------------------------
+ * 2026-10-17   wm              Initial version
+ *
+ ******************************************************************************/
+
+#ifndef SYMMETRIC_MATRIX_HPP_
+#define SYMMETRIC_MATRIX_HPP_
+
+#include "instrument.hpp"
+
+#include <cstddef>
+#include <algorithm>
+#include <valarray>
+#include <utility>
+
+/*
+ * Symmetric n_col x n_col matrix of which only the upper triangle (with the
+ * diagonal) is stored, row after row. Row `r` holds columns r..n_col-1.
+ *
+ * Optionally only the first n_row rows are kept, which gives the upper
+ * trapezoid needed when just the pairs involving the leading n_row items
+ * are of interest; at(r, c) is then valid whenever min(r, c) < n_row.
+ *
+ * row_cbegin/row_cend span the stored part of a row, i.e. they start at
+ * the diagonal. upper_row_cbegin returns a pointer to be indexed with
+ * absolute column numbers c >= r, which is what the pair sweeps use and is
+ * also provided by Matrix2d.
+ */
+template<typename _Type>
+struct SymmetricMatrix2d
+{
+    typedef _Type value_type;
+    typedef value_type * pointer;
+    typedef const value_type * const_pointer;
+    typedef std::size_t size_type;
+
+    explicit SymmetricMatrix2d(size_type n_col)
+    :
+        SymmetricMatrix2d(n_col, n_col)
+    {
+    }
+
+    SymmetricMatrix2d(size_type n_row, size_type n_col)
+    :
+        m_n_row(std::min(n_row, n_col)),
+        m_n_col(n_col),
+        m_data(packed_size(m_n_row, m_n_col))
+    {
+        AM_MATRIX_ALLOCATED(nelem() * sizeof (value_type));
+    }
+
+    SymmetricMatrix2d(const SymmetricMatrix2d &) = delete;
+    SymmetricMatrix2d & operator=(const SymmetricMatrix2d &) = delete;
+
+    ~SymmetricMatrix2d()
+    {
+        AM_MATRIX_RELEASED(nelem() * sizeof (value_type));
+    }
+
+    /*
+     * Offset of element (index, 0) if rows were not packed, i.e. the packed
+     * start of row `index` minus `index`.
+     */
+    static size_type packed_row_offset(const size_type n_col, const size_type index)
+    {
+        return index * n_col - index * (index + 1) / 2;
+    }
+
+    static size_type packed_size(const size_type n_row, const size_type n_col)
+    {
+        return packed_row_offset(n_col, n_row) + n_row;
+    }
+
+    void copyRowFrom(size_type row_index, const_pointer cbegin, const_pointer cend)
+    {
+        std::copy(cbegin + row_index, cend, row_begin(row_index));
+    }
+
+    pointer row_begin(const size_type & index)
+    {
+        return &m_data[0] + row_offset(index) + index;
+    }
+
+    pointer row_end(const size_type & index)
+    {
+        return &m_data[0] + row_offset(index) + m_n_col;
+    }
+
+    const_pointer row_cbegin(const size_type & index) const
+    {
+        return &m_data[0] + row_offset(index) + index;
+    }
+
+    const_pointer row_cend(const size_type & index) const
+    {
+        return &m_data[0] + row_offset(index) + m_n_col;
+    }
+
+    const_pointer upper_row_cbegin(const size_type & index) const
+    {
+        return &m_data[0] + row_offset(index);
+    }
+
+    value_type at(size_type row, size_type column) const
+    {
+        if (row > column)
+        {
+            std::swap(row, column);
+        }
+
+        return m_data[row_offset(row) + column];
+    }
+
+    void write(size_type row, size_type column, value_type value)
+    {
+        if (row > column)
+        {
+            std::swap(row, column);
+        }
+
+        m_data[row_offset(row) + column] = value;
+    }
+
+    size_type rows() const
+    {
+        return m_n_row;
+    }
+
+    size_type cols() const
+    {
+        return m_n_col;
+    }
+
+    size_type nelem() const
+    {
+        return m_data.size();
+    }
+
+    const_pointer data() const
+    {
+        return &m_data[0];
+    }
+
+private:
+    size_type row_offset(const size_type & index) const
+    {
+        return packed_row_offset(m_n_col, index);
+    }
+
+private:
+    const size_type m_n_row;
+    const size_type m_n_col;
+    std::valarray<value_type> m_data;
+};
+
+/*
+ * Read-only view with the SymmetricMatrix2d API over packed storage owned
+ * elsewhere, e.g. a memory mapped file.
+ */
+template<typename _Type>
+struct SymmetricMatrixView
+{
+    typedef _Type value_type;
+    typedef const value_type * const_pointer;
+    typedef std::size_t size_type;
+
+    SymmetricMatrixView(const_pointer data, size_type n_row, size_type n_col)
+    :
+        m_n_row(std::min(n_row, n_col)),
+        m_n_col(n_col),
+        m_data(data)
+    {
+    }
+
+    const_pointer row_cbegin(const size_type & index) const
+    {
+        return upper_row_cbegin(index) + index;
+    }
+
+    const_pointer row_cend(const size_type & index) const
+    {
+        return upper_row_cbegin(index) + m_n_col;
+    }
+
+    const_pointer upper_row_cbegin(const size_type & index) const
+    {
+        return m_data + SymmetricMatrix2d<value_type>::packed_row_offset(m_n_col, index);
+    }
+
+    value_type at(size_type row, size_type column) const
+    {
+        if (row > column)
+        {
+            std::swap(row, column);
+        }
+
+        return upper_row_cbegin(row)[column];
+    }
+
+    size_type rows() const
+    {
+        return m_n_row;
+    }
+
+    size_type cols() const
+    {
+        return m_n_col;
+    }
+
+private:
+    const size_type m_n_row;
+    const size_type m_n_col;
+    const_pointer m_data;
+};
+
+#endif /* SYMMETRIC_MATRIX_HPP_ */
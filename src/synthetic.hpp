@@ -0,0 +1,197 @@
+/*******************************************************************************
+ * Copyright (c) 2015 Wojciech Migda
+ * All rights reserved
+ * Distributed under the terms of the GNU LGPL v3
+ *******************************************************************************
+ *
+ * Filename: synthetic.hpp
+ *
+ * Description:
+ *      Reproducible synthetic datasets in the ranking input format
+ *
+ * Authors:
+ *          Wojciech Migda (wm)
+ *
+ *******************************************************************************
+ * History:
+ * --------
+ * Date         Who  Ticket     Description
+ * ----------   ---  ---------  ------------------------------------------------
+ * 2026-10-17   wm              Initial version
+ *
+ ******************************************************************************/
+
+#ifndef SYNTHETIC_HPP_
+#define SYNTHETIC_HPP_
+
+#include "symmetric_matrix.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+#include <memory>
+
+/*
+ * Every molecule gets a hidden position in an N_LATENT dimensional space.
+ * Similarities decay with the latent distance, the descriptors and the
+ * activity are noisy functions of the position, so the data has some of
+ * the structure the ranking looks for. Activities are partly snapped to a
+ * few common values to give the CP statistics agreeing pairs.
+ *
+ * Values are rounded to the precision they are printed with, so the
+ * in-memory similarities equal what a parser reads back from write().
+ * The same (X, Y, seed) always gives the same dataset.
+ */
+struct SyntheticDataset
+{
+    typedef std::size_t size_type;
+    typedef std::vector<std::string> molecule_array_type;
+
+    static constexpr size_type N_LATENT{8};
+    static constexpr size_type N_DESCRIPTORS{21};
+
+    SyntheticDataset(size_type X, size_type Y, std::uint64_t seed = 1)
+    :
+        m_X(X),
+        m_Y(Y),
+        m_similarities(new SymmetricMatrix2d<double>(X + Y))
+    {
+        const size_type N = X + Y;
+
+        std::mt19937_64 engine(seed);
+        std::normal_distribution<double> normal(0.0, 1.0);
+        std::uniform_int_distribution<int> small_int(1, 30);
+        std::uniform_int_distribution<int> snap(0, 3);
+
+        std::vector<double> latent(N * N_LATENT);
+
+        for (auto & value : latent)
+        {
+            value = normal(engine);
+        }
+
+        for (size_type iidx{0}; iidx < N; ++iidx)
+        {
+            m_similarities->write(iidx, iidx, 1.0);
+
+            for (size_type jidx{iidx + 1}; jidx < N; ++jidx)
+            {
+                double distance_sq{0.0};
+
+                for (size_type kidx{0}; kidx < N_LATENT; ++kidx)
+                {
+                    const double delta = latent[iidx * N_LATENT + kidx] - latent[jidx * N_LATENT + kidx];
+
+                    distance_sq += delta * delta;
+                }
+
+                m_similarities->write(iidx, jidx, rounded(std::exp(-distance_sq / N_LATENT), 1e6));
+            }
+        }
+
+        m_molecules.reserve(N);
+
+        for (size_type midx{0}; midx < N; ++midx)
+        {
+            const double * position = &latent[midx * N_LATENT];
+            std::string molecule;
+            char buffer[64];
+
+            for (size_type didx{0}; didx < N_DESCRIPTORS; ++didx)
+            {
+                if (didx == 14)
+                {
+                    std::snprintf(buffer, sizeof (buffer), "C%dH%dN%d,",
+                        small_int(engine), 2 * small_int(engine), small_int(engine) % 6);
+                    molecule += buffer;
+                }
+
+                const double value = 250.0 + 60.0 * position[didx % N_LATENT] + 40.0 * normal(engine);
+
+                std::snprintf(buffer, sizeof (buffer), "%.3f", rounded(value, 1e3));
+                molecule += buffer;
+
+                if (didx + 1 < N_DESCRIPTORS || midx < X)
+                {
+                    molecule += ',';
+                }
+            }
+
+            if (midx < X)
+            {
+                const int snapped = snap(engine);
+                const double activity =
+                    snapped == 0 ? 5.0 : snapped == 1 ? 7.5 : 5.0 + 1.5 * position[0] + 0.5 * normal(engine);
+
+                std::snprintf(buffer, sizeof (buffer), "%.2f", rounded(activity, 1e2));
+                molecule += buffer;
+            }
+
+            m_molecules.push_back(molecule);
+        }
+    }
+
+    size_type X() const
+    {
+        return m_X;
+    }
+
+    size_type Y() const
+    {
+        return m_Y;
+    }
+
+    const std::unique_ptr<SymmetricMatrix2d<double>> & similarities() const
+    {
+        return m_similarities;
+    }
+
+    molecule_array_type training_molecules() const
+    {
+        return molecule_array_type(m_molecules.cbegin(), m_molecules.cbegin() + m_X);
+    }
+
+    molecule_array_type testing_molecules() const
+    {
+        return molecule_array_type(m_molecules.cbegin() + m_X, m_molecules.cend());
+    }
+
+    // the text input format read by main
+    void write(std::FILE * stream) const
+    {
+        const size_type N = m_X + m_Y;
+
+        std::fprintf(stream, "%zu %zu\n", m_X, m_Y);
+
+        for (size_type iidx{0}; iidx < N; ++iidx)
+        {
+            for (size_type jidx{0}; jidx < N; ++jidx)
+            {
+                std::fprintf(stream, jidx + 1 < N ? "%.6f " : "%.6f\n", m_similarities->at(iidx, jidx));
+            }
+        }
+
+        for (const auto & molecule : m_molecules)
+        {
+            std::fprintf(stream, "%s\n", molecule.c_str());
+        }
+    }
+
+private:
+    static double rounded(const double value, const double scale)
+    {
+        return std::round(value * scale) / scale;
+    }
+
+private:
+    const size_type m_X;
+    const size_type m_Y;
+    std::unique_ptr<SymmetricMatrix2d<double>> m_similarities;
+    molecule_array_type m_molecules;
+};
+
+#endif /* SYNTHETIC_HPP_ */
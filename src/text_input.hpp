@@ -0,0 +1,387 @@
+/*******************************************************************************
+ * Copyright (c) 2015 Wojciech Migda
+ * All rights reserved
+ * Distributed under the terms of the GNU LGPL v3
+ *******************************************************************************
+ *
+ * Filename: text_input.hpp
+ *
+ * Description:
+ *      Block-buffered reader for whitespace separated text input
+ *
+ * Authors:
+ *          Wojciech Migda (wm)
+ *
+ *******************************************************************************
+ * History:
+ * --------
+ * Date         Who  Ticket     Description
+ * ----------   ---  ---------  ------------------------------------------------
+ * 2026-10-17   wm              Initial version
+ *
+ ******************************************************************************/
+
+#ifndef TEXT_INPUT_HPP_
+#define TEXT_INPUT_HPP_
+
+#include "number_parser.hpp"
+#include "parallel.hpp"
+#include "instrument.hpp"
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+/*
+ * Pulls the stream in large blocks with fread and hands out tokens from
+ * the buffer. Long runs of numbers are parsed with parse_doubles, which
+ * can split each block across the workers of a ThreadPool: every worker
+ * first counts the tokens in its slice, a prefix sum turns the counts into
+ * output offsets and then the slices are parsed independently.
+ */
+struct BlockReader
+{
+    typedef std::size_t size_type;
+
+    static constexpr size_type DEFAULT_BLOCK_SIZE{size_type(1) << 24};
+
+    explicit BlockReader(std::FILE * stream, size_type block_size = DEFAULT_BLOCK_SIZE)
+    :
+        m_stream(stream),
+        m_buffer(std::max<size_type>(block_size, 2)),
+        m_begin(0),
+        m_end(0),
+        m_eof(false),
+        m_bytes_read(0)
+    {
+    }
+
+    bool next_token(std::string & token)
+    {
+        const char * pos = nullptr;
+        const char * token_end = nullptr;
+
+        if (!locate_token(pos, token_end))
+        {
+            return false;
+        }
+
+        token.assign(pos, token_end);
+        m_begin = token_end - data();
+
+        return true;
+    }
+
+    template<typename _Integer>
+    bool next_integer(_Integer & value)
+    {
+        std::string token;
+
+        if (!next_token(token))
+        {
+            return false;
+        }
+
+        value = std::strtol(token.c_str(), nullptr, 10);
+
+        return true;
+    }
+
+    /*
+     * Parses the next `count` numbers into `out`. Returns how many were
+     * actually read, which is less than `count` only at end of input.
+     */
+    size_type parse_doubles(double * out, const size_type count, ThreadPool & thread_pool)
+    {
+        size_type done{0};
+
+        while (done < count)
+        {
+            const char * lo = skip_spaces(data() + m_begin, data() + m_end);
+            m_begin = lo - data();
+
+            const char * hi = safe_end();
+
+            if (lo == hi)
+            {
+                if (!refill())
+                {
+                    break;
+                }
+                continue;
+            }
+
+            done += parse_range(lo, hi, out + done, count - done, thread_pool);
+        }
+
+        return done;
+    }
+
+    size_type bytes_read() const
+    {
+        return m_bytes_read;
+    }
+
+private:
+    struct Slice
+    {
+        const char * begin;
+        const char * end;
+        size_type n_tokens;
+        size_type offset;
+        const char * parsed_end;
+    };
+
+    const char * data() const
+    {
+        return m_buffer.data();
+    }
+
+    /*
+     * End of the part of the buffer which contains only complete tokens.
+     * Unless the stream is exhausted the last token may continue in the
+     * next block, so we stop after the last whitespace.
+     */
+    const char * safe_end() const
+    {
+        const char * lo = data() + m_begin;
+        const char * hi = data() + m_end;
+
+        if (m_eof)
+        {
+            return hi;
+        }
+
+        while (hi != lo && !is_space(*(hi - 1)))
+        {
+            --hi;
+        }
+
+        return hi;
+    }
+
+    size_type parse_range(const char * lo, const char * hi, double * out, const size_type wanted, ThreadPool & thread_pool)
+    {
+        constexpr size_type MIN_SLICE_SIZE{size_type(1) << 16};
+
+        const size_type n_slices =
+            std::max<size_type>(1, std::min<size_type>(thread_pool.workers(), (hi - lo) / MIN_SLICE_SIZE));
+
+        if (n_slices == 1)
+        {
+            size_type n_parsed{0};
+            const char * p = lo;
+
+            for (; n_parsed < wanted && p != hi; ++n_parsed)
+            {
+                p = parse_double(p, hi, out[n_parsed]);
+                p = skip_spaces(skip_token(p, hi), hi);
+            }
+
+            m_begin = p - data();
+
+            return n_parsed;
+        }
+
+        std::vector<Slice> slices(n_slices);
+
+        const char * pos = lo;
+
+        for (size_type idx{0}; idx < n_slices; ++idx)
+        {
+            const char * slice_end =
+                idx + 1 == n_slices ?
+                    hi
+                    :
+                    std::max(pos, std::min(hi, lo + (hi - lo) * (idx + 1) / n_slices));
+
+            slice_end = skip_token(slice_end, hi);
+
+            slices[idx].begin = pos;
+            slices[idx].end = slice_end;
+            pos = slice_end;
+        }
+
+        thread_pool.parallel_for(0, n_slices,
+            [&slices](const size_type idx)
+            {
+                Slice & slice = slices[idx];
+                size_type n_tokens{0};
+
+                for (const char * p = skip_spaces(slice.begin, slice.end); p != slice.end; p = skip_spaces(p, slice.end))
+                {
+                    p = skip_token(p, slice.end);
+                    ++n_tokens;
+                }
+
+                slice.n_tokens = n_tokens;
+            }
+        );
+
+        size_type total{0};
+
+        for (auto & slice : slices)
+        {
+            slice.offset = total;
+            total += slice.n_tokens;
+        }
+
+        thread_pool.parallel_for(0, n_slices,
+            [&slices, out, wanted](const size_type idx)
+            {
+                Slice & slice = slices[idx];
+                const char * p = skip_spaces(slice.begin, slice.end);
+
+                for (size_type tidx{slice.offset}; tidx < wanted && tidx < slice.offset + slice.n_tokens; ++tidx)
+                {
+                    p = parse_double(p, slice.end, out[tidx]);
+                    p = skip_token(p, slice.end);
+                    p = skip_spaces(p, slice.end);
+                }
+
+                slice.parsed_end = p;
+            }
+        );
+
+        if (total <= wanted)
+        {
+            m_begin = hi - data();
+
+            return total;
+        }
+        else
+        {
+            for (const auto & slice : slices)
+            {
+                if (slice.offset + slice.n_tokens >= wanted)
+                {
+                    m_begin = slice.parsed_end - data();
+                    break;
+                }
+            }
+
+            return wanted;
+        }
+    }
+
+    bool locate_token(const char *& pos, const char *& token_end)
+    {
+        while (true)
+        {
+            pos = skip_spaces(data() + m_begin, data() + m_end);
+            m_begin = pos - data();
+            token_end = skip_token(pos, data() + m_end);
+
+            if (pos != token_end && (token_end != data() + m_end || m_eof))
+            {
+                return true;
+            }
+
+            if (!refill())
+            {
+                return pos != token_end;
+            }
+        }
+    }
+
+    /*
+     * Moves the unconsumed tail to the front and appends the next block,
+     * growing the buffer if a single token does not fit.
+     */
+    bool refill()
+    {
+        if (m_eof)
+        {
+            return false;
+        }
+
+        const size_type tail = m_end - m_begin;
+
+        std::memmove(&m_buffer[0], &m_buffer[m_begin], tail);
+        m_begin = 0;
+        m_end = tail;
+
+        if (m_end == m_buffer.size())
+        {
+            m_buffer.resize(m_buffer.size() * 2);
+        }
+
+        const size_type n_read = std::fread(&m_buffer[m_end], 1, m_buffer.size() - m_end, m_stream);
+
+        m_end += n_read;
+        m_bytes_read += n_read;
+        AM_COUNT(BYTES_PARSED, n_read);
+
+        if (n_read == 0)
+        {
+            m_eof = true;
+        }
+
+        return true;
+    }
+
+private:
+    std::FILE * m_stream;
+    std::vector<char> m_buffer;
+    size_type m_begin;
+    size_type m_end;
+    bool m_eof;
+    size_type m_bytes_read;
+};
+
+// numbers read_similarity_rows parses per batch unless asked for fewer
+constexpr std::size_t SIMILARITY_BATCH_VALUES{std::size_t(1) << 22};
+
+/*
+ * Size, in numbers, of the batch read_similarity_rows parses for an N x N
+ * block: as many whole rows as fit in `max_values`, but at least one.
+ */
+inline
+std::size_t similarity_batch_values(const std::size_t N, const std::size_t max_values)
+{
+    const std::size_t rows_per_batch = std::max<std::size_t>(1, max_values / std::max<std::size_t>(N, 1));
+
+    return std::min(rows_per_batch, N) * N;
+}
+
+/*
+ * Reads the N x N similarity block of the input, calling
+ * consumer(row_index, cbegin, cend) for every row. Rows are parsed in
+ * batches of up to `max_batch_values` numbers (see
+ * similarity_batch_values()), 4M by default to keep all workers busy.
+ * Returns false when the input ends short of the block, the rows of the
+ * short batch not being passed on.
+ */
+template<typename _Consumer>
+bool read_similarity_rows(
+    BlockReader & reader,
+    const std::size_t N,
+    ThreadPool & thread_pool,
+    _Consumer && consumer,
+    const std::size_t max_batch_values = SIMILARITY_BATCH_VALUES)
+{
+    std::vector<double> batch(similarity_batch_values(N, max_batch_values));
+    const std::size_t rows_per_batch = N != 0 ? batch.size() / N : 0;
+
+    for (std::size_t i = 0; i < N;)
+    {
+        const std::size_t n_rows = std::min<std::size_t>(rows_per_batch, N - i);
+
+        if (reader.parse_doubles(batch.data(), n_rows * N, thread_pool) != n_rows * N)
+        {
+            return false;
+        }
+
+        for (std::size_t r = 0; r < n_rows; ++r, ++i)
+        {
+            consumer(i, batch.data() + r * N, batch.data() + (r + 1) * N);
+        }
+    }
+
+    return true;
+}
+
+#endif /* TEXT_INPUT_HPP_ */
@@ -0,0 +1,442 @@
+/*******************************************************************************
+ * Copyright (c) 2015 Wojciech Migda
+ * All rights reserved
+ * Distributed under the terms of the GNU LGPL v3
+ *******************************************************************************
+ *
+ * Filename: tiled_matrix.hpp
+ *
+ * Description:
+ *      Similarity trapezoids kept on disk as fixed-size tiles
+ *
+ * Authors:
+ *          Wojciech Migda (wm)
+ *
+ *******************************************************************************
+ * History:
+ * --------
+ * Date         Who  Ticket     Description
+ * ----------   ---  ---------  ------------------------------------------------
+ * 2026-10-17   wm              Initial version
+ *
+ ******************************************************************************/
+
+#ifndef TILED_MATRIX_HPP_
+#define TILED_MATRIX_HPP_
+
+#include "quantize.hpp"
+
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdlib>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <utility>
+#include <algorithm>
+
+/*
+ * Position of a tile in the tile grid, not in elements.
+ */
+struct TileIndex
+{
+    std::size_t row;
+    std::size_t col;
+};
+
+/*
+ * The upper trapezoid of an n_row x n_col matrix, i.e. the elements (r, c)
+ * with r < n_row and r <= c < n_col, stored in an unlinked temporary file
+ * as tile_size x tile_size tiles. Only tiles touching the trapezoid exist:
+ * in tile row b these are the tile columns b and up. Tiles are row major
+ * inside and laid out one tile row after the other, so a tile row is one
+ * contiguous run of the file. Elements outside the trapezoid or the matrix
+ * but inside a stored tile are padding.
+ *
+ * Tiles are read and written with positioned I/O, so any number of threads
+ * may do so at once. An I/O error clears good() for good.
+ */
+template<typename _Type>
+struct TiledMatrixFile
+{
+    typedef std::size_t size_type;
+    typedef _Type value_type;
+
+    TiledMatrixFile(
+        const std::string & directory,
+        const size_type n_row,
+        const size_type n_col,
+        const size_type tile_size)
+    :
+        m_fd(-1),
+        m_n_row(n_row),
+        m_n_col(n_col),
+        m_tile_size(tile_size),
+        m_tile_rows((n_row + tile_size - 1) / tile_size),
+        m_tile_cols((n_col + tile_size - 1) / tile_size),
+        m_directory(directory),
+        m_failed(false)
+    {
+        std::string path = directory + "/am_tiles_XXXXXX";
+
+        m_fd = ::mkstemp(&path[0]);
+
+        if (m_fd < 0)
+        {
+            m_failed = true;
+            return;
+        }
+
+        ::unlink(path.c_str());
+
+        if (::ftruncate(m_fd, tile_offset(TileIndex{m_tile_rows, m_tile_rows})) != 0)
+        {
+            m_failed = true;
+        }
+    }
+
+    TiledMatrixFile(const TiledMatrixFile &) = delete;
+    TiledMatrixFile & operator=(const TiledMatrixFile &) = delete;
+
+    ~TiledMatrixFile()
+    {
+        if (m_fd >= 0)
+        {
+            ::close(m_fd);
+        }
+    }
+
+    bool good() const
+    {
+        return !m_failed;
+    }
+
+    size_type rows() const
+    {
+        return m_n_row;
+    }
+
+    size_type cols() const
+    {
+        return m_n_col;
+    }
+
+    size_type tile_size() const
+    {
+        return m_tile_size;
+    }
+
+    size_type tile_elements() const
+    {
+        return m_tile_size * m_tile_size;
+    }
+
+    size_type tile_rows() const
+    {
+        return m_tile_rows;
+    }
+
+    size_type tile_cols() const
+    {
+        return m_tile_cols;
+    }
+
+    // where sibling files, e.g. the Jaccard trapezoid, go
+    const std::string & directory() const
+    {
+        return m_directory;
+    }
+
+    bool read_tile(const TileIndex & tile, value_type * data) const
+    {
+        return transfer(tile, data, [this](char * buffer, const size_type size, const off_t offset)
+            {
+                return ::pread(m_fd, buffer, size, offset);
+            }
+        );
+    }
+
+    bool write_tile(const TileIndex & tile, const value_type * data)
+    {
+        return write_tiles(tile, 1, data);
+    }
+
+    // `count` consecutive tiles of one tile row, starting at `first`
+    bool write_tiles(const TileIndex & first, const size_type count, const value_type * data)
+    {
+        return transfer(first, const_cast<value_type *>(data), [this](char * buffer, const size_type size, const off_t offset)
+            {
+                return ::pwrite(m_fd, buffer, size, offset);
+            },
+            count
+        );
+    }
+
+private:
+    off_t tile_offset(const TileIndex & tile) const
+    {
+        // tile row b holds m_tile_cols - b tiles
+        const size_type preceding = tile.row * m_tile_cols - tile.row * (tile.row - 1) / 2;
+
+        return off_t(preceding + tile.col - tile.row) * tile_elements() * sizeof (value_type);
+    }
+
+    template<typename _Transfer>
+    bool transfer(const TileIndex & tile, value_type * data, _Transfer && io, const size_type count = 1) const
+    {
+        char * buffer = reinterpret_cast<char *>(data);
+        size_type left = count * tile_elements() * sizeof (value_type);
+        off_t offset = tile_offset(tile);
+
+        while (left != 0 && !m_failed)
+        {
+            const ssize_t done = io(buffer, left, offset);
+
+            if (done < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (done <= 0)
+            {
+                m_failed = true;
+                break;
+            }
+
+            buffer += done;
+            left -= done;
+            offset += done;
+        }
+
+        return !m_failed;
+    }
+
+private:
+    int m_fd;
+    const size_type m_n_row;
+    const size_type m_n_col;
+    const size_type m_tile_size;
+    const size_type m_tile_rows;
+    const size_type m_tile_cols;
+    const std::string m_directory;
+    mutable std::atomic<bool> m_failed;
+};
+
+/*
+ * Fills a TiledMatrixFile from full matrix rows arriving in order, as
+ * read_similarity_rows() delivers them. A tile row worth of rows is
+ * gathered into its tiles, encoded with SimilarityCodec, and written in
+ * one go; rows past the trapezoid, i.e. the test molecules' ones, are
+ * dropped. close() writes out a last partial tile row.
+ */
+template<typename _Type>
+struct TiledMatrixWriter
+{
+    typedef std::size_t size_type;
+    typedef _Type value_type;
+
+    explicit TiledMatrixWriter(TiledMatrixFile<value_type> & file)
+    :
+        m_file(file),
+        m_band(file.tile_cols() * file.tile_elements()),
+        m_tile_row(0),
+        m_pending(0)
+    {
+    }
+
+    ~TiledMatrixWriter()
+    {
+        close();
+    }
+
+    bool good() const
+    {
+        return m_file.good();
+    }
+
+    // `cbegin` .. `cend` is the full row `index` of the similarity matrix
+    void writeRow(const size_type index, const double * cbegin, const double * cend)
+    {
+        if (index >= m_file.rows())
+        {
+            return;
+        }
+
+        const size_type T = m_file.tile_size();
+        const size_type n_col = std::min<size_type>(cend - cbegin, m_file.cols());
+
+        if (index / T != m_tile_row)
+        {
+            flush();
+            m_tile_row = index / T;
+        }
+
+        // tiles of the tile row start at its diagonal tile
+        const size_type first_col = m_tile_row * T;
+        value_type * row = &m_band[(index % T) * T];
+
+        for (size_type cidx{first_col}; cidx < n_col; ++cidx)
+        {
+            const size_type tile = (cidx - first_col) / T;
+
+            row[tile * m_file.tile_elements() + cidx % T] = SimilarityCodec<value_type>::encode(cbegin[cidx]);
+        }
+
+        ++m_pending;
+    }
+
+    bool close()
+    {
+        flush();
+
+        return good();
+    }
+
+private:
+    void flush()
+    {
+        if (m_pending == 0)
+        {
+            return;
+        }
+
+        const size_type count = m_file.tile_cols() - m_tile_row;
+
+        m_file.write_tiles(TileIndex{m_tile_row, m_tile_row}, count, m_band.data());
+
+        std::fill(m_band.begin(), m_band.end(), value_type());
+        m_pending = 0;
+    }
+
+private:
+    TiledMatrixFile<value_type> & m_file;
+    // tiles of the current tile row
+    std::vector<value_type> m_band;
+    size_type m_tile_row;
+    size_type m_pending;
+};
+
+/*
+ * Largest multiple of 64 not above `n_col` (rounded up to 64) for which a
+ * TiledMatrixWriter's tile row buffer plus the two tiles a tile sweep
+ * holds fit within `budget` bytes, but at least 64. Callers take the
+ * input parse buffers off the budget first; vectors of O(n_col) elements
+ * kept by the rankers come on top of it.
+ */
+inline
+std::size_t tile_size_for_budget(const std::size_t budget, const std::size_t n_col, const std::size_t element_size)
+{
+    constexpr std::size_t STEP{64};
+
+    const std::size_t padded_cols = (n_col + STEP - 1) / STEP * STEP;
+
+    for (std::size_t tile_size{std::max(padded_cols, STEP)}; tile_size > STEP; tile_size -= STEP)
+    {
+        const std::size_t band = tile_size * ((n_col + tile_size - 1) / tile_size * tile_size);
+
+        if ((band + 2 * tile_size * tile_size) * element_size <= budget)
+        {
+            return tile_size;
+        }
+    }
+
+    return STEP;
+}
+
+/*
+ * Calls fn(tile, data) for the tiles in `order`, one after the other. A
+ * single reader thread, started once per sweep, reads the next tile while
+ * fn works on the current one, so a sweep costs about max(I/O, compute)
+ * rather than their sum. Only the two tile buffers are held. Returns false
+ * on I/O errors, in which case fn has seen garbage for the failed tiles.
+ */
+template<typename _Type, typename _TileFunction>
+bool for_each_stored_tile(
+    const TiledMatrixFile<_Type> & file,
+    const std::vector<TileIndex> & order,
+    _TileFunction && fn)
+{
+    if (order.empty())
+    {
+        return file.good();
+    }
+
+    std::vector<_Type> buffers[2] = {
+        std::vector<_Type>(file.tile_elements()),
+        std::vector<_Type>(file.tile_elements())
+    };
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    // tiles read so far and tiles fn is done with, the reader stays within two of the latter
+    std::size_t n_read{0};
+    std::size_t n_released{0};
+    bool stop{false};
+    bool result{true};
+
+    std::thread reader([&]()
+    {
+        for (std::size_t idx{0}; idx < order.size(); ++idx)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&]{ return stop || idx < n_released + 2; });
+
+                if (stop)
+                {
+                    return;
+                }
+            }
+
+            const bool good = file.read_tile(order[idx], buffers[idx % 2].data());
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                result = good && result;
+                ++n_read;
+            }
+            changed.notify_all();
+        }
+    });
+
+    try
+    {
+        for (std::size_t idx{0}; idx < order.size(); ++idx)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&]{ return n_read > idx; });
+            }
+
+            fn(order[idx], static_cast<const _Type *>(buffers[idx % 2].data()));
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                ++n_released;
+            }
+            changed.notify_all();
+        }
+    }
+    catch (...)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        changed.notify_all();
+        reader.join();
+        throw;
+    }
+
+    reader.join();
+
+    return result;
+}
+
+#endif /* TILED_MATRIX_HPP_ */